@@ -23,6 +23,10 @@ void* storageBlocks[STORAGE_MaxBlocks];
 unsigned int aelibLoopCount = 0;
 LOOP aelibLoops[AELIB_MaxLoops];
 
+// Loop profiler: worst case duration of aeLoop() pass and of every registered loop, us
+unsigned long aelibPassMax = 0;
+unsigned long aelibLoopMax[AELIB_MaxLoops];
+
 
 struct StorageSnapshotHeader {
     char id;
@@ -175,7 +179,25 @@ void aeInit() {
 }
 #pragma endregion
 
+void aeLoopProfile(unsigned long* passMax, int* slowestLoop, unsigned long* slowestMax) {
+    *passMax = aelibPassMax;
+    *slowestLoop = -1;
+    *slowestMax = 0;
+    for (int i = 0; i < aelibLoopCount; i++) {
+        if (aelibLoopMax[i] > *slowestMax) {
+            *slowestLoop = i;
+            *slowestMax = aelibLoopMax[i];
+        }
+    }
+}
+
+void aeLoopProfileReset() {
+    aelibPassMax = 0;
+    memset(aelibLoopMax, 0, sizeof(aelibLoopMax));
+}
+
 void aeLoop() {
+    unsigned long passStarted = micros();
     // Check if storage blocks changed
     static unsigned long checkedOn = 0;
     unsigned long t = millis();
@@ -192,8 +214,14 @@ void aeLoop() {
 
     for (int i = 0; i < aelibLoopCount; i++) {
         if (aelibLoops[i] != NULL) {
+            unsigned long started = micros();
             aelibLoops[i]();
+            unsigned long d = micros() - started;
+            if (d > aelibLoopMax[i]) aelibLoopMax[i] = d;
             yield();
         }
     }
+
+    unsigned long d = micros() - passStarted;
+    if (d > aelibPassMax) aelibPassMax = d;
 }
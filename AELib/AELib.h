@@ -32,6 +32,10 @@ void aeInit();
 void aeRegisterLoop( LOOP loop );
 void aeLoop();
 
+// Loop profiler: worst case duration (us) of aeLoop() pass and the slowest registered loop (index in registration order)
+void aeLoopProfile(unsigned long* passMax, int* slowestLoop, unsigned long* slowestMax);
+void aeLoopProfileReset();
+
 
 // Clear storage blocks
 void storageReset();
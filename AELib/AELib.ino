@@ -3,6 +3,7 @@
 #include "LED.h"
 #include "Buttons.h"
 #include "Relays.h"
+#include "Bindings.h"
 
 #define BTN0 16
 #define BTN1 5
@@ -44,6 +45,14 @@ void setup() {
   btnRegister( BTN1, false, true );
   
   btnRegister( BTN2, false, true );
+
+  // While HA is offline buttons switch relays locally. Bindings are stored in EEPROM and may be changed via MQTT
+  bindInit();
+  if( bindCount() == 0 ) {
+    bindSet( 1, "Btn23Pressed,RelaySwitch,3,Offline" );
+    bindSet( 2, "Btn2Pressed,RelaySwitch,1,Offline" );
+    bindSet( 3, "Btn3Pressed,RelaySwitch,2,Offline" );
+  }
   
   mqttRegisterCallbacks( mqttCallback, mqttConnect );
 
@@ -53,13 +62,8 @@ void setup() {
 void loop() {
   aeLoop();
 
-  if (!haConnected()) {
-    if( btnPressed( BTN1, BTN2 ) ) relaySwitch( RELAY3 ); 
-    if( btnPressed( BTN1 ) ) relaySwitch( RELAY1 );
-    if( btnPressed( BTN2 ) ) relaySwitch( RELAY2 );
-  } else {
-    btnPublishKeypressEvent(true);
-  }
+  // Events handled by bindings are not published
+  btnPublishKeypressEvent(true);
 
   if( btnState( BTN1 ) || btnState( BTN2 ) ) {
     ledMode( On );
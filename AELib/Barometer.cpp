@@ -7,6 +7,7 @@
 static char* TOPIC_BaroTemperature PROGMEM = "Sensors/Temperature";
 static char* TOPIC_BaroPressure PROGMEM = "Sensors/Pressure";
 static char* TOPIC_BaroValid PROGMEM = "Sensors/BarometerValid";
+static char* TOPIC_BaroState PROGMEM = "State/Barometer";
 
 #define baroAccuracy (float)0.6
 #define baroTempAccuracy (float)0.25
@@ -25,32 +26,54 @@ bool baroValid() {
 void baroPublishStatus() {
   if ( !mqttConnected() ) return;
   if( baroUpdatedOn==0 ) return;
+  bool changed = false;
   
   static int _valid = -1;
   int valid = baroValid() ? 1 : 0;
   if ( valid != _valid ) {
-    if ( mqttPublish( TOPIC_BaroValid, valid, true ) ) _valid = valid;
+    _valid = valid;
+    changed = true;
+#if (MQTT_StateFormat & MQTT_StateTopics)
+    mqttPublish( TOPIC_BaroValid, valid, true );
+#endif
   }
-  if ( valid == 0 ) return;
 
-  char b[31];
-  bool hindex = false;
   float delta;
 
-  static float _baroPressure = -1000;
-  delta = baroPressure - _baroPressure;  if (delta < 0) delta = -delta;
-  if ( (delta > baroAccuracy) ) {
-    dtostrf( baroPressure, 0, 0, b );
-    if ( mqttPublish( TOPIC_BaroPressure, b, true ) ) _baroPressure = baroPressure;
+  if ( valid != 0 ) {
+    static float _baroPressure = -1000;
+    delta = baroPressure - _baroPressure;  if (delta < 0) delta = -delta;
+    if ( (delta > baroAccuracy) ) {
+      _baroPressure = baroPressure;
+      changed = true;
+#if (MQTT_StateFormat & MQTT_StateTopics)
+      mqttPublish( TOPIC_BaroPressure, baroPressure, 0, true );
+#endif
+    }
+
+    static float _baroTemperature = -1000;
+    delta = baroTemperature - _baroTemperature;  if (delta < 0) delta = -delta;
+    if ( (delta > baroTempAccuracy) ) {
+      _baroTemperature = baroTemperature;
+      changed = true;
+#if (MQTT_StateFormat & MQTT_StateTopics)
+      mqttPublish( TOPIC_BaroTemperature, baroTemperature, 1, true );
+#endif
+    }
   }
 
-  static float _baroTemperature = -1000;
-  delta = baroTemperature - _baroTemperature;  if (delta < 0) delta = -delta;
-  if ( (delta > baroTempAccuracy) ) {
-    dtostrf( baroTemperature, 0, 1, b );
-    if ( mqttPublish( TOPIC_BaroTemperature, b, true ) ) _baroTemperature = baroTemperature;
+#if (MQTT_StateFormat & MQTT_StateJson)
+  if ( changed ) {
+    MqttState state;
+    mqttStateBegin( &state );
+    mqttStateAdd( &state, "Valid", (long)valid );
+    if ( valid != 0 ) {
+      mqttStateAdd( &state, "Pressure", baroPressure, 0 );
+      mqttStateAdd( &state, "Temperature", baroTemperature, 1 );
+    }
+    mqttPublishState( TOPIC_BaroState, &state, true );
   }
-
+#endif
 }
 
 
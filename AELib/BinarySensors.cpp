@@ -3,11 +3,14 @@
 #include "AELib.h"
 #include "Comms.h"
 #include "BinarySensors.h"
+#include "Expander.h"
 
 //#define Debug
 
-// Maximum number of buttons supported
-#define BNS_MAX_SENSORS 8
+// Maximum number of sensors supported
+#ifndef BNS_MAX_SENSORS
+#define BNS_MAX_SENSORS 16
+#endif
 
 // Anticlush filtering timeout, ms
 #define BNS_CLASH_TIMEOUT ((unsigned long)75)
@@ -69,7 +72,7 @@ void bnsRegister(byte pin, bool inverted, bool pullUp, unsigned int reportEveryS
     bnsSensors[bnsCount].state = false;
     bnsSensors[bnsCount].reportedState = 2;
 
-    pinMode( pin, pullUp ? INPUT_PULLUP : INPUT);
+    expPinMode( pin, pullUp ? INPUT_PULLUP : INPUT);
     bnsCount++;
 }
 
@@ -92,7 +95,8 @@ void bnsLoop() {
 
     _tmSensorsUpdated = t;
     for (int i = 0; i < bnsCount; i++) {
-        bool state = (digitalRead(bnsSensors[i].pin) == ((bnsSensors[i].inverted) ? LOW : HIGH));
+        // Expander pins are served from the last burst read, no I2C traffic per sensor
+        bool state = (expDigitalRead(bnsSensors[i].pin) == ((bnsSensors[i].inverted) ? LOW : HIGH));
         if ((state != bnsSensors[i].state)) {
             if (bnsSensors[i].triggeredOn == 0) {
                 bnsSensors[i].triggeredOn = t;
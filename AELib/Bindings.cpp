@@ -0,0 +1,345 @@
+#include <Arduino.h>
+
+#include "AELib.h"
+#include "Comms.h"
+#include "Bindings.h"
+#include "Buttons.h"
+#include "Relays.h"
+#include "Dimmer.h"
+#include "Peers.h"
+
+// Turn on debug output
+//#define Debug
+
+// Number of binding slots stored in EEPROM (12 bytes each)
+#ifndef BINDINGS_Max
+#define BINDINGS_Max 16
+#endif
+// Trigger name (local or paired device buttons) and binding text buffers
+#define BINDINGS_NameSize (BTN_EventNameSize + 8)
+#define BINDINGS_TextSize (BINDINGS_NameSize + 32)
+
+// Payload: <slot>,<binding text>; binding of slot # is published to Binding# (retained)
+static char* TOPIC_BindingsSet PROGMEM = "Bindings/Set";
+static char* TOPIC_BindingsClear PROGMEM = "Bindings/Clear";
+// first %s is slot number
+#define TOPIC_Binding "Binding%s"
+
+static const char* bindActionNames[] = { "", "RelaySwitch", "RelayOn", "RelayOff", "DimmerSwitch", "DimmerRamp", "DimmerSet",
+    "PeerRelaySwitch", "PeerRelayOn", "PeerRelayOff" };
+static const char* bindPolicyNames[] = { "", "Always", "Offline", "Report" };
+#define BINDINGS_Actions (sizeof(bindActionNames) / sizeof(bindActionNames[0]))
+#define BINDINGS_Policies (sizeof(bindPolicyNames) / sizeof(bindPolicyNames[0]))
+
+struct Binding {
+    uint32_t buttons; // Event buttons mask, 0: empty slot
+    byte gesture;     // BtnGesture
+    byte count;       // Event count to match, 0: any
+    byte action;      // BindingAction
+    byte argument;    // Relay number or dimmer brightness
+    byte policy;      // BindingPolicy
+    byte peer;        // 1: buttons of paired device (Peers module), trigger is prefixed with "Peer"
+};
+
+struct BindingsConfig {
+    Binding bindings[BINDINGS_Max];
+} bindConfig;
+
+// Slots to be published, bit per slot
+uint32_t bindUnreported = 0;
+// Ramp bindings which hold was started locally, bit per slot: ticks and end follow it regardless of policy
+uint32_t bindHolding = 0;
+
+#pragma region Text format
+int bindFindName(const char** names, int count, char* name) {
+    for (int i = 1; i < count; i++) {
+        if (strcasecmp(names[i], name) == 0) return i;
+    }
+    return 0;
+}
+
+// Buttons of paired device are not registered here, and number of them is not known: its buttons (one or
+// two pressed together) are separated by underscore, PeerBtn12Pressed is button 12, PeerBtn1_2Pressed is a chord
+void bindEventName(char* eventName, Binding* binding, BtnGesture gesture) {
+    if (binding->peer == 0) {
+        btnEventName(eventName, binding->buttons, gesture);
+        return;
+    }
+    char suffix[BINDINGS_NameSize];
+    btnEventName(suffix, 0, gesture);
+    strcpy(eventName, "PeerBtn");
+    for (int i = 0; i < 32; i++) {
+        if ((binding->buttons & (1UL << i)) != 0) sprintf(eventName + strlen(eventName), (eventName[7] == 0) ? "%d" : "_%d", i + 1);
+    }
+    strcat(eventName, suffix + 3);
+}
+
+// Button numbers of the trigger: one digit per button (two if more than 9 buttons are registered),
+// paired device buttons are numbers separated by underscore
+bool bindParseButtons(char* p, Binding* binding) {
+    char name[BINDINGS_NameSize];
+    btnEventName(name, 1, btnClick);
+    int localDigits = (name[3] == '0') ? 2 : 1;
+    binding->buttons = 0;
+    while ((*p >= '0') && (*p <= '9')) {
+        int digits = (binding->peer != 0) ? (((p[1] >= '0') && (p[1] <= '9')) ? 2 : 1) : localDigits;
+        int number = 0;
+        for (int i = 0; i < digits; i++, p++) {
+            if ((*p < '0') || (*p > '9')) return false;
+            number = number * 10 + (*p - '0');
+        }
+        if ((number < 1) || (number > 32)) return false;
+        binding->buttons |= 1UL << (number - 1);
+        if ((binding->peer != 0) && (*p == '_')) p++;
+    }
+    return binding->buttons != 0;
+}
+
+// Trigger is matched against event names of registered buttons, so it is spelled exactly as published
+bool bindParseTrigger(char* trigger, Binding* binding) {
+    char* count = strchr(trigger, '=');
+    binding->count = 0;
+    if (count != NULL) {
+        *count++ = 0;
+        long c = strtol(count, NULL, 10);
+        if ((c < 1) || (c > 255)) return false;
+        binding->count = c;
+    }
+    binding->peer = (strncmp(trigger, "Peer", 4) == 0) ? 1 : 0;
+    if (binding->peer != 0) trigger += 4;
+    if ((strncmp(trigger, "Btn", 3) != 0) || !bindParseButtons(trigger + 3, binding)) return false;
+    // Name is built back and compared: buttons not registered and misspelled numbers don't match
+    char name[BINDINGS_NameSize];
+    for (byte gesture = btnClick; gesture <= btnHoldEnd; gesture++) {
+        bindEventName(name, binding, (BtnGesture)gesture);
+        if (strcmp(name + ((binding->peer != 0) ? 4 : 0), trigger) == 0) {
+            binding->gesture = gesture;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool bindParse(char* text, Binding* binding) {
+    // Empty fields are allowed, e.g. "Btn1Hold,DimmerRamp,,Report"
+    char* fields[4] = { NULL, NULL, NULL, NULL };
+    int n = 0;
+    for (char* p = text; (p != NULL) && (n < 4); n++) {
+        while (*p == ' ') p++;
+        fields[n] = p;
+        p = strchr(p, ',');
+        if (p != NULL) *p++ = 0;
+    }
+    if ((n < 2) || !bindParseTrigger(fields[0], binding)) return false;
+    binding->action = bindFindName(bindActionNames, BINDINGS_Actions, fields[1]);
+    if (binding->action == 0) return false;
+    long argument = (fields[2] != NULL) ? strtol(fields[2], NULL, 10) : 0;
+    if ((argument < 0) || (argument > 255)) return false;
+    binding->argument = argument;
+    if ((binding->action <= bindRelayOff) && (relayPin(binding->argument) < 0)) return false;
+    if ((binding->action == bindDimmerRamp) && (binding->gesture != btnHoldStart)) return false;
+    // Hold gestures come only from buttons with btnRepeat(), paired devices check it themselves
+    if ((binding->peer == 0) && (binding->gesture >= btnHoldStart) && !btnRepeating(binding->buttons)) return false;
+    if ((binding->action >= bindPeerRelaySwitch) && (binding->argument < 1)) return false;
+    // Paired devices send neither series summary nor hold ticks
+    if ((binding->peer != 0) && ((binding->gesture == btnClicks) || (binding->gesture == btnHoldTick))) return false;
+    binding->policy = ((fields[3] != NULL) && (*fields[3] != 0)) ? bindFindName(bindPolicyNames, BINDINGS_Policies, fields[3]) : bindOffline;
+    return binding->policy != 0;
+}
+
+void bindFormat(char* text, Binding* binding) {
+    bindEventName(text, binding, (BtnGesture)binding->gesture);
+    if (binding->count != 0) sprintf(text + strlen(text), "=%d", binding->count);
+    sprintf(text + strlen(text), ",%s,%d,%s", bindActionNames[binding->action], binding->argument, bindPolicyNames[binding->policy]);
+}
+
+bool bindValid(Binding* binding) {
+    return (binding->gesture >= btnClick) && (binding->gesture <= btnHoldEnd)
+        && (binding->action >= 1) && (binding->action < BINDINGS_Actions)
+        && (binding->policy >= 1) && (binding->policy < BINDINGS_Policies) && (binding->peer <= 1);
+}
+#pragma endregion
+
+#pragma region Bindings API
+bool bindSet(byte slot, char* text) {
+    if ((slot < 1) || (slot > BINDINGS_Max)) return false;
+    Binding binding;
+    memset(&binding, 0, sizeof(binding));
+    char s[BINDINGS_TextSize];
+    strncpy(s, text, sizeof(s) - 1);
+    s[sizeof(s) - 1] = 0;
+    if ((s[0] != 0) && !bindParse(s, &binding)) return false;
+    bindConfig.bindings[slot - 1] = binding;
+    bindUnreported |= 1UL << (slot - 1);
+    bindHolding &= ~(1UL << (slot - 1));
+    storageSave();
+    return true;
+}
+
+void bindClear() {
+    for (int i = 0; i < BINDINGS_Max; i++) {
+        if (bindConfig.bindings[i].buttons != 0) bindUnreported |= 1UL << i;
+    }
+    memset(&bindConfig, 0, sizeof(bindConfig));
+    bindHolding = 0;
+    storageSave();
+}
+
+int bindCount() {
+    int count = 0;
+    for (int i = 0; i < BINDINGS_Max; i++) {
+        if (bindConfig.bindings[i].buttons != 0) count++;
+    }
+    return count;
+}
+#pragma endregion
+
+#pragma region Execution
+// Ramp binding is triggered by hold start, but owns the whole hold: ticks and end as well
+bool bindMatches(Binding* binding, const BtnEvent* event) {
+    if (binding->buttons != event->buttons) return false;
+    if ((binding->action == bindDimmerRamp) && (event->gesture >= btnHoldStart)) return true;
+    return (binding->gesture == event->gesture) && ((binding->count == 0) || (binding->count == event->count));
+}
+
+void bindRun(Binding* binding, const BtnEvent* event) {
+#ifdef Debug
+    char text[BINDINGS_TextSize];
+    bindFormat(text, binding);
+    aePrintf("Binding: %s\r\n", text);
+#endif
+    int pin = relayPin(binding->argument);
+    switch (binding->action) {
+    case bindRelaySwitch:
+        if (pin >= 0) relaySwitch(pin);
+        break;
+    case bindRelayOn:
+    case bindRelayOff:
+        if (pin >= 0) relaySetState(pin, binding->action == bindRelayOn);
+        break;
+    case bindDimmerSwitch:
+        dimmerSwitch();
+        break;
+    case bindDimmerRamp:
+        if (event->gesture == btnHoldStart) dimmerStartGlowing();
+        if (event->gesture == btnHoldEnd) dimmerStopGlowing();
+        break;
+    case bindDimmerSet:
+        dimmerSetLevel(binding->argument);
+        break;
+    case bindPeerRelaySwitch:
+        peerSendRelay(binding->argument, PEER_Toggle);
+        break;
+    case bindPeerRelayOn:
+    case bindPeerRelayOff:
+        peerSendRelay(binding->argument, (binding->action == bindPeerRelayOn) ? PEER_On : PEER_Off);
+        break;
+    }
+}
+
+bool bindHandle(const BtnEvent* event, byte peer) {
+    bool consumed = false;
+    for (int i = 0; i < BINDINGS_Max; i++) {
+        Binding* binding = &bindConfig.bindings[i];
+        if ((binding->buttons == 0) || (binding->peer != peer) || !bindMatches(binding, event)) continue;
+        // Hold is handled as a whole where it started: HA coming online in the middle gets neither ticks nor end
+        uint32_t slot = 1UL << i;
+        if ((binding->action == bindDimmerRamp) && (event->gesture != btnHoldStart)) {
+            if ((bindHolding & slot) == 0) continue;
+            if (event->gesture == btnHoldEnd) bindHolding &= ~slot;
+        } else {
+            if ((binding->policy == bindOffline) && haConnected()) continue;
+            if (binding->action == bindDimmerRamp) bindHolding |= slot;
+        }
+        bindRun(binding, event);
+        if (binding->policy != bindReport) consumed = true;
+    }
+    return consumed;
+}
+
+// Called by Buttons module right at gesture detection
+bool bindButtonHandler(const BtnEvent* event) {
+    return bindHandle(event, 0);
+}
+
+// Button event of paired device: buttons numbers (two for combination) and gesture
+bool bindPeerHandler(const uint8_t* mac, const PeerMessage* message) {
+    if ((message->type != peerButton) || (message->index < 1) || (message->index > 32) || (message->index2 > 32)) return false;
+    BtnEvent event;
+    memset(&event, 0, sizeof(event));
+    event.buttons = 1UL << (message->index - 1);
+    if (message->index2 != 0) event.buttons |= 1UL << (message->index2 - 1);
+    switch (message->value) {
+    case peerPressed: event.gesture = btnClick; break;
+    case peerLongPressed: event.gesture = btnLongPress; break;
+    case peerVeryLongPressed: event.gesture = btnVeryLongPress; break;
+    case peerHoldStart: event.gesture = btnHoldStart; break;
+    case peerHoldEnd: event.gesture = btnHoldEnd; break;
+    default: return false;
+    }
+    event.count = message->count;
+    return bindHandle(&event, 1);
+}
+#pragma endregion
+
+#pragma region MQTT support
+void bindMqttConnect() {
+    mqttSubscribeTopic(TOPIC_BindingsSet);
+    mqttSubscribeTopic(TOPIC_BindingsClear);
+    for (int i = 0; i < BINDINGS_Max; i++) {
+        if (bindConfig.bindings[i].buttons != 0) bindUnreported |= 1UL << i;
+    }
+}
+
+bool bindMqttCallback(char* topic, byte* payload, unsigned int length) {
+    if (mqttIsTopic(topic, TOPIC_BindingsSet)) {
+        char text[BINDINGS_TextSize];
+        memset(text, 0, sizeof(text));
+        strncpy(text, (char*)payload, (length < sizeof(text) - 1) ? length : sizeof(text) - 1);
+        char* binding = strchr(text, ',');
+        if (binding != NULL) *binding++ = 0;
+        long slot = strtol(text, NULL, 10);
+        if ((slot < 1) || (slot > BINDINGS_Max) || !bindSet(slot, (binding != NULL) ? binding : (char*)"")) {
+            aePrintf("Bindings: invalid \"%s\"\r\n", (binding != NULL) ? binding : text);
+        }
+        return true;
+    }
+    if (mqttIsTopic(topic, TOPIC_BindingsClear)) {
+        bindClear();
+        return true;
+    }
+    return false;
+}
+
+// Cleared slots are published empty to remove retained message
+void bindMqttPublish() {
+    while (bindUnreported != 0) {
+        int i = __builtin_ctz(bindUnreported);
+        char sns[4];
+        char text[BINDINGS_TextSize];
+        sprintf(sns, "%d", i + 1);
+        text[0] = 0;
+        if (bindConfig.bindings[i].buttons != 0) bindFormat(text, &bindConfig.bindings[i]);
+        if (!mqttPublish(TOPIC_Binding, sns, text, true)) return;
+        bindUnreported &= ~(1UL << i);
+    }
+}
+#pragma endregion
+
+#pragma region Loop, Init
+void bindLoop() {
+    if ((bindUnreported != 0) && mqttConnected()) bindMqttPublish();
+}
+
+void bindInit() {
+    storageRegisterBlock(BINDINGS_StorageId, &bindConfig, sizeof(bindConfig));
+    for (int i = 0; i < BINDINGS_Max; i++) {
+        Binding* binding = &bindConfig.bindings[i];
+        if ((binding->buttons != 0) && !bindValid(binding)) memset(binding, 0, sizeof(Binding));
+    }
+    btnRegisterHandler(bindButtonHandler);
+    peerRegisterHandler(bindPeerHandler);
+    mqttRegisterCallbacks(bindMqttCallback, bindMqttConnect);
+    aeRegisterLoop(bindLoop);
+}
+#pragma endregion
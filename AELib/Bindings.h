@@ -0,0 +1,41 @@
+#ifndef bindings_h
+#define bindings_h
+
+#define BINDINGS_StorageId 'B'
+
+// Local bindings of button gestures to relay and dimmer actions, executed as soon as gesture is
+// detected without MQTT round trip. Binding text (MQTT payloads and bindSet):
+//   <trigger>,<action>,<argument>,<policy>
+// trigger: button event name as published, optionally with count: Btn1Pressed, Btn12LongPressed, Btn1Pressed=2.
+//   Prefixed with "Peer" for buttons of paired device (Peers module): PeerBtn1Pressed, PeerBtn1_2Hold
+//   Hold gestures are accepted only for buttons with btnRepeat(), so call it before bindSet()
+// action: RelaySwitch, RelayOn, RelayOff (argument: relay number), DimmerSwitch, DimmerRamp (trigger Btn#Hold),
+//   DimmerSet (argument: brightness, 0 switches off), PeerRelaySwitch, PeerRelayOn, PeerRelayOff (argument:
+//   relay number of paired devices)
+// policy: Always (handled locally only), Offline (locally while HA is offline, default), Report (locally and published)
+enum BindingAction {
+    bindRelaySwitch = 1,
+    bindRelayOn,
+    bindRelayOff,
+    bindDimmerSwitch,
+    bindDimmerRamp,
+    bindDimmerSet,
+    bindPeerRelaySwitch,
+    bindPeerRelayOn,
+    bindPeerRelayOff
+};
+
+enum BindingPolicy {
+    bindAlways = 1,
+    bindOffline,
+    bindReport
+};
+
+// Set binding slot (1..BINDINGS_Max) from text, empty text clears the slot. Returns false if text is invalid
+bool bindSet(byte slot, char* binding);
+void bindClear();
+int bindCount();
+
+// Bindings use button events, so buttons must be registered before MQTT configuration is received
+void bindInit();
+#endif
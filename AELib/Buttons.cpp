@@ -1,15 +1,47 @@
 #include <Arduino.h>
+#include <sys/time.h>
+#ifdef ESP32
+#include <soc/gpio_reg.h>
+#endif
 
 #include "AELib.h"
 #include "Comms.h"
 #include "Buttons.h"
+#include "Expander.h"
+#include "Ladder.h"
+#include "Peers.h"
 
 // #define Debug
 
-// Maximum number of buttons supported
-#define ButtonsSize 8
-// Anticlush filtering timeout, ms
-#define ClashTimeout ((unsigned long)40)
+// Anticlush filtering: button level must stay unchanged this long to be accepted, ms
+#ifndef ClashTimeout
+#define ClashTimeout ((unsigned long)25)
+#endif
+// Edges recorded by interrupt and not yet processed by btnsLoop (power of 2)
+#ifndef BUTTONS_EdgesSize
+#define BUTTONS_EdgesSize 32
+#endif
+// Hold-to-repeat defaults for btnRepeat(pin), ms
+#ifndef BUTTONS_RepeatDelay
+#define BUTTONS_RepeatDelay ((unsigned long)400)
+#endif
+#ifndef BUTTONS_RepeatInterval
+#define BUTTONS_RepeatInterval ((unsigned long)100)
+#endif
+
+// Gesture events not yet read by btnNextEvent()
+#ifndef BUTTONS_EventsSize
+#define BUTTONS_EventsSize 16
+#endif
+// Latency histograms are published this often if BUTTONS_Latency is defined, ms
+#ifndef BUTTONS_LatencyReport
+#define BUTTONS_LatencyReport ((unsigned long)600000)
+#endif
+#define BUTTONS_HandlersSize 4
+// Highest GPIO number + 1, including expander and ladder pins
+#define BUTTONS_Pins LADDER_PinsEnd
+// Buttons not supporting interrupts are polled this often, ms
+#define BUTTONS_PollInterval ((unsigned long)20)
 
 #ifndef LongPressTimeout
 #define LongPressTimeout ((unsigned long)800)
@@ -30,11 +62,19 @@
 struct Btn {
     byte pin; // Pin number
     bool inverted; // false if button connects to ground
-    bool pressed; // inverted ? (digitalRead(pin) == HIGH) : (digitalRead(pin) == LOW );
+    bool pressed; // Debounced state
     BtnDefaultFunction bdf;
     unsigned long triggeredOn;
     unsigned long lastPressedOn;
     int fastCount;
+    // Hold-to-repeat, ms
+    unsigned int repeatDelay;
+    unsigned int repeatInterval;
+
+    // Raw state from the last edge and micros of the first and the last edge since state was accepted
+    bool rawPressed;
+    unsigned long rawChangedOn;
+    unsigned long rawFirstChangedOn;
 
     bool wasPressed;
     bool wasReleased;
@@ -48,22 +88,96 @@ struct Btn {
 
 byte btnCount = 0;
 Btn buttons[ButtonsSize];
+// Button index + 1 by pin number, 0 if not registered
+byte btnPinIndex[BUTTONS_Pins];
+
+// Debounced buttons state, bit per button
+uint32_t btnStates = 0;
+// Raw (not debounced) buttons state
+uint32_t btnRawStates = 0;
+// Buttons with raw state changed and not settled yet
+uint32_t btnSettling = 0;
+
+#pragma region Interrupt
+// GPIO input register(s) read at once by interrupt
+#ifdef ESP32
+typedef uint64_t BtnInputs;
+#define btnReadInputs() (((BtnInputs)REG_READ(GPIO_IN1_REG) << 32) | REG_READ(GPIO_IN_REG))
+#elif defined(ESP8266)
+typedef uint32_t BtnInputs;
+#define btnReadInputs() (GPI)
+#endif
+
+struct BtnEdge {
+    uint32_t states; // Raw state of interrupt driven buttons, bit per button
+    unsigned long micros;
+};
+
+// Single producer (interrupt) / single consumer (btnsLoop) ring
+BtnEdge btnEdges[BUTTONS_EdgesSize];
+volatile byte btnEdgesHead = 0;
+volatile byte btnEdgesTail = 0;
+volatile bool btnEdgesLost = false;
 
-// Current button state collected via interrupts
-byte btnStates = 0;
-// Millis of last button change (clash detection)
-unsigned long btnChangedOn = 0;
+// Input register bit per button, 0 for polled buttons
+#ifdef btnReadInputs
+BtnInputs btnInputBits[ButtonsSize];
+#endif
+// Interrupt driven / I2C expander / inverted buttons
+uint32_t btnInterruptMask = 0;
+uint32_t btnExpanderMask = 0;
+uint32_t btnLadderMask = 0;
+uint32_t btnInvertedMask = 0;
+// Last state pushed to the ring, used by interrupt only
+uint32_t btnInterruptStates = 0;
 
 bool btnInterruptsSupported(byte btnPin) {
     return (btnPin != 16);
 }
 
 short int btnIndex(byte btnPin) {
-    for (int i = 0; i < btnCount; i++) {
-        if (buttons[i].pin == btnPin) return i;
+    return (btnPin < BUTTONS_Pins) ? (short int)btnPinIndex[btnPin] - 1 : -1;
+}
+
+uint32_t btnMask(byte btnPin) {
+    short int index = btnIndex(btnPin);
+    return (index >= 0) ? (1UL << index) : 0;
+}
+
+// Shared by all buttons: records state of all interrupt driven buttons on any edge
+void IRAM_ATTR btnInterrupt() {
+    unsigned long us = micros();
+    uint32_t levels = 0;
+#ifdef btnReadInputs
+    BtnInputs inputs = btnReadInputs();
+    for (byte i = 0; i < btnCount; i++) {
+        if ((inputs & btnInputBits[i]) != 0) levels |= (1UL << i);
     }
-    return -1;
+#else
+    for (byte i = 0; i < btnCount; i++) {
+        if (((btnInterruptMask >> i) & 1) && (digitalRead(buttons[i].pin) == HIGH)) levels |= (1UL << i);
+    }
+#endif
+    uint32_t states = (~levels ^ btnInvertedMask) & btnInterruptMask;
+    if (states == btnInterruptStates) return;
+
+    byte next = (btnEdgesHead + 1) & (BUTTONS_EdgesSize - 1);
+    if (next == btnEdgesTail) {
+        // Ring is full: newest edge is replaced, so the last level (often a release, nothing comes after it)
+        // is never lost. States are absolute, only intermediate edges are lost. Loop reads the oldest slot
+        byte newest = (btnEdgesHead - 1) & (BUTTONS_EdgesSize - 1);
+        btnEdges[newest].states = states;
+        btnEdges[newest].micros = us;
+        btnInterruptStates = states;
+        btnEdgesLost = true;
+        return;
+    }
+    btnEdges[btnEdgesHead].states = states;
+    btnEdges[btnEdgesHead].micros = us;
+    btnEdgesHead = next;
+    btnInterruptStates = states;
 }
+#pragma endregion
 
 #ifdef Debug
 void btnShowStatus(Btn* btn) {
@@ -77,50 +191,6 @@ void btnShowStatus(Btn* btn) {
 }
 #endif
 
-
-void IRAM_ATTR btnInterrupt(int index) {
-    unsigned long t = millis();
-    bool pressed = (digitalRead(buttons[index].pin) == ((buttons[index].inverted) ? HIGH : LOW));
-    byte bitmask = (1 << index);
-    if (pressed != ((btnStates & bitmask) != 0)) {
-        if (pressed) {
-            btnStates |= bitmask;
-        } else {
-            btnStates &= ~bitmask;
-        }
-        if (t > 1000L) {
-            btnChangedOn = t;
-        }
-    }
-}
-void IRAM_ATTR btnInterrupt0() {
-    btnInterrupt(0);
-}
-void IRAM_ATTR btnInterrupt1() {
-    btnInterrupt(1);
-}
-void IRAM_ATTR btnInterrupt2() {
-    btnInterrupt(2);
-}
-void IRAM_ATTR btnInterrupt3() {
-    btnInterrupt(3);
-}
-void IRAM_ATTR btnInterrupt4() {
-    btnInterrupt(4);
-}
-void IRAM_ATTR btnInterrupt5() {
-    btnInterrupt(5);
-}
-void IRAM_ATTR btnInterrupt6() {
-    btnInterrupt(6);
-}
-void IRAM_ATTR btnInterrupt7() {
-    btnInterrupt(7);
-}
-
-
-
-
 void btnLoop(Btn* btn, bool pressed, unsigned long t) {
     int state = pressed ? 1 : 0;
     if (pressed != btn->pressed) {
@@ -176,33 +246,372 @@ void btnLoop(Btn* btn, bool pressed, unsigned long t) {
     }
 }
 
-void btnRegister(byte btnPin, bool inverted, bool pullUp) {
-    if (btnIndex(btnPin) >= 0) return;
+#pragma region Latency
+// Gestures completed by a release edge; others are detected by timeout and have no edge to measure from
+bool btnEdgeDriven(BtnGesture gesture) {
+    switch (gesture) {
+    case btnClick:
+    case btnVeryLongPress:
+    case btnHoldEnd:
+        return true;
+#ifndef BUTTONS_EASY_MODE
+    case btnLongPress:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
 
-    if (btnCount < ButtonsSize) {
+#ifdef BUTTONS_Latency
+static char* TOPIC_ButtonsLatency PROGMEM = "Buttons/Latency";
+
+// Stages of the path from button edge to MQTT: debounce and gesture detection (edge -> queued),
+// main loop (queued -> read by btnNextEvent), publishing (read -> mqttPublish returned) and total
+enum BtnLatencyStage {
+    btnStageDebounce = 0,
+    btnStageLoop,
+    btnStagePublish,
+    btnStageTotal,
+    btnStagesCount
+};
+static const char* btnStageNames[btnStagesCount] = { "Debounce", "Loop", "Publish", "Total" };
+
+// Bucket upper bounds, ms; the last bucket counts everything longer
+#define BUTTONS_LatencyBuckets 10
+static const unsigned int btnLatencyBounds[BUTTONS_LatencyBuckets - 1] = { 1, 2, 5, 10, 20, 50, 100, 200, 500 };
 
-        buttons[btnCount].pin = btnPin;
-        buttons[btnCount].inverted = inverted;
-        buttons[btnCount].fastCount = 0;
-        buttons[btnCount].bdf = BDF_None;
-        buttons[btnCount].pressed = false;
-        buttons[btnCount].reportedState = -1;
-
-        pinMode(btnPin, pullUp ? INPUT_PULLUP : INPUT);
-        if (btnInterruptsSupported(btnPin)) {
-            switch (btnCount) {
-            case 0: attachInterrupt(btnPin, btnInterrupt0, CHANGE); break;
-            case 1: attachInterrupt(btnPin, btnInterrupt1, CHANGE); break;
-            case 2: attachInterrupt(btnPin, btnInterrupt2, CHANGE); break;
-            case 3: attachInterrupt(btnPin, btnInterrupt3, CHANGE); break;
-            case 4: attachInterrupt(btnPin, btnInterrupt4, CHANGE); break;
-            case 5: attachInterrupt(btnPin, btnInterrupt5, CHANGE); break;
-            case 6: attachInterrupt(btnPin, btnInterrupt6, CHANGE); break;
-            case 7: attachInterrupt(btnPin, btnInterrupt7, CHANGE); break;
+struct BtnLatency {
+    unsigned int buckets[BUTTONS_LatencyBuckets];
+    unsigned long max; // us
+};
+BtnLatency btnLatency[btnStagesCount];
+
+void btnLatencyRecord(BtnLatencyStage stage, unsigned long us) {
+    BtnLatency* latency = &btnLatency[stage];
+    int bucket = 0;
+    while ((bucket < BUTTONS_LatencyBuckets - 1) && (us >= btnLatencyBounds[bucket] * 1000UL)) bucket++;
+    latency->buckets[bucket]++;
+    if (us > latency->max) latency->max = us;
+}
+
+// {"Samples":n,"Debounce":"b0,b1,...","DebounceMax":us,...}: counts per bucket and worst case per stage
+// Worst case of 32-bit counters: 10 numbers of 10 digits and commas per stage, 4 stages of
+// ,"Debounce":"<counts>","DebounceMax":<long> and the samples field
+#define BUTTONS_LatencyCountsSize (BUTTONS_LatencyBuckets * 11)
+#define BUTTONS_LatencyJsonSize (24 + btnStagesCount * (BUTTONS_LatencyCountsSize + 48))
+
+void btnLatencyPublish() {
+    char b[BUTTONS_LatencyJsonSize];
+    char key[24];
+    char counts[BUTTONS_LatencyCountsSize];
+    JsonWriter json;
+    jsonBegin(&json, b, sizeof(b));
+    unsigned long samples = 0;
+    for (int bucket = 0; bucket < BUTTONS_LatencyBuckets; bucket++) samples += btnLatency[btnStageTotal].buckets[bucket];
+    jsonAdd(&json, "Samples", (long)samples);
+    for (int stage = 0; stage < btnStagesCount; stage++) {
+        unsigned int n = 0;
+        counts[0] = 0;
+        for (int bucket = 0; (bucket < BUTTONS_LatencyBuckets) && (n < sizeof(counts)); bucket++) {
+            n += snprintf(counts + n, sizeof(counts) - n, (bucket == 0) ? "%u" : ",%u", btnLatency[stage].buckets[bucket]);
+        }
+        jsonAdd(&json, (char*)btnStageNames[stage], counts);
+        snprintf(key, sizeof(key), "%sMax", btnStageNames[stage]);
+        jsonAdd(&json, key, (long)btnLatency[stage].max);
+    }
+    if (jsonEnd(&json)) {
+        mqttPublish(TOPIC_ButtonsLatency, b, false);
+    } else {
+        aePrintln(F("Buttons: latency report too long"));
+    }
+}
+
+// Every report covers one interval: counts are reset even if there was nothing to publish or MQTT was offline
+void btnLatencyLoop(unsigned long t) {
+    static unsigned long _tmReported = 0;
+    if (!timedOut(t, _tmReported, BUTTONS_LatencyReport)) return;
+    _tmReported = t;
+    if (mqttConnected()) {
+        for (int bucket = 0; bucket < BUTTONS_LatencyBuckets; bucket++) {
+            if (btnLatency[btnStageTotal].buckets[bucket] != 0) {
+                btnLatencyPublish();
+                break;
             }
         }
+    }
+    memset(btnLatency, 0, sizeof(btnLatency));
+}
+#endif
+#pragma endregion
+
+#pragma region Gestures
+BtnEvent btnEvents[BUTTONS_EventsSize];
+byte btnEventsHead = 0;
+byte btnEventsCount = 0;
+bool btnEventsLost = false;
+
+struct BtnHandlers {
+    BTN_HANDLER;
+};
+unsigned int btnHandlersCount = 0;
+BtnHandlers btnHandlers[BUTTONS_HandlersSize];
+
+// Press episode: from the first button pressed till all buttons released
+uint32_t btnEpisode = 0;
+unsigned long btnEpisodeStartedOn = 0;
+unsigned long btnEpisodeReleasedOn = 0;
+// Interrupt time of the latest release edge, micros
+unsigned long btnEpisodeEdgeOn = 0;
+// BUTTONS_EASY_MODE: long press is reported while buttons are still held
+bool btnEpisodeLong = false;
+// Buttons of the hold latched at btnHoldStart: buttons pressed later do not change ticks and end,
+// so receivers can pair start and end
+uint32_t btnHoldButtons = 0;
+
+// Buttons with hold-to-repeat enabled
+uint32_t btnRepeatMask = 0;
+// Repeat ticks of the current episode (0: not held long enough) and millis of the last tick
+unsigned int btnHoldTicks = 0;
+unsigned long btnHoldTickOn = 0;
+
+// Buttons of the last finished episode per gesture, read by btnChordXXX() once
+uint32_t btnChordShort = 0;
+uint32_t btnChordLong = 0;
+uint32_t btnChordVeryLong = 0;
+
+// Series of short presses of the same buttons
+uint32_t btnSeries = 0;
+byte btnSeriesCount = 0;
+unsigned long btnSeriesStartedOn = 0;
+unsigned long btnSeriesReleasedOn = 0;
+
+void btnQueue(uint32_t buttons, BtnGesture gesture, unsigned int count, unsigned long duration, unsigned long timestamp) {
+    BtnEvent event;
+    event.buttons = buttons;
+    event.gesture = gesture;
+    event.count = count;
+    event.duration = duration;
+    event.timestamp = timestamp;
+    event.queuedOn = micros();
+    event.edgeOn = btnEdgeDriven(gesture) ? btnEpisodeEdgeOn : event.queuedOn;
+#ifdef BUTTONS_Latency
+    if (btnEdgeDriven(gesture)) btnLatencyRecord(btnStageDebounce, event.queuedOn - event.edgeOn);
+#endif
+    // Handled locally right away, e.g. by a binding; consumed events are neither queued nor published
+    for (int i = 0; i < btnHandlersCount; i++) {
+        if (btnHandlers[i].handler(&event)) return;
+    }
+
+    // Events are not read (e.g. while HA is offline): the oldest one is dropped
+    if (btnEventsCount >= BUTTONS_EventsSize) {
+        btnEventsHead = (btnEventsHead + 1) % BUTTONS_EventsSize;
+        btnEventsCount--;
+        btnEventsLost = true;
+    }
+    btnEvents[(btnEventsHead + btnEventsCount) % BUTTONS_EventsSize] = event;
+    btnEventsCount++;
+}
+
+void btnRegisterHandler(BTN_HANDLER) {
+    if (btnHandlersCount >= BUTTONS_HandlersSize) return;
+    btnHandlers[btnHandlersCount++].handler = handler;
+}
+
+bool btnNextEvent(BtnEvent* event) {
+    if (btnEventsCount == 0) return false;
+    *event = btnEvents[btnEventsHead];
+    btnEventsHead = (btnEventsHead + 1) % BUTTONS_EventsSize;
+    btnEventsCount--;
+#ifdef BUTTONS_Latency
+    if (btnEdgeDriven(event->gesture)) btnLatencyRecord(btnStageLoop, micros() - event->queuedOn);
+#endif
+    return true;
+}
+
+void btnSeriesFinished() {
+    if (btnSeriesCount > 0) {
+        btnQueue(btnSeries, btnClicks, btnSeriesCount, btnSeriesReleasedOn - btnSeriesStartedOn, btnSeriesStartedOn);
+    }
+    btnSeries = 0;
+    btnSeriesCount = 0;
+}
+
+// Accepted state change of button i at millis t, caused by the edge at micros us
+void btnGesture(int i, bool pressed, unsigned long t, unsigned long us) {
+    if (pressed) {
+        if (btnEpisode == 0) {
+            btnEpisodeStartedOn = t;
+            btnEpisodeReleasedOn = t;
+            btnEpisodeEdgeOn = us;
+            btnEpisodeLong = false;
+            btnHoldTicks = 0;
+        }
+        btnEpisode |= (1UL << i);
+        return;
+    }
+    // Buttons may be accepted out of order: episode ends with the latest release
+    if ((long)(t - btnEpisodeReleasedOn) > 0) {
+        btnEpisodeReleasedOn = t;
+        btnEpisodeEdgeOn = us;
+    }
+    if (btnStates != 0) return;
+
+    uint32_t episode = btnEpisode;
+    unsigned long duration = btnEpisodeReleasedOn - btnEpisodeStartedOn;
+    btnEpisode = 0;
+    if (btnHoldTicks > 0) {
+        btnQueue(btnHoldButtons, btnHoldEnd, btnHoldTicks, duration, btnEpisodeStartedOn);
+        // Hold is not reported as long press by btnLongPressed(pin) etc. either
+        for (uint32_t mask = episode; mask != 0; mask &= mask - 1) {
+            Btn* btn = &buttons[__builtin_ctz(mask)];
+            btn->wasShortPressed = false;
+            btn->wasLongPressed = false;
+            btn->wasVeryLongPressed = false;
+        }
+        return;
+    }
+#ifdef BUTTONS_EASY_MODE
+    if (btnEpisodeLong) return;
+    if (duration >= LongPressTimeout) duration = LongPressTimeout - 1;
+#endif
+    if (duration < LongPressTimeout) {
+        btnChordShort = episode;
+        if ((episode != btnSeries) || timedOut(btnEpisodeStartedOn, btnSeriesReleasedOn, RepeatTimeout)) {
+            btnSeriesFinished();
+            btnSeries = episode;
+            btnSeriesStartedOn = btnEpisodeStartedOn;
+        }
+        if (btnSeriesCount < 255) btnSeriesCount++;
+        btnSeriesReleasedOn = btnEpisodeReleasedOn;
+        btnQueue(episode, btnClick, btnSeriesCount, duration, btnEpisodeStartedOn);
+    } else {
+        btnSeriesFinished();
+        if (duration < VeryLongPressTimeout) {
+            btnChordLong = episode;
+            btnQueue(episode, btnLongPress, 1, duration, btnEpisodeStartedOn);
+        } else {
+            btnChordVeryLong = episode;
+            btnQueue(episode, btnVeryLongPress, 1, duration, btnEpisodeStartedOn);
+        }
+    }
+}
+
+// Repeat ticks are counted from the first press, so ticks missed by a stalled loop are queued all together
+void btnHoldLoop(unsigned long t) {
+    Btn* btn = &buttons[__builtin_ctz((btnHoldTicks == 0) ? btnEpisode : btnHoldButtons)];
+    if (btnHoldTicks == 0) {
+        if (!timedOut(t, btnEpisodeStartedOn, btn->repeatDelay - 1)) return;
+        btnSeriesFinished();
+        btnHoldTicks = 1;
+        btnHoldTickOn = btnEpisodeStartedOn + btn->repeatDelay;
+        btnHoldButtons = btnEpisode;
+        btnQueue(btnHoldButtons, btnHoldStart, 1, btn->repeatDelay, btnEpisodeStartedOn);
+    }
+    while (timedOut(t, btnHoldTickOn, btn->repeatInterval - 1)) {
+        btnHoldTickOn += btn->repeatInterval;
+        btnHoldTicks++;
+        btnQueue(btnHoldButtons, btnHoldTick, btnHoldTicks, btnHoldTickOn - btnEpisodeStartedOn, btnEpisodeStartedOn);
+    }
+}
+
+void btnGesturesLoop(unsigned long t) {
+    if ((btnSeriesCount > 0) && (btnEpisode == 0) && timedOut(t, btnSeriesReleasedOn, RepeatTimeout)) {
+        btnSeriesFinished();
+    }
+    // Hold-to-repeat works if all buttons pressed have it enabled; settings of the first one are used.
+    // Started hold goes on till all buttons are released, whatever is pressed meanwhile
+    bool repeat = (btnEpisode != 0) && ((btnHoldTicks > 0) || ((btnEpisode & ~btnRepeatMask) == 0));
+    if (repeat) btnHoldLoop(t);
+#ifdef BUTTONS_EASY_MODE
+    if (!repeat && (btnEpisode != 0) && !btnEpisodeLong && timedOut(t, btnEpisodeStartedOn, LongPressTimeout)) {
+        btnEpisodeLong = true;
+        btnChordLong = btnEpisode;
+        btnSeriesFinished();
+        btnQueue(btnEpisode, btnLongPress, 1, t - btnEpisodeStartedOn, btnEpisodeStartedOn);
+    }
+#endif
+#ifdef Debug
+    if (btnEventsLost) {
+        btnEventsLost = false;
+        aePrintln(F("Buttons: events lost"));
+    }
+#endif
+}
+#pragma endregion
+
+#pragma region Debouncing
+// Accept raw state of button i if it did not change for ClashTimeout by micros "at".
+// Gestures are timed by the first edge of the bounce
+void btnSettle(int i, unsigned long at) {
+    Btn* btn = &buttons[i];
+    // Signed: edge newer than "at" is still settling
+    if ((long)(at - btn->rawChangedOn) < (long)(ClashTimeout * 1000)) return;
+    btnSettling &= ~(1UL << i);
+    if (btn->rawPressed == btn->pressed) return;
+    if (btn->rawPressed) {
+        btnStates |= (1UL << i);
+    } else {
+        btnStates &= ~(1UL << i);
+    }
+    triggerActivity();
+    unsigned long t = millis() - (unsigned long)(micros() - btn->rawFirstChangedOn) / 1000;
+    btnLoop(btn, btn->rawPressed, t);
+    btnGesture(i, btn->rawPressed, t, btn->rawFirstChangedOn);
+}
+
+// Raw edge of button i at micros us. Edges are processed in order, so states settled before this
+// edge are accepted first even if btnsLoop was not called for a while
+void btnEdge(int i, bool pressed, unsigned long us) {
+    Btn* btn = &buttons[i];
+    if (pressed == btn->rawPressed) return;
+    if ((btnSettling & (1UL << i)) != 0) btnSettle(i, us);
+    btn->rawPressed = pressed;
+    btn->rawChangedOn = us;
+    if (pressed) {
+        btnRawStates |= (1UL << i);
+    } else {
+        btnRawStates &= ~(1UL << i);
+    }
+    if ((btnSettling & (1UL << i)) == 0) {
+        btn->rawFirstChangedOn = us;
+        btnSettling |= (1UL << i);
+    }
+}
+#pragma endregion
+
+void btnRegister(byte btnPin, bool inverted, bool pullUp) {
+    if ((btnPin >= BUTTONS_Pins) || (btnIndex(btnPin) >= 0)) return;
+
+    if (btnCount < ButtonsSize) {
+        Btn* btn = &buttons[btnCount];
+        uint32_t bit = (1UL << btnCount);
+        btn->pin = btnPin;
+        btn->inverted = inverted;
+        btn->fastCount = 0;
+        btn->bdf = BDF_None;
+        btn->pressed = false;
+        btn->rawPressed = false;
+        btn->reportedState = -1;
+        btnLoop(btn, false, 0);
+
+        if (!ladderIsPin(btnPin)) expPinMode(btnPin, pullUp ? INPUT_PULLUP : INPUT);
+        if (inverted) btnInvertedMask |= bit;
+        if (ladderIsPin(btnPin)) {
+            // Edges come from ADC ladder samples (btnLadderEdge)
+            btnLadderMask |= bit;
+        } else if (expIsPin(btnPin)) {
+            // Edges come from expander reads (btnExpanderEdge)
+            btnExpanderMask |= bit;
+        } else if (btnInterruptsSupported(btnPin)) {
+#ifdef btnReadInputs
+            btnInputBits[btnCount] = ((BtnInputs)1 << btnPin);
+#endif
+            btnInterruptMask |= bit;
+            attachInterrupt(btnPin, btnInterrupt, CHANGE);
+        }
         btnCount++;
-        btnLoop(&buttons[btnCount - 1], false, 0);
+        btnPinIndex[btnPin] = btnCount;
     }
 }
 void btnDefaultFunction(byte btnPin, BtnDefaultFunction bdf) {
@@ -210,15 +619,30 @@ void btnDefaultFunction(byte btnPin, BtnDefaultFunction bdf) {
     if (index >= 0) buttons[index].bdf = bdf;
 }
 
+void btnRepeat(byte btnPin, unsigned long delay, unsigned long interval) {
+    short int index = btnIndex(btnPin);
+    if (index < 0) return;
+    buttons[index].repeatDelay = (delay > 0) ? delay : 1;
+    buttons[index].repeatInterval = (interval > 0) ? interval : 1;
+    btnRepeatMask |= (1UL << index);
+}
+
+void btnRepeat(byte btnPin) {
+    btnRepeat(btnPin, BUTTONS_RepeatDelay, BUTTONS_RepeatInterval);
+}
+
+bool btnRepeating(uint32_t buttons) {
+    return (buttons != 0) && ((buttons & ~btnRepeatMask) == 0);
+}
+
 bool btnState(byte btnPin) {
     short int index = btnIndex(btnPin);
     return ((index >= 0) && buttons[index].pressed);
 }
 
 bool btnState(byte btnPin, byte btnPin2) {
-    short int index = btnIndex(btnPin);
-    short int index2 = btnIndex(btnPin2);
-    return ((index >= 0) && buttons[index].pressed && (index2 >= 0) && buttons[index2].pressed);
+    uint32_t mask = btnMask(btnPin2);
+    return (mask != 0) && btnChordState(btnMask(btnPin) | mask);
 }
 
 bool btnPressed(byte btnPin) {
@@ -272,19 +696,8 @@ bool btnShortPressed(byte btnPin) {
 }
 
 bool btnShortPressed(byte btnPin, byte btnPin2) {
-    short int index = btnIndex(btnPin);
-    if ((index < 0) || !buttons[index].wasShortPressed) return false;
-
-    short int index2 = btnIndex(btnPin2);
-    if ((index2 < 0) || !buttons[index2].wasShortPressed) return false;
-
-#ifdef Debug
-    aePrintf("Shortpress check #%d, #%d TRUE\n", btnPin, btnPin2);
-#endif  
-
-    buttons[index].wasShortPressed = false;
-    buttons[index2].wasShortPressed = false;
-    return true;
+    uint32_t mask = btnMask(btnPin2);
+    return (mask != 0) && btnChordShortPressed(btnMask(btnPin) | mask);
 }
 
 bool btnLongPressed(byte btnPin) {
@@ -295,15 +708,8 @@ bool btnLongPressed(byte btnPin) {
 }
 
 bool btnLongPressed(byte btnPin, byte btnPin2) {
-    short int index = btnIndex(btnPin);
-    if ((index < 0) || !buttons[index].wasLongPressed) return false;
-
-    short int index2 = btnIndex(btnPin2);
-    if ((index2 < 0) || !buttons[index2].wasLongPressed) return false;
-
-    buttons[index].wasLongPressed = false;
-    buttons[index2].wasLongPressed = false;
-    return true;
+    uint32_t mask = btnMask(btnPin2);
+    return (mask != 0) && btnChordLongPressed(btnMask(btnPin) | mask);
 }
 
 #ifndef BUTTONS_EASY_MODE
@@ -315,149 +721,176 @@ bool btnVeryLongPressed(byte btnPin) {
 }
 
 bool btnVeryLongPressed(byte btnPin, byte btnPin2) {
-    short int index = btnIndex(btnPin);
-    if ((index < 0) || !buttons[index].wasVeryLongPressed) return false;
+    uint32_t mask = btnMask(btnPin2);
+    return (mask != 0) && btnChordVeryLongPressed(btnMask(btnPin) | mask);
+}
+#endif
 
-    short int index2 = btnIndex(btnPin2);
-    if ((index2 < 0) || !buttons[index2].wasVeryLongPressed) return false;
+#pragma region Chords
+bool btnChordState(uint32_t buttons) {
+    return (buttons != 0) && ((btnStates & buttons) == buttons);
+}
 
-    buttons[index].wasVeryLongPressed = false;
-    buttons[index2].wasVeryLongPressed = false;
+// True once if the last episode with the gesture had exactly these buttons. Flags of single buttons are
+// cleared as well, so combination is not reported as separate presses by btnShortPressed(pin) etc.
+bool btnChord(uint32_t mask, uint32_t* chord, bool Btn::* flag) {
+    if ((mask == 0) || (*chord != mask)) return false;
+    *chord = 0;
+    while (mask != 0) {
+        buttons[__builtin_ctz(mask)].*flag = false;
+        mask &= mask - 1;
+    }
     return true;
 }
-#endif
 
-static int btnLastPressB1 = -1;
-static int btnLastPressB2 = -1;
-static unsigned long btnLastPressed = 0;
-static char btnCounter = 0;
-static char btnLastEvent[24] = { 0 };
+bool btnChordShortPressed(uint32_t buttons) {
+    return btnChord(buttons, &btnChordShort, &Btn::wasShortPressed);
+}
 
-void btnPublishLastEvent() {
-    if (btnLastEvent[0] == 0) {
-        return;
-    }
-    mqttPublish(strcat(btnLastEvent, "X"), (long)btnCounter, false);
-    btnLastEvent[0] = 0;
+bool btnChordLongPressed(uint32_t buttons) {
+    return btnChord(buttons, &btnChordLong, &Btn::wasLongPressed);
 }
-bool btnSingleButtonEvent(char* eventName) {
-    for (int b1 = 0; b1 < btnCount; b1++) {
-        if (btnShortPressed(buttons[b1].pin)) {
-            if ((btnLastPressB1 != b1)) {
-                btnPublishLastEvent();
-                btnCounter = 1;
-            } else {
-                btnCounter++;
-            }
-            sprintf(eventName, "Btn%dPressed", b1 + 1);
-            strcpy(btnLastEvent, eventName);
-            btnLastPressB1 = b1;
-            btnLastPressB2 = -1;
-            return true;
-        }
-        if (btnLongPressed(buttons[b1].pin)) {
-            btnPublishLastEvent();
-            sprintf(eventName, "Btn%dLongPressed", b1 + 1);
-            btnCounter = 1;
-            btnLastPressB1 = -1;
-            btnLastPressB2 = -1;
-            return true;
-        }
+
 #ifndef BUTTONS_EASY_MODE
-        if (btnVeryLongPressed(buttons[b1].pin)) {
-            sprintf(eventName, "Btn%dVeryLongPressed", b1 + 1);
-            btnLastPressB1 = -1;
-            btnLastPressB2 = -1;
-            return true;
-        }
+bool btnChordVeryLongPressed(uint32_t buttons) {
+    return btnChord(buttons, &btnChordVeryLong, &Btn::wasVeryLongPressed);
+}
 #endif
+#pragma endregion
+
+// Event name is "Btn" + numbers of the buttons (starting from 1) + gesture. Two digits per button if
+// there are more than 9 of them: button 12 and buttons 1 and 2 pressed together are told apart
+void btnEventName(char* eventName, uint32_t buttons, BtnGesture gesture) {
+    strcpy(eventName, "Btn");
+    const char* format = (btnCount > 9) ? "%02d" : "%d";
+    for (int i = 0; i < btnCount; i++) {
+        if ((buttons & (1UL << i)) != 0) sprintf(eventName + strlen(eventName), format, i + 1);
+    }
+    switch (gesture) {
+    case btnClick: strcat(eventName, "Pressed"); break;
+    case btnClicks: strcat(eventName, "PressedX"); break;
+    case btnLongPress: strcat(eventName, "LongPressed"); break;
+    case btnVeryLongPress: strcat(eventName, "VeryLongPressed"); break;
+    case btnHoldStart: strcat(eventName, "Hold"); break;
+    case btnHoldTick: strcat(eventName, "HoldTick"); break;
+    case btnHoldEnd: strcat(eventName, "HoldEnd"); break;
     }
-    return false;
 }
 
-bool btnTwoButtonsEvent(char* eventName) {
-    for (int b1 = 0; b1 < btnCount - 1; b1++) {
-        for (int b2 = b1 + 1; b2 < btnCount; b2++) {
-            if (btnShortPressed(buttons[b1].pin, buttons[b2].pin)) {
-                if ((btnLastPressB1 != b1) || (btnLastPressB2 != b2)) {
-                    btnPublishLastEvent();
-                    btnCounter = 1;
-                } else {
-                    btnCounter++;
-                }
-                sprintf(eventName, "Btn%d%dPressed", b1 + 1, b2 + 1);
-                strcpy(btnLastEvent, eventName);
-                btnLastPressB1 = b1;
-                btnLastPressB2 = b2;
-                return true;
-            }
-            if (btnLongPressed(buttons[b1].pin, buttons[b2].pin)) {
-                btnPublishLastEvent();
-                sprintf(eventName, "Btn%d%dLongPressed", b1 + 1, b2 + 1);
-                btnCounter = 1;
-                btnLastPressB1 = -1;
-                btnLastPressB2 = -1;
-                return true;
-            }
-#ifndef BUTTONS_EASY_MODE
-            if (btnVeryLongPressed(buttons[b1].pin, buttons[b2].pin)) {
-                sprintf(eventName, "Btn%d%dVeryLongPressed", b1 + 1, b2 + 1);
-                btnLastPressB1 = -1;
-                btnLastPressB2 = -1;
-                return true;
-            }
+void btnPublishEvent(uint32_t buttons, BtnEvent* event) {
+#ifndef BUTTONS_PublishHoldTicks
+    // Hold is published as start / end pair, receiver ramps by itself
+    if (event->gesture == btnHoldTick) return;
 #endif
-        }
+    char eventName[BTN_EventNameSize];
+    btnEventName(eventName, buttons, event->gesture);
+#ifdef Debug
+    aePrintln(eventName);
+#endif
+#ifdef BUTTONS_PublishEdgeTime
+    // Wall clock time of the edge lets receiver measure network stage as well: {"Count":n,"Edge":seconds.micros}
+    char payload[64];
+    timeval now;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec > 1600000000) {
+        int64_t edge = (int64_t)now.tv_sec * 1000000 + now.tv_usec - (unsigned long)(micros() - event->edgeOn);
+        sprintf(payload, "{\"Count\":%u,\"Edge\":%ld.%06ld}", event->count, (long)(edge / 1000000), (long)(edge % 1000000));
+    } else {
+        sprintf(payload, "{\"Count\":%u}", event->count);
     }
-    return false;
-}
-
-bool btnPublishKeypressEvent(bool combinations) {
-    if (!mqttConnected()) return false;
-    unsigned long t = millis();
-    if ((btnLastPressed > 0) && timedOut(t, btnLastPressed, RepeatTimeout)) {
-        btnPublishLastEvent();
+    mqttPublish(eventName, payload, false);
+#else
+    mqttPublish(eventName, (long)event->count, false);
+#endif
 
-        btnLastPressB1 = -1;
-        btnLastPressB2 = -1;
-        btnLastPressed = 0;
-        btnCounter = 0;
+    // Paired devices get buttons numbers (two first for combinations) and do not need series summary or ticks
+    byte kind;
+    switch (event->gesture) {
+    case btnClick: kind = peerPressed; break;
+    case btnLongPress: kind = peerLongPressed; break;
+    case btnVeryLongPress: kind = peerVeryLongPressed; break;
+    case btnHoldStart: kind = peerHoldStart; break;
+    case btnHoldEnd: kind = peerHoldEnd; break;
+    default: return;
     }
-    char eventName[24] = { 0 };
+    byte b1 = __builtin_ctz(buttons) + 1;
+    uint32_t rest = buttons & (buttons - 1);
+    byte b2 = (rest != 0) ? __builtin_ctz(rest) + 1 : 0;
+    peerSendButton(b1, b2, kind, (event->count < 255) ? event->count : 255);
+}
 
-    if ((combinations && btnTwoButtonsEvent(eventName)) || btnSingleButtonEvent(eventName)) {
-        btnLastPressed = t;
-#ifdef Debug
-        aePrintln(eventName);
+bool btnPublishKeypressEvent(bool combinations) {
+    if (!commsEnabled()) return false;
+    BtnEvent event;
+    bool published = false;
+    while (btnNextEvent(&event)) {
+#ifdef BUTTONS_Latency
+        unsigned long readOn = micros();
 #endif
-        mqttPublish(eventName, (long)btnCounter, false);
-        return true;
+        if (combinations) {
+            btnPublishEvent(event.buttons, &event);
+        } else {
+            // Buttons pressed together are reported separately
+            uint32_t buttons = event.buttons;
+            while (buttons != 0) {
+                btnPublishEvent(buttons & (~buttons + 1), &event);
+                buttons &= buttons - 1;
+            }
+        }
+#ifdef BUTTONS_Latency
+        if (btnEdgeDriven(event.gesture)) {
+            unsigned long publishedOn = micros();
+            btnLatencyRecord(btnStagePublish, publishedOn - readOn);
+            btnLatencyRecord(btnStageTotal, publishedOn - event.edgeOn);
+        }
+#endif
+        published = true;
     }
-    return false;
+    return published;
 }
 
 void btnsLoop() {
-    static unsigned long _tmInterruptsEnabledButtonsUpdated = 0;
+    static unsigned long _tmPolled = 0;
     unsigned long t = millis();
 
-    if (timedOut(t, _tmInterruptsEnabledButtonsUpdated, 20)) {
-        _tmInterruptsEnabledButtonsUpdated = t;
-        for (int i = 0; i < btnCount; i++) {
-            if (!btnInterruptsSupported(buttons[i].pin)) {
-                btnInterrupt(i);
-            }
+    while (btnEdgesTail != btnEdgesHead) {
+        BtnEdge* edge = &btnEdges[btnEdgesTail];
+        uint32_t changed = (edge->states ^ btnRawStates) & btnInterruptMask;
+        while (changed != 0) {
+            int i = __builtin_ctz(changed);
+            changed &= changed - 1;
+            btnEdge(i, (edge->states & (1UL << i)) != 0, edge->micros);
         }
+        btnEdgesTail = (btnEdgesTail + 1) & (BUTTONS_EdgesSize - 1);
+    }
+    if (btnEdgesLost) {
+        btnEdgesLost = false;
+        aePrintln(F("Buttons: edges lost"));
     }
+    // Read after the ring is drained: edge pushed by interrupt meanwhile must not be newer than "us"
+    unsigned long us = micros();
 
-    // Limit button scan frequency
-    if ((btnChangedOn > 0) && timedOut(t, btnChangedOn, ClashTimeout)) {
-        btnChangedOn = 0;
-        triggerActivity();
-        // Process states;
+    if (timedOut(t, _tmPolled, BUTTONS_PollInterval)) {
+        _tmPolled = t;
         for (int i = 0; i < btnCount; i++) {
-            btnLoop(&buttons[i], ((btnStates & (1 << i)) != 0), t);
+            if (((btnInterruptMask | btnExpanderMask | btnLadderMask) & (1UL << i)) == 0) {
+                btnEdge(i, (digitalRead(buttons[i].pin) == HIGH) == buttons[i].inverted, us);
+            }
         }
     }
+
+    uint32_t settling = btnSettling;
+    while (settling != 0) {
+        int i = __builtin_ctz(settling);
+        settling &= settling - 1;
+        btnSettle(i, us);
+    }
+
+    btnGesturesLoop(t);
+#ifdef BUTTONS_Latency
+    btnLatencyLoop(t);
+#endif
+
 #ifdef BUTTONS_EASY_MODE
     for (int i = 0; i < btnCount; i++) {
         if (timedOut(t, buttons[i].triggeredOn, LongPressTimeout) && buttons[i].pressed && !buttons[i].wasLongPressedFlag) {
@@ -469,6 +902,22 @@ void btnsLoop() {
 
 }
 
+// Expander input change, timed by INT line edge
+void btnExpanderEdge(byte pin, bool level, unsigned long us) {
+    short int index = btnIndex(pin);
+    if ((index < 0) || ((btnExpanderMask & (1UL << index)) == 0)) return;
+    btnEdge(index, level == buttons[index].inverted, us);
+}
+
+// Ladder key change, timed by the first ADC sample of the new reading
+void btnLadderEdge(byte pin, bool pressed, unsigned long us) {
+    short int index = btnIndex(pin);
+    if ((index < 0) || ((btnLadderMask & (1UL << index)) == 0)) return;
+    btnEdge(index, pressed != buttons[index].inverted, us);
+}
+
 void btnInit() {
+    expRegisterHandler(btnExpanderEdge);
+    ladderRegisterHandler(btnLadderEdge);
     aeRegisterLoop(btnsLoop);
 }
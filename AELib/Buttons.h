@@ -1,6 +1,13 @@
 #ifndef buttons_h
 #define buttons_h
 
+// Maximum number of buttons supported (up to 32)
+#ifndef ButtonsSize
+#define ButtonsSize 16
+#endif
+// Event name buffer: "Btn", two digits per button, gesture and zero
+#define BTN_EventNameSize (3 + ButtonsSize * 2 + 16)
+
 enum BtnDefaultFunction {
     BDF_None = 0, // none
     BDF_EnableOTA, // enable OTA on 10th fast click
@@ -11,6 +18,11 @@ enum BtnDefaultFunction {
 
 void btnRegister(byte btnPin, bool btnInverted, bool pullUp);
 void btnDefaultFunction(byte btnPin, BtnDefaultFunction bdf);
+// Hold-to-repeat: btnHoldXXX events after "delay" ms held and then every "interval" ms (e.g. to ramp brightness)
+void btnRepeat(byte btnPin);
+void btnRepeat(byte btnPin, unsigned long delay, unsigned long interval);
+// True if all buttons of the mask (bit per button in registration order) have repeat enabled
+bool btnRepeating(uint32_t buttons);
 
 bool btnState(byte btnPin);
 bool btnPressed(byte btnPin);
@@ -30,6 +42,52 @@ bool btnLongPressed(byte btnPin, byte btnPin2);
 bool btnVeryLongPressed(byte btnPin, byte btnPin2);
 #endif
 
+// Combinations of any number of buttons: mask is btnMask(pin1) | btnMask(pin2) | ...
+uint32_t btnMask(byte btnPin);
+bool btnChordState(uint32_t buttons);
+bool btnChordShortPressed(uint32_t buttons);
+bool btnChordLongPressed(uint32_t buttons);
+#ifndef BUTTONS_EASY_MODE
+bool btnChordVeryLongPressed(uint32_t buttons);
+#endif
+
+enum BtnGesture {
+    btnClick = 1,       // Short press, count = number of the click in series
+    btnClicks,          // Series of short presses finished (RepeatTimeout passed), count = total clicks
+    btnLongPress,
+    btnVeryLongPress,   // Not available in BUTTONS_EASY_MODE
+    // Buttons with btnRepeat() enabled and held longer than repeat delay. Hold replaces click / long press
+    btnHoldStart,       // count = 1
+    btnHoldTick,        // Every repeat interval while held, count = tick number
+    btnHoldEnd          // Released, count = total ticks
+};
+
+struct BtnEvent {
+    // Bit per button in registration order; several bits for buttons pressed together
+    uint32_t buttons;
+    BtnGesture gesture;
+    unsigned int count;
+    // Press duration (from the first button pressed till all released) and millis of the first press
+    unsigned long duration;
+    unsigned long timestamp;
+    // Latency tracing, micros: interrupt time of the release edge that completed the gesture and time
+    // the event was queued. Gestures due by timeout (series end, hold start / ticks) have edgeOn == queuedOn
+    unsigned long edgeOn;
+    unsigned long queuedOn;
+};
+
+// Gesture events are queued in order of detection, returns false if queue is empty
+bool btnNextEvent(BtnEvent* event);
+
+// Called for every gesture event as soon as it is detected, before it is queued.
+// Handler returns true if the event is consumed: it is not queued for btnNextEvent() then
+#define BTN_HANDLER std::function<bool(const BtnEvent* event)> handler
+void btnRegisterHandler(BTN_HANDLER);
+
+// MQTT event name: "Btn" + numbers of the buttons (from 1) + gesture, e.g. Btn12LongPressed for buttons
+// 1 and 2 pressed together. With more than 9 buttons registered numbers take two digits: Btn0102LongPressed,
+// Btn12LongPressed is button 12. eventName is BTN_EventNameSize bytes
+void btnEventName(char* eventName, uint32_t buttons, BtnGesture gesture);
 bool btnPublishKeypressEvent(bool combinations);
 
 void btnInit();
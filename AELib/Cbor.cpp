@@ -0,0 +1,118 @@
+#include <Arduino.h>
+
+#include "AELib.h"
+#include "Cbor.h"
+
+// CBOR major types
+#define CBOR_Unsigned 0x00
+#define CBOR_Negative 0x20
+#define CBOR_Text 0x60
+#define CBOR_Map 0xA0
+#define CBOR_Float32 0xFA
+#define CBOR_Null 0xF6
+
+void cborAppend(CborWriter* cbor, const uint8_t* data, unsigned int length) {
+    if (cbor->overflow || (cbor->length + length > cbor->size)) {
+        cbor->overflow = true;
+        return;
+    }
+    memcpy(cbor->buffer + cbor->length, data, length);
+    cbor->length += length;
+}
+
+// Write major type and argument in the shortest form
+void cborHeader(CborWriter* cbor, uint8_t type, unsigned long value) {
+    uint8_t h[5];
+    unsigned int n;
+    if (value < 24) {
+        h[0] = type | value; n = 1;
+    } else if (value <= 0xFF) {
+        h[0] = type | 24; h[1] = value; n = 2;
+    } else if (value <= 0xFFFF) {
+        h[0] = type | 25; h[1] = value >> 8; h[2] = value; n = 3;
+    } else {
+        h[0] = type | 26; h[1] = value >> 24; h[2] = value >> 16; h[3] = value >> 8; h[4] = value; n = 5;
+    }
+    cborAppend(cbor, h, n);
+}
+
+void cborInit(CborWriter* cbor, uint8_t* buffer, unsigned int size) {
+    cbor->buffer = buffer;
+    cbor->size = size;
+    cbor->length = 0;
+    cbor->count = 0;
+    cbor->overflow = false;
+}
+
+void cborWrite(CborWriter* cbor, long value) {
+    if (value >= 0) {
+        cborHeader(cbor, CBOR_Unsigned, value);
+    } else {
+        cborHeader(cbor, CBOR_Negative, (unsigned long)(-1 - value));
+    }
+}
+
+void cborWrite(CborWriter* cbor, char* value) {
+    if (value == NULL) {
+        uint8_t h = CBOR_Null;
+        cborAppend(cbor, &h, 1);
+        return;
+    }
+    unsigned int length = strlen(value);
+    cborHeader(cbor, CBOR_Text, length);
+    cborAppend(cbor, (uint8_t*)value, length);
+}
+
+void cborWrite(CborWriter* cbor, float value, int decimals) {
+    if (isnan(value) || isinf(value)) {
+        uint8_t h = CBOR_Null;
+        cborAppend(cbor, &h, 1);
+        return;
+    }
+    // Round to the same precision text encoding would use
+    float scale = 1;
+    for (int i = 0; i < decimals; i++) scale *= 10;
+    value = round(value * scale) / scale;
+
+    if ((decimals <= 0) && (value >= -2147483648.0) && (value <= 2147483647.0)) {
+        cborWrite(cbor, (long)value);
+        return;
+    }
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t h[5] = { CBOR_Float32, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits };
+    cborAppend(cbor, h, 5);
+}
+
+void cborBegin(CborWriter* cbor, uint8_t* buffer, unsigned int size) {
+    cborInit(cbor, buffer, size);
+    // Placeholder, item count is written by cborEnd()
+    uint8_t h = CBOR_Map;
+    cborAppend(cbor, &h, 1);
+}
+
+void cborKey(CborWriter* cbor, char* key) {
+    cbor->count++;
+    cborWrite(cbor, key);
+}
+
+void cborAdd(CborWriter* cbor, char* key, long value) {
+    cborKey(cbor, key);
+    cborWrite(cbor, value);
+}
+
+void cborAdd(CborWriter* cbor, char* key, char* value) {
+    cborKey(cbor, key);
+    cborWrite(cbor, value);
+}
+
+void cborAdd(CborWriter* cbor, char* key, float value, int decimals) {
+    cborKey(cbor, key);
+    cborWrite(cbor, value, decimals);
+}
+
+bool cborEnd(CborWriter* cbor) {
+    if (cbor->count > CBOR_MaxMapSize) cbor->overflow = true;
+    if (!cbor->overflow) cbor->buffer[0] = CBOR_Map | cbor->count;
+    return !cbor->overflow;
+}
@@ -0,0 +1,41 @@
+#ifndef cbor_h
+#define cbor_h
+
+// Minimalistic CBOR (RFC 8949) encoder. Writes into caller provided buffer, no heap allocations.
+// Integers are encoded in the shortest form, floats as integers (if decimals==0) or single precision.
+// Usage:
+//   uint8_t b[64];
+//   CborWriter cbor;
+//   cborBegin(&cbor, b, sizeof(b));
+//   cborAdd(&cbor, "Temperature", 23.5, 1);
+//   cborAdd(&cbor, "Humidity", (long)45);
+//   if (cborEnd(&cbor)) mqttPublishRaw(topic, b, cbor.length, true);
+
+// Maximum number of key/value pairs in map (map header is one byte)
+#define CBOR_MaxMapSize 23
+
+struct CborWriter {
+    uint8_t* buffer;
+    unsigned int size;
+    unsigned int length;
+    unsigned int count;
+    bool overflow;
+};
+
+// Single value encoding
+void cborInit(CborWriter* cbor, uint8_t* buffer, unsigned int size);
+void cborWrite(CborWriter* cbor, long value);
+void cborWrite(CborWriter* cbor, char* value);
+void cborWrite(CborWriter* cbor, float value, int decimals);
+
+// Map (object) encoding
+void cborBegin(CborWriter* cbor, uint8_t* buffer, unsigned int size);
+void cborAdd(CborWriter* cbor, char* key, long value);
+void cborAdd(CborWriter* cbor, char* key, char* value);
+void cborAdd(CborWriter* cbor, char* key, float value, int decimals);
+
+/// <summary>Close CBOR map</summary>
+/// <returns>False if buffer was too small to hold the whole map or map has too many items</returns>
+bool cborEnd(CborWriter* cbor);
+
+#endif
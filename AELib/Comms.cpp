@@ -8,11 +8,30 @@
 #endif
 
 #include <errno.h>
-#include <PubSubClient.h>
 #include <ArduinoOTA.h>
+#ifdef COMMS_UdpPort
+#include <WiFiUdp.h>
+#ifdef ESP8266
+#include <bearssl/bearssl.h>
+#else
+#include <mbedtls/md.h>
+#endif
+#endif
+#ifdef MQTT_TLS
+#include <WiFiClientSecure.h>
+#ifdef ESP8266
+#include <StackThunk.h>
+#ifdef UMM_STATS_FULL
+#include <umm_malloc/umm_malloc.h>
+#endif
+#endif
+#endif
 
 #include "AELib.h"
 #include "Comms.h"
+#include "MqttQueue.h"
+#include "Cbor.h"
+#include "MqttClient.h"
 
 #ifdef MQTT_Address
 #elif MQTT_Port
@@ -25,6 +44,13 @@ struct mqttMdnsRecord {
     uint16_t port;
 };
 mqttMdnsRecord mqttMdns[mqttMdnsSize];
+// Time to collect mDNS answers, ms
+#define MQTT_MdnsTimeout ((unsigned long)3000)
+#ifdef MQTT_TLS
+#define MQTT_MdnsService "secure-mqtt"
+#else
+#define MQTT_MdnsService "mqtt"
+#endif
 #endif
 
 #ifdef TIMEZONE
@@ -43,15 +69,122 @@ static char* NTP_SERVER2 PROGMEM = "time.nist.gov";
 
 //#define Debug
 
-// Time to wait between connection attempts
+// Time to wait for WiFi connection
 #define COMMS_ConnectTimeout ((unsigned long)(60 * 1000))
+// Time to wait before trying next broker found via mDNS
 #define COMMS_ConnectNextTimeout ((unsigned long)(3 * 1000))
+// Time to wait between connection attempts: doubles after every failed attempt
+// from COMMS_BackoffMin up to COMMS_BackoffMax, ms, and is randomized by COMMS_BackoffJitter percent
+#ifndef COMMS_BackoffMin
+#define COMMS_BackoffMin ((unsigned long)(3 * 1000))
+#endif
+#ifndef COMMS_BackoffMax
+#define COMMS_BackoffMax ((unsigned long)(60 * 1000))
+#endif
+#ifndef COMMS_BackoffJitter
+#define COMMS_BackoffJitter 50
+#endif
 // Number of connection attempts before resetting controller
 #define COMMS_ConnectAttempts 1000000
+// Time to wait for fast connect to cached AP or roaming before falling back to full scan
+#define WIFI_FastConnectTimeout ((unsigned long)(3 * 1000))
+// Broker connection failures in a row after fast connect before falling back to full scan and DHCP:
+// cached lease may be stale (router changed subnet or gave the address away)
+#ifndef WIFI_FastConnectBrokerAttempts
+#define WIFI_FastConnectBrokerAttempts 2
+#endif
+// Roaming: scan for better AP if RSSI stays below WIFI_RoamThreshold (dBm) for WIFI_RoamDelay,
+// not more often than once per WIFI_ScanInterval. New AP must be WIFI_RoamHysteresis dB stronger
+#ifndef WIFI_RoamThreshold
+#define WIFI_RoamThreshold -75
+#endif
+#ifndef WIFI_RoamHysteresis
+#define WIFI_RoamHysteresis 8
+#endif
+#ifndef WIFI_ScanInterval
+#define WIFI_ScanInterval ((unsigned long)(5 * 60 * 1000))
+#endif
+#define WIFI_RoamDelay ((unsigned long)(30 * 1000))
+// Broker connection steps timeouts
+#ifdef MQTT_TLS
+// Full TLS handshake takes 1-2 seconds on ESP8266
+#define MQTT_OpenTimeout ((unsigned long)5000)
+#else
+#define MQTT_OpenTimeout ((unsigned long)1500)
+#endif
+#define MQTT_ConnAckTimeout ((unsigned long)(5 * 1000))
+// Online heartbeat interval, randomized by +-10% per device and period
+#define COMMS_HeartbeatTimeout ((unsigned long)(10 * 60 * 1000))
 // Time to wait between RSSI reports
 #define COMMS_RSSITimeout ((unsigned long)(60 * 1000))
 
 #define MQTT_ActivityTimeout ((unsigned long)(10 * 1000))
+// Maximum number of queued messages to send per MQTT_CoalesceWindow
+#ifndef MQTT_QueueBurst
+#define MQTT_QueueBurst 8
+#endif
+// Retained messages are staged in queue and sent once per window, ms.
+// Only latest value is sent if topic was updated several times within the window.
+// Set to 0 to send staged messages once per loop pass.
+#ifndef MQTT_CoalesceWindow
+#define MQTT_CoalesceWindow ((unsigned long)200)
+#endif
+#ifndef WIFI_FastConnect
+#define WIFI_FastConnect 1
+#endif
+// AP roamed to is kept in RTC memory at this offset (4-byte blocks) instead of flash, see MQTT_TlsRtcOffset
+#ifndef WIFI_RtcOffset
+#define WIFI_RtcOffset 120
+#endif
+#define WIFI_RtcMagic 0x57494649
+// QoS of not retained messages (events), mqttTopicQos() overrides it for selected topics.
+// Retained messages (states) are always sent with QoS 0
+#ifndef MQTT_EventQos
+#define MQTT_EventQos 0
+#endif
+#ifndef MQTT_QosTopicsSize
+#define MQTT_QosTopicsSize 8
+#endif
+// Persistent session: subscribe with QoS 1 so commands sent while device is offline are queued by broker
+#ifdef MQTT_PersistentSession
+#define MQTT_SubscribeQos 1
+#else
+#define MQTT_SubscribeQos 0
+#endif
+#ifdef MQTT_TLS
+// TLS receive / transmit buffers, bytes. Receive buffer smaller than 16384 is used only if broker
+// accepts Maximum Fragment Length extension (probed once per broker), ESP8266 only
+#ifndef MQTT_TlsRxBuffer
+#define MQTT_TlsRxBuffer 1024
+#endif
+#ifndef MQTT_TlsTxBuffer
+#define MQTT_TlsTxBuffer 512
+#endif
+// TLS session is saved in RTC memory at this offset (4-byte blocks) to be resumed after reset or deep sleep.
+// First 128 bytes of RTC user memory are used by OTA bootloader
+#ifndef MQTT_TlsRtcOffset
+#define MQTT_TlsRtcOffset 32
+#endif
+#define MQTT_TlsRtcMagic 0x544C5331
+#endif
+#ifdef COMMS_UdpPort
+// UDP control datagram (big endian):
+//   version, 'C', device nonce (4), sequence (4), topic length, topic relative to device root, payload, MAC
+// Reply:
+//   version, 'R', device nonce (4), sequence (4), status, last accepted sequence (4), MAC
+// MAC is HMAC-SHA256 of preceding bytes keyed with COMMS_UdpKey, truncated to UDP_MacSize.
+// Nonce is random per boot and sequence must grow (reordering within UDP_SeqWindow is accepted),
+// sender learns both from udpStale reply. Datagrams with invalid MAC are dropped without reply
+#define UDP_Version 1
+#define UDP_HeaderSize 10
+#define UDP_MacSize 16
+#define UDP_PacketSize 200
+#define UDP_SeqWindow 32
+enum UdpStatus { udpOk = 0, udpUnknown = 1, udpStale = 2, udpMalformed = 3 };
+#ifndef COMMS_UdpKey
+#error "Please define COMMS_UdpKey to enable UDP control"
+#endif
+#endif
 #define MQTT_CbsSize 10
 #define MQTT_ClientId 16
 #define MQTT_RootSize 32
@@ -59,6 +192,10 @@ static char* NTP_SERVER2 PROGMEM = "time.nist.gov";
 static char* TOPIC_Online PROGMEM = "Online";
 static char* TOPIC_DeviceInfo PROGMEM = "DeviceInfo";
 static char* TOPIC_Activity PROGMEM = "Activity";
+static char* TOPIC_Stats PROGMEM = "Stats";
+static char* TOPIC_Connection PROGMEM = "Connection";
+static char* TOPIC_RSSI PROGMEM = "RSSI";
+static char* TOPIC_PayloadFormat PROGMEM = "PayloadFormat";
 static char* TOPIC_Reset PROGMEM = "Reset";
 static char* TOPIC_FactoryReset PROGMEM = "FactoryReset";
 static char* TOPIC_EnableOTA PROGMEM = "EnableOTA";
@@ -71,6 +208,10 @@ static char* TOPIC_SetName PROGMEM = "SetName";
 static char* TOPIC_SetRoot PROGMEM = "SetRoot";
 #endif
 
+#ifndef MQTT_PayloadFormat
+static char* TOPIC_SetPayloadFormat PROGMEM = "SetPayloadFormat";
+#endif
+
 #ifndef TOPIC_HA_Status
 static char* TOPIC_HA_Status PROGMEM = "homeassistant/status";
 #endif
@@ -91,6 +232,21 @@ struct CommsConfig {
     // *********** End of device configuration
     // Disable wifi/mqtt 
     bool disabled;
+    // Numeric and state payloads encoding: MQTT_PayloadText or MQTT_PayloadCbor
+    // Use SetPayloadFormat MQTT command to change
+    byte payloadFormat;
+    // Last broker connected successfully (mDNS discovery only), it is tried first on boot
+    char brokerAddress[16];
+    uint16_t brokerPort;
+    // Last AP and DHCP lease, used to connect without scan and DHCP (WIFI_FastConnect)
+    uint8_t wifiBssid[6];
+    uint8_t wifiChannel;
+    uint32_t wifiIP;
+    uint32_t wifiGateway;
+    uint32_t wifiSubnet;
+    uint32_t wifiDns;
+    // Index of network in wifiNetworks
+    uint8_t wifiNetwork;
 } commsConfig;
 
 #define CONFIG_Timeout ((unsigned long)(15*60*1000))
@@ -98,12 +254,72 @@ struct CommsConfig {
 // Templrary disable wifi/mqtt
 bool commsOffline = false;
 bool wifiTimeCritical = false;
+
+struct WiFiNetwork {
+    const char* ssid;
+    const char* password;
+};
+WiFiNetwork wifiNetworks[] = {
+    { WIFI_SSID, WIFI_Password },
+#ifdef WIFI_SSID2
+    { WIFI_SSID2, WIFI_Password2 },
+#endif
+#ifdef WIFI_SSID3
+    { WIFI_SSID3, WIFI_Password3 },
+#endif
+};
+#define WIFI_Networks ((int)(sizeof(wifiNetworks) / sizeof(wifiNetworks[0])))
+// Network connected or being connected
+int wifiNetwork = 0;
+
+// Background scan: to choose network to connect or better AP to roam to
+enum WiFiScan { wifiScanNone, wifiScanConnect, wifiScanRoam };
+WiFiScan wifiScan = wifiScanNone;
+unsigned long wifiScanned = 0;
+unsigned long wifiWeakSince = 0;
+unsigned long wifiRoamStarted = 0;
+unsigned long wifiRoams = 0;
+unsigned long wifiRoamTime = 0;
 unsigned long commsConnecting;
+// Connection metrics, ms
+unsigned long commsConnectStarted;
+unsigned long wifiConnectTime = 0;
+unsigned long commsConnectTime = 0;
+unsigned long commsBootToOnline = 0;
+unsigned long commsConnectAttempts = 0;
+#if WIFI_FastConnect
+bool wifiFastConnecting = false;
+bool wifiFastConnected = false;
+bool wifiFastFailed = false;
+byte wifiFastBrokerFailures = 0;
+
+// AP roamed to within the saved network: roaming changes neither network nor DHCP lease, so it is not
+// worth a flash write. Survives reset in RTC memory (ESP8266), magic is 0 if not valid
+struct WifiRoamRtc {
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t network;
+} wifiRoamAP;
+#endif
 unsigned long commsConnectAttempt = 0;
 unsigned long commsPaused;
+unsigned long commsPauseDelay;
+// Pause is caused by lost connection: resume broker connection without WiFi reconnect
+bool commsPauseResume = false;
+uint32_t commsRandomState = 0;
 
 int mqttMdnsIndex = 0;
 int mqttMdnsCnt = 0;
+#ifdef MQTT_MDNS
+// Cached broker is being tried / has failed: discover brokers on next attempt
+bool mqttBrokerCached = false;
+bool mqttBrokerCacheFailed = false;
+#ifdef ESP8266
+MDNSResponder::hMDNSServiceQuery mqttMdnsQuery = NULL;
+unsigned long mqttMdnsQueryStarted;
+#endif
+#endif
 
 unsigned long otaEnabled;
 bool otaShouldInit;
@@ -112,11 +328,72 @@ unsigned int otaProgress;
 unsigned long mqttActivity;
 bool mqttDisableCallback = false;
 char mqttServerAddress[32] = "";
+uint16_t mqttServerPort = 0;
 bool commsHAConnected = false;
 int commsRSSI = 0;
 
+#ifdef MQTT_TLS
+#ifdef ESP8266
+BearSSL::WiFiClientSecure wifiClient;
+// Session of last connection: next handshake resumes it instead of full key exchange
+BearSSL::Session mqttTlsSession;
+BearSSL::Session mqttTlsPrevious;
+#ifdef MQTT_TlsCA
+BearSSL::X509List mqttTlsCA(MQTT_TlsCA);
+#endif
+#else
+WiFiClientSecure wifiClient;
+#endif
+// Broker Maximum Fragment Length support was probed for
+char mqttTlsProbedAddress[32] = "";
+uint16_t mqttTlsProbedPort = 0;
+bool mqttTlsMfln = false;
+// Last handshake metrics
+unsigned long mqttTlsStarted;
+unsigned long mqttTlsTime = 0;
+uint32_t mqttTlsFreeHeap;
+long mqttTlsHeap = 0;
+bool mqttTlsResumed = false;
+#else
 WiFiClient wifiClient;
-PubSubClient mqttClient(wifiClient);
+#endif
+MqttClient mqttClient(wifiClient);
+
+#ifdef COMMS_UdpPort
+WiFiUDP commsUdp;
+bool udpStarted = false;
+uint32_t udpNonce;
+// Last accepted sequence and bit mask of accepted sequences before it
+uint32_t udpLastSeq = 0;
+uint32_t udpSeqMask = 0;
+unsigned long udpCommands = 0;
+unsigned long udpRejected = 0;
+#ifdef ESP8266
+br_hmac_key_context udpKey;
+#endif
+#endif
+
+// Broker connection steps, advanced one step per commsLoop() pass to not block other loops
+enum MqttConnectStep {
+    mqttStepResolve,    // Choose broker (mDNS / MQTT_Address)
+#ifdef MQTT_TLS
+    mqttStepTls,        // Set up TLS, probe broker fragment length support
+#endif
+    mqttStepOpen,       // Open TCP connection
+    mqttStepConnect,    // Send CONNECT
+    mqttStepConnAck,    // Wait for CONNACK
+    mqttStepSubscribe,  // Subscribe Comms topics
+    mqttStepAnnounce,   // Publish Online, DeviceInfo
+    mqttStepCallbacks,  // Call modules' connect callbacks, one per pass
+    mqttStepOnline
+};
+MqttConnectStep mqttStep = mqttStepResolve;
+unsigned long mqttStepStarted;
+unsigned int mqttStepCallback;
+unsigned long mqttOnlineReported = 0;
+// Broker resumed session on reconnect: subscriptions are still active
+bool mqttSubscribed = false;
+unsigned long mqttHeartbeatDelay = COMMS_HeartbeatTimeout;
 
 struct MQTTCallbacks {
     MQTT_CALLBACK;
@@ -126,6 +403,22 @@ struct MQTTCallbacks {
 unsigned int mqttCbsCount = 0;
 MQTTCallbacks mqttCbs[MQTT_CbsSize];
 
+struct MQTTQosTopic {
+    char* name;
+    byte qos;
+};
+
+unsigned int mqttQosTopicsCount = 0;
+MQTTQosTopic mqttQosTopics[MQTT_QosTopicsSize];
+
+unsigned long mqttTxMessageCount = 0;
+unsigned long mqttTxByteCount = 0;
+
+void mqttQueueFlush(unsigned int count);
+#ifdef MQTT_MDNS
+void mqttMdnsStop();
+#endif
+
 //**************************************************************************
 //                          WIFI helper functions
 //**************************************************************************
@@ -161,6 +454,179 @@ void commsDisable() {
     commsConfig.disabled = true;
 }
 
+#if WIFI_FastConnect
+void wifiRoamSave() {
+#ifdef ESP8266
+    ESP.rtcUserMemoryWrite(WIFI_RtcOffset, (uint32_t*)&wifiRoamAP, sizeof(wifiRoamAP));
+#endif
+}
+
+void wifiRoamLoad() {
+#ifdef ESP8266
+    if (!ESP.rtcUserMemoryRead(WIFI_RtcOffset, (uint32_t*)&wifiRoamAP, sizeof(wifiRoamAP)) || (wifiRoamAP.magic != WIFI_RtcMagic)) {
+        wifiRoamAP.magic = 0;
+    }
+#endif
+}
+
+// Roamed AP is used only while saved network is the same
+bool wifiRoamValid() {
+    return (wifiRoamAP.magic == WIFI_RtcMagic) && (wifiRoamAP.network == commsConfig.wifiNetwork) &&
+        (wifiRoamAP.channel >= 1) && (wifiRoamAP.channel <= 14);
+}
+
+// Save AP and DHCP lease after connecting with full scan. Roaming within the same network only
+// updates AP in RTC memory: flash is written when network or lease changes
+void wifiRememberConnection(bool roaming) {
+    wifiFastConnected = wifiFastConnecting;
+    wifiFastConnecting = false;
+    wifiFastFailed = false;
+    wifiFastBrokerFailures = 0;
+    if (wifiFastConnected) return;
+
+    uint8_t* bssid = WiFi.BSSID();
+    uint8_t channel = WiFi.channel();
+    uint32_t ip = WiFi.localIP();
+    uint32_t gateway = WiFi.gatewayIP();
+    uint32_t subnet = WiFi.subnetMask();
+    uint32_t dns = WiFi.dnsIP();
+    if ((bssid == NULL) || (ip == 0)) return;
+
+    bool leaseChanged = (commsConfig.wifiNetwork != wifiNetwork) || (commsConfig.wifiChannel == 0) || (commsConfig.wifiIP != ip) ||
+        (commsConfig.wifiGateway != gateway) || (commsConfig.wifiSubnet != subnet) || (commsConfig.wifiDns != dns);
+    if (roaming && !leaseChanged) {
+        wifiRoamAP.magic = WIFI_RtcMagic;
+        memcpy(wifiRoamAP.bssid, bssid, sizeof(wifiRoamAP.bssid));
+        wifiRoamAP.channel = channel;
+        wifiRoamAP.network = wifiNetwork;
+        wifiRoamSave();
+        return;
+    }
+    if (wifiRoamAP.magic != 0) {
+        wifiRoamAP.magic = 0;
+        wifiRoamSave();
+    }
+    if (leaseChanged || (memcmp(commsConfig.wifiBssid, bssid, sizeof(commsConfig.wifiBssid)) != 0) || (commsConfig.wifiChannel != channel)) {
+        memcpy(commsConfig.wifiBssid, bssid, sizeof(commsConfig.wifiBssid));
+        commsConfig.wifiNetwork = wifiNetwork;
+        commsConfig.wifiChannel = channel;
+        commsConfig.wifiIP = ip;
+        commsConfig.wifiGateway = gateway;
+        commsConfig.wifiSubnet = subnet;
+        commsConfig.wifiDns = dns;
+        storageSave();
+    }
+}
+#endif
+
+// Start background scan, results are handled by wifiScanLoop()
+void wifiScanStart(WiFiScan purpose) {
+    aePrintln((purpose == wifiScanRoam) ? F("WIFI: Scanning for better AP") : F("WIFI: Scanning"));
+    wifiScan = purpose;
+    WiFi.scanNetworks(true);
+}
+
+void wifiScanCancel() {
+    if (wifiScan == wifiScanNone) return;
+    wifiScan = wifiScanNone;
+    WiFi.scanDelete();
+}
+
+// Strongest AP of known networks in scan results: scan result index or -1
+int wifiScanBest(int n, int* network) {
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < WIFI_Networks; k++) {
+            if (strcmp(WiFi.SSID(i).c_str(), wifiNetworks[k].ssid) != 0) continue;
+            if ((best < 0) || (WiFi.RSSI(i) > WiFi.RSSI(best))) {
+                best = i;
+                *network = k;
+            }
+        }
+    }
+    return best;
+}
+
+// Connect to AP found by scan. IP configuration is kept when roaming within the same network
+void wifiBeginScanned(int i, int network, bool keepConfig) {
+    if (!keepConfig) WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+    wifiNetwork = network;
+    WiFi.begin(wifiNetworks[network].ssid, wifiNetworks[network].password, WiFi.channel(i), WiFi.BSSID(i));
+}
+
+// Start connecting to AP: cached AP and IP configuration first if known, full scan and DHCP otherwise
+void wifiBegin() {
+#if WIFI_FastConnect
+    wifiFastConnecting = !wifiFastFailed && (commsConfig.wifiChannel != 0);
+    if (wifiFastConnecting) {
+        bool roamed = wifiRoamValid();
+        uint8_t channel = roamed ? wifiRoamAP.channel : commsConfig.wifiChannel;
+        aePrintf("WIFI: Fast connect, channel %d\r\n", channel);
+        wifiNetwork = commsConfig.wifiNetwork;
+        WiFi.config(IPAddress(commsConfig.wifiIP), IPAddress(commsConfig.wifiGateway), IPAddress(commsConfig.wifiSubnet), IPAddress(commsConfig.wifiDns));
+        WiFi.begin(wifiNetworks[wifiNetwork].ssid, wifiNetworks[wifiNetwork].password, channel, roamed ? wifiRoamAP.bssid : commsConfig.wifiBssid);
+        return;
+    }
+    // Back to DHCP
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+#endif
+    // Several networks: choose the strongest one
+    if (WIFI_Networks > 1) {
+        wifiScanStart(wifiScanConnect);
+        return;
+    }
+    wifiNetwork = 0;
+    WiFi.begin(WIFI_SSID, WIFI_Password);
+}
+
+void wifiScanLoop(unsigned long t) {
+    int n = WiFi.scanComplete();
+    if (n == WIFI_SCAN_RUNNING) return;
+
+    WiFiScan purpose = wifiScan;
+    wifiScan = wifiScanNone;
+    int network = 0;
+    int best = (n > 0) ? wifiScanBest(n, &network) : -1;
+
+    if (purpose == wifiScanConnect) {
+        if (best >= 0) {
+            aePrintf("WIFI: Connecting %s, channel %d, %d dBm\r\n", wifiNetworks[network].ssid, WiFi.channel(best), WiFi.RSSI(best));
+            wifiBeginScanned(best, network, false);
+        } else {
+            // Nothing found: let SDK search for the primary network
+            wifiNetwork = 0;
+            WiFi.begin(WIFI_SSID, WIFI_Password);
+        }
+    } else if ((best >= 0) && (WiFi.status() == WL_CONNECTED)) {
+        int rssi = WiFi.RSSI();
+        if ((memcmp(WiFi.BSSID(best), WiFi.BSSID(), 6) != 0) && (WiFi.RSSI(best) >= rssi + WIFI_RoamHysteresis)) {
+            aePrintf("WIFI: Roaming to %s, channel %d, %d dBm -> %d dBm\r\n", wifiNetworks[network].ssid, WiFi.channel(best), rssi, WiFi.RSSI(best));
+            wifiRoamStarted = t;
+            wifiWeakSince = 0;
+            if (mqttClient.connected()) mqttClient.disconnect();
+            mqttStep = mqttStepResolve;
+            commsConnecting = t;
+            commsConnectStarted = t;
+            wifiBeginScanned(best, network, network == wifiNetwork);
+        }
+    }
+    WiFi.scanDelete();
+}
+
+// Scan for better AP while signal stays weak
+void wifiRoamCheck(unsigned long t, int rssi) {
+    if (rssi >= WIFI_RoamThreshold) {
+        wifiWeakSince = 0;
+        return;
+    }
+    if (wifiWeakSince == 0) wifiWeakSince = t;
+    if ((wifiScan == wifiScanNone) && timedOut(t, wifiWeakSince, WIFI_RoamDelay)
+        && ((wifiScanned == 0) || timedOut(t, wifiScanned, WIFI_ScanInterval))) {
+        wifiScanned = t;
+        wifiScanStart(wifiScanRoam);
+    }
+}
+
 void commsConnect() {
     if (commsConfig.disabled) return;
     commsOffline = false;
@@ -173,6 +639,7 @@ void commsConnect() {
     }
 
     commsConnecting = millis();
+    commsConnectStarted = commsConnecting;
     commsPaused = 0;
 
     WiFi.forceSleepWake();
@@ -203,18 +670,25 @@ void commsConnect() {
     storageSave();
 
     WiFi.hostname(commsConfig.hostName);
-    WiFi.begin(WIFI_SSID, WIFI_Password);
+    wifiBegin();
 }
 
 void commsDisconnect() {
     if (mqttClient.connected()) {
         aePrintln(F("MQTT: Disconnecting"));
-        mqttPublish(TOPIC_Online, (long)0, true);
+        mqttPublish(TOPIC_Online, (char*)"0", true);
+        mqttQueueFlush(mqttQueueCount());
         mqttClient.disconnect();
     }
+    mqttStep = mqttStepResolve;
     if (wifiConnected()) {
         aePrintln(F("WIFI: Disconnecting"));
     }
+#ifdef MQTT_MDNS
+    mqttMdnsStop();
+#endif
+    wifiScanCancel();
+    wifiRoamStarted = 0;
     MDNS.end();
     WiFi.disconnect();
     WiFi.mode(WIFI_OFF);
@@ -222,6 +696,48 @@ void commsDisconnect() {
     commsOffline = true;
 }
 
+// Pseudo random numbers for retry jitter (xorshift32). Seeded from MAC address
+// so devices restarted by the same event don't retry in sync
+uint32_t commsRandom() {
+    if (commsRandomState == 0) {
+        uint8_t macAddr[6];
+        WiFi.macAddress(macAddr);
+        commsRandomState = 2166136261UL;
+        for (int i = 0; i < 6; i++) commsRandomState = (commsRandomState ^ macAddr[i]) * 16777619UL;
+        if (commsRandomState == 0) commsRandomState = 1;
+    }
+    commsRandomState ^= commsRandomState << 13;
+    commsRandomState ^= commsRandomState >> 17;
+    commsRandomState ^= commsRandomState << 5;
+    return commsRandomState;
+}
+
+// Delay before next connection attempt after given number of failed ones
+unsigned long commsBackoff(unsigned long attempt) {
+    unsigned long delay = COMMS_BackoffMin;
+    while ((attempt > 0) && (delay < COMMS_BackoffMax)) {
+        delay *= 2;
+        attempt--;
+    }
+    if (delay > COMMS_BackoffMax) delay = COMMS_BackoffMax;
+    unsigned long jitter = delay / 100 * COMMS_BackoffJitter;
+    return delay - jitter + commsRandom() % (jitter + 1);
+}
+
+// Heartbeat interval is randomized to keep heartbeats of devices connected at the same time apart
+unsigned long commsHeartbeatDelay() {
+    return COMMS_HeartbeatTimeout - COMMS_HeartbeatTimeout / 10 + commsRandom() % (COMMS_HeartbeatTimeout / 5);
+}
+
+void commsPause(unsigned long t, unsigned long delay, bool resume) {
+    commsPaused = t;
+    commsPauseDelay = delay;
+    commsPauseResume = resume;
+#ifdef Debug
+    aePrintf("WIFI: Next attempt in %lu ms\r\n", delay);
+#endif
+}
+
 void commsReconnect() {
     if (commsConfig.disabled || commsOffline) return;
     commsDisconnect();
@@ -289,7 +805,8 @@ void mqttSubscribeTopic(char* TOPIC_Name, char* topicVar1, char* topicVar2) {
     mqttSubscribeTopicRaw(mqttTopic(topic, TOPIC_Name, topicVar1, topicVar2));
 }
 void mqttSubscribeTopicRaw(char* topic) {
-    mqttClient.subscribe(topic);
+    if (mqttSubscribed) return;
+    mqttClient.subscribe(topic, MQTT_SubscribeQos);
 }
 
 // Wrappers to mqtt publish function
@@ -305,11 +822,36 @@ bool mqttPublish(char* TOPIC_Name, char* topicVar1, char* topicVar2, long value,
 }
 
 bool mqttPublishRaw(char* topic, long value, bool retained) {
+    if (mqttPayloadCbor()) {
+        uint8_t b[8];
+        CborWriter cbor;
+        cborInit(&cbor, b, sizeof(b));
+        cborWrite(&cbor, value);
+        return mqttPublishRaw(topic, b, cbor.length, retained);
+    }
     char sValue[32];
     sprintf(sValue, "%ld", value);
     return mqttPublishRaw(topic, sValue, retained);
 }
 
+bool mqttPublish(char* TOPIC_Name, float value, int decimals, bool retained) {
+    char topic[MQTT_MAX_TOPIC_LEN];
+    return mqttPublishRaw(mqttTopic(topic, TOPIC_Name), value, decimals, retained);
+}
+
+bool mqttPublishRaw(char* topic, float value, int decimals, bool retained) {
+    if (mqttPayloadCbor()) {
+        uint8_t b[8];
+        CborWriter cbor;
+        cborInit(&cbor, b, sizeof(b));
+        cborWrite(&cbor, value, decimals);
+        return mqttPublishRaw(topic, b, cbor.length, retained);
+    }
+    char sValue[32];
+    dtostrf(value, 0, decimals, sValue);
+    return mqttPublishRaw(topic, sValue, retained);
+}
+
 bool mqttPublish(char* TOPIC_Name, char* value, bool retained) {
     return mqttPublish(TOPIC_Name, NULL, NULL, value, retained);
 }
@@ -322,11 +864,137 @@ bool mqttPublish(char* TOPIC_Name, char* topicVar1, char* topicVar2, char* value
 }
 
 bool mqttPublishRaw(char* topic, char* value, bool retained) {
-    if (!mqttConnected()) return false;
 #ifdef Debug  
-    aePrint(F("Publish ")); aePrint(topic); aePrint(F("="));  aePrintln(value);
+    aePrint(F("Publish ")); aePrint(topic); aePrint(F("="));  aePrintln((value != NULL) ? value : "");
 #endif  
-    return mqttClient.publish(topic, value, retained);
+    return mqttPublishRaw(topic, (uint8_t*)value, (value != NULL) ? strlen(value) : 0, retained);
+}
+
+// Check if topic level(s) text conforms the rest of TOPIC_Name template, "%s" matches any text within a level
+bool mqttTopicMatch(char* topic, char* name) {
+    while (*name != 0) {
+        if ((name[0] == '%') && (name[1] == 's')) {
+            name += 2;
+            while (!mqttTopicMatch(topic, name)) {
+                if ((*topic == 0) || (*topic == '/')) return false;
+                topic++;
+            }
+            return true;
+        }
+        if (*topic != *name) return false;
+        topic++;
+        name++;
+    }
+    return (*topic == 0);
+}
+
+void mqttTopicQos(char* TOPIC_Name, byte qos) {
+    for (int i = 0; i < mqttQosTopicsCount; i++) {
+        if (strcmp(mqttQosTopics[i].name, TOPIC_Name) == 0) {
+            mqttQosTopics[i].qos = qos;
+            return;
+        }
+    }
+    if (mqttQosTopicsCount >= MQTT_QosTopicsSize) return;
+    mqttQosTopics[mqttQosTopicsCount].name = TOPIC_Name;
+    mqttQosTopics[mqttQosTopicsCount].qos = qos;
+    mqttQosTopicsCount++;
+}
+
+// QoS to publish the message with: first matching mqttTopicQos() template or MQTT_EventQos
+byte mqttPublishQos(char* topic, bool retained) {
+    if (retained) return 0;
+    if (mqttQosTopicsCount > 0) {
+        char root[MQTT_MAX_TOPIC_LEN];
+        unsigned int rootLength = strlen(mqttTopic(root, (char*)""));
+        if (strncmp(topic, root, rootLength) == 0) {
+            for (int i = 0; i < mqttQosTopicsCount; i++) {
+                char* name = mqttQosTopics[i].name;
+                while ((*name) == '/') name++;
+                if (mqttTopicMatch(topic + rootLength, name)) return mqttQosTopics[i].qos;
+            }
+        }
+    }
+    return MQTT_EventQos;
+}
+
+// Send PUBLISH packet and update traffic counters
+bool mqttSend(char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    if (!mqttClient.publish(topic, payload, length, retained, mqttPublishQos(topic, retained))) return false;
+    mqttTxMessageCount++;
+    mqttTxByteCount += mqttClient.lastPublishSize();
+    return true;
+}
+
+bool mqttPublishRaw(char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    if (commsConfig.disabled) return false;
+    // Retained (state) messages are always staged to be sent by commsLoop: latest value wins.
+    // Events are published directly unless older events are still queued. Staged states are sent first:
+    // event must not reach the broker before the state change that caused it
+    if (!retained && mqttConnected() && (mqttQueueEventCount() == 0)) {
+        mqttQueueFlush(mqttQueueCount());
+        if (mqttQueueEmpty() && !((mqttPublishQos(topic, retained) > 0) && mqttClient.inFlightFull())) {
+            return mqttSend(topic, payload, length, retained);
+        }
+    }
+    return mqttQueuePush(topic, payload, length, retained);
+}
+
+// Publish up to "count" staged messages or messages queued while broker was not available
+void mqttQueueFlush(unsigned int count) {
+    char* topic;
+    uint8_t* payload;
+    unsigned int length;
+    bool retained;
+    while ((count > 0) && mqttConnected() && mqttQueuePeek(&topic, &payload, &length, &retained)) {
+        // Wait for PUBACKs to keep events order
+        if ((mqttPublishQos(topic, retained) > 0) && mqttClient.inFlightFull()) return;
+        if (!mqttSend(topic, payload, length, retained) && !mqttClient.connected()) return;
+        // Message is dropped if it can't be sent while broker is connected (too long etc)
+        mqttQueuePop();
+        count--;
+    }
+}
+
+void mqttStateBegin(MqttState* state) {
+    state->cbor = mqttPayloadCbor();
+    if (state->cbor) {
+        cborBegin(&state->cborWriter, (uint8_t*)state->buffer, sizeof(state->buffer));
+    } else {
+        jsonBegin(&state->json, state->buffer, sizeof(state->buffer));
+    }
+}
+void mqttStateAdd(MqttState* state, char* key, long value) {
+    if (state->cbor) cborAdd(&state->cborWriter, key, value); else jsonAdd(&state->json, key, value);
+}
+void mqttStateAdd(MqttState* state, char* key, char* value) {
+    if (state->cbor) cborAdd(&state->cborWriter, key, value); else jsonAdd(&state->json, key, value);
+}
+void mqttStateAdd(MqttState* state, char* key, float value, int decimals) {
+    if (state->cbor) cborAdd(&state->cborWriter, key, value, decimals); else jsonAdd(&state->json, key, value, decimals);
+}
+bool mqttPublishState(char* TOPIC_Name, MqttState* state, bool retained) {
+    if (state->cbor ? !cborEnd(&state->cborWriter) : !jsonEnd(&state->json)) {
+        aePrint(F("MQTT: State document is too long: ")); aePrintln(TOPIC_Name);
+        return false;
+    }
+    char topic[MQTT_MAX_TOPIC_LEN];
+    mqttTopic(topic, TOPIC_Name);
+    if (state->cbor) {
+        return mqttPublishRaw(topic, (uint8_t*)state->buffer, state->cborWriter.length, retained);
+    }
+    return mqttPublishRaw(topic, state->buffer, retained);
+}
+
+bool mqttPayloadCbor() {
+    return (commsConfig.payloadFormat == MQTT_PayloadCbor);
+}
+
+unsigned long mqttTxMessages() {
+    return mqttTxMessageCount;
+}
+unsigned long mqttTxBytes() {
+    return mqttTxByteCount;
 }
 
 // TRUE if:
@@ -376,15 +1044,21 @@ void mqttRegisterCallbacks(MQTT_CALLBACK, MQTT_CONNECT) {
     mqttCbsCount++;
 }
 
-// Internal proxy function to process "default" topics
-void mqttCallbackProxy(char* topic, byte* payload, unsigned int length) {
-    if (mqttDisableCallback) return;
-
+// Pass message to modules' handlers. Returns true if one of them handled the topic
+bool mqttDispatch(char* topic, byte* payload, unsigned int length) {
     for (int i = 0; i < mqttCbsCount; i++) {
         if (mqttCbs[i].callback != NULL) {
-            if (mqttCbs[i].callback(topic, payload, length)) return;
+            if (mqttCbs[i].callback(topic, payload, length)) return true;
         }
     }
+    return false;
+}
+
+// Internal proxy function to process "default" topics
+void mqttCallbackProxy(char* topic, byte* payload, unsigned int length) {
+    if (mqttDisableCallback) return;
+
+    if (mqttDispatch(topic, payload, length)) return;
 
     if (mqttIsTopic(topic, TOPIC_Reset)) {
         aePrintln(F("MQTT: Resetting by request"));
@@ -410,6 +1084,21 @@ void mqttCallbackProxy(char* topic, byte* payload, unsigned int length) {
             commsRestart();
         }
 #endif
+#ifndef MQTT_PayloadFormat
+    } else if (mqttIsTopic(topic, TOPIC_SetPayloadFormat)) {
+        byte format = commsConfig.payloadFormat;
+        if ((payload != NULL) && (length == 4) && (strncasecmp((char*)payload, "text", 4) == 0)) {
+            format = MQTT_PayloadText;
+        } else if ((payload != NULL) && (length == 4) && (strncasecmp((char*)payload, "cbor", 4) == 0)) {
+            format = MQTT_PayloadCbor;
+        }
+        if (format != commsConfig.payloadFormat) {
+            commsConfig.payloadFormat = format;
+            aePrint(F("MQTT: Payload format set to ")); aePrintln(mqttPayloadCbor() ? "CBOR" : "text");
+            // Restart to republish all retained topics in new format
+            commsRestart();
+        }
+#endif
 #ifndef MQTT_Root
     } else if (mqttIsTopic(topic, TOPIC_SetRoot)) {
         if ((payload != NULL) && (length > 3) && (length < 63)
@@ -430,7 +1119,6 @@ void mqttPublishDeviceInfo() {
     IPAddress ip = WiFi.localIP();
     uint8_t macAddr[6];
     WiFi.macAddress(macAddr);
-    commsRSSI = WiFi.RSSI();
 
 #ifdef ESP32
     int espModelNo = 32;
@@ -438,7 +1126,7 @@ void mqttPublishDeviceInfo() {
     int espModelNo = esp_is_8285() ? 8285 : 8266;
 #endif
 
-    static char* deviceInfoFormatString PROGMEM = "%s\nESP%d/%dMB/%uMHz\nMAC: %02X %02X %02X %02X %02X %02X\nSSID: %s/%ddB\nIP: %d.%d.%d.%d\nBroker: %s, %s\nAELib v%s";
+    static char* deviceInfoFormatString PROGMEM = "%s\nESP%d/%dMB/%uMHz\nMAC: %02X %02X %02X %02X %02X %02X\nSSID: %s\nIP: %d.%d.%d.%d\nBroker: %s, %s\nAELib v%s";
 #ifdef MQTT_User
     static char* deviceInfoAuthorization PROGMEM = "authorized";
 #else
@@ -451,7 +1139,7 @@ void mqttPublishDeviceInfo() {
         (int)(ESP.getFlashChipRealSize() / 1024 / 1024),
         ESP.getCpuFreqMHz(),
         macAddr[0], macAddr[1], macAddr[2], macAddr[3], macAddr[4], macAddr[5],
-        WIFI_SSID, commsRSSI,
+        wifiNetworks[wifiNetwork].ssid,
         ip[0], ip[1], ip[2], ip[3],
         mqttServerAddress,
         deviceInfoAuthorization,
@@ -464,6 +1152,72 @@ void mqttPublishDeviceInfo() {
 #endif
     mqttPublish(TOPIC_DeviceInfo, deviceInfo, true);
 }
+
+// Connection timing: boot to first Online, last WiFi connection and last full connection (WiFi + broker)
+void mqttPublishConnectionStats() {
+    char stats[256];
+    JsonWriter json;
+    jsonBegin(&json, stats, sizeof(stats));
+    jsonAdd(&json, "BootToOnline", (long)commsBootToOnline);
+    jsonAdd(&json, "WiFi", (long)wifiConnectTime);
+    jsonAdd(&json, "Total", (long)commsConnectTime);
+    jsonAdd(&json, "Attempts", (long)commsConnectAttempts + 1);
+#if WIFI_FastConnect
+    jsonAdd(&json, "FastConnect", (long)(wifiFastConnected ? 1 : 0));
+#endif
+    jsonAdd(&json, "Roams", (long)wifiRoams);
+    jsonAdd(&json, "RoamTime", (long)wifiRoamTime);
+#ifdef MQTT_TLS
+    jsonAdd(&json, "Tls", (long)mqttTlsTime);
+    jsonAdd(&json, "TlsResumed", (long)(mqttTlsResumed ? 1 : 0));
+    jsonAdd(&json, "TlsHeap", mqttTlsHeap);
+#ifdef ESP8266
+    jsonAdd(&json, "TlsMfln", (long)(mqttTlsMfln ? MQTT_TlsRxBuffer : 0));
+    // BearSSL runs on its own stack: high-water mark shows how much of it handshake needs
+    jsonAdd(&json, "TlsStack", (long)stack_thunk_get_max_usage());
+#ifdef UMM_STATS_FULL
+    jsonAdd(&json, "TlsMinHeap", (long)umm_free_heap_size_min());
+#endif
+#endif
+#endif
+    if (jsonEnd(&json)) mqttPublish(TOPIC_Connection, stats, false);
+}
+
+// Signal level is published separately to not resend DeviceInfo when it changes
+void mqttPublishRSSI() {
+    commsRSSI = WiFi.RSSI();
+    mqttPublish(TOPIC_RSSI, (long)commsRSSI, true);
+}
+
+void mqttPublishStats() {
+    char stats[256];
+    unsigned long passMax, loopMax;
+    int loopIndex;
+    aeLoopProfile(&passMax, &loopIndex, &loopMax);
+    JsonWriter json;
+    jsonBegin(&json, stats, sizeof(stats));
+    jsonAdd(&json, "TxMessages", (long)mqttTxMessageCount);
+    jsonAdd(&json, "TxBytes", (long)mqttTxByteCount);
+    jsonAdd(&json, "Pings", (long)mqttClient.pingCount());
+    if ((MQTT_EventQos > 0) || (mqttQosTopicsCount > 0)) jsonAdd(&json, "Retransmits", (long)mqttClient.retransmitCount());
+#if (MQTT_Version == 5)
+    jsonAdd(&json, "Aliased", (long)mqttClient.aliasedCount());
+#endif
+#ifdef COMMS_UdpPort
+    jsonAdd(&json, "UdpCommands", (long)udpCommands);
+    jsonAdd(&json, "UdpRejected", (long)udpRejected);
+#endif
+    jsonAdd(&json, "Queued", (long)mqttQueueCount());
+    jsonAdd(&json, "Coalesced", (long)mqttQueueCoalesced());
+    jsonAdd(&json, "DroppedStates", (long)mqttQueueDroppedStates());
+    jsonAdd(&json, "DroppedEvents", (long)mqttQueueDroppedEvents());
+    // Worst loop stall since previous report, us
+    jsonAdd(&json, "MaxPass", (long)passMax);
+    jsonAdd(&json, "MaxLoop", (long)loopMax);
+    jsonAdd(&json, "MaxLoopIndex", (long)loopIndex);
+    if (jsonEnd(&json)) mqttPublish(TOPIC_Stats, stats, false);
+    aeLoopProfileReset();
+}
 #pragma endregion
 
 //**************************************************************************
@@ -515,6 +1269,513 @@ bool haConnected() {
 }
 #pragma endregion
 
+#pragma region MQTT connection
+void mqttStepNext(MqttConnectStep step, unsigned long t) {
+#ifdef Debug
+    aePrintf("MQTT: Step %d done in %lu ms\r\n", mqttStep, (unsigned long)(t - mqttStepStarted));
+#endif
+    mqttStep = step;
+    mqttStepStarted = millis();
+}
+
+void mqttConnectFailed(unsigned long t) {
+    aePrint(F("MQTT: Connection error #")); aePrintln(mqttClient.state());
+    wifiClient.stop();
+#ifdef MQTT_TLS
+    // Broker may have been unavailable while probing: probe it again on next attempt
+    mqttTlsProbedPort = 0;
+#endif
+#ifdef MQTT_MDNS
+    if (mqttBrokerCached) mqttBrokerCacheFailed = true;
+#endif
+    mqttStep = mqttStepResolve;
+#if WIFI_FastConnect
+    // Next reconnect gets address by DHCP, new lease is saved if it differs
+    if (wifiFastConnected && (++wifiFastBrokerFailures >= WIFI_FastConnectBrokerAttempts)) {
+        aePrintln(F("WIFI: Broker unreachable with cached lease, using DHCP"));
+        wifiFastConnected = false;
+        wifiFastFailed = true;
+        commsPause(t, commsBackoff(commsConnectAttempt), false);
+        return;
+    }
+#endif
+#ifdef MQTT_MDNS
+    if ((mqttMdnsCnt > 0) || mqttBrokerCacheFailed) {
+        // More brokers to try
+        commsPause(t, COMMS_ConnectNextTimeout, false);
+        return;
+    }
+#endif
+    commsPause(t, commsBackoff(commsConnectAttempt), false);
+}
+
+#ifdef MQTT_MDNS
+void mqttMdnsStop() {
+#ifdef ESP8266
+    if (mqttMdnsQuery != NULL) {
+        MDNS.removeServiceQuery(mqttMdnsQuery);
+        mqttMdnsQuery = NULL;
+        WiFi.setSleepMode(wifiTimeCritical ? WIFI_NONE_SLEEP : WIFI_LIGHT_SLEEP);
+    }
+#endif
+}
+
+void mqttMdnsAdd(IPAddress ip, uint16_t port) {
+    char address[16];
+    sprintf(address, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+    bool valid = (ip[0] || ip[1] || ip[2] || ip[3]) && (port != 0);
+    if (valid && (mqttMdnsCnt < mqttMdnsSize)) {
+        strcpy(mqttMdns[mqttMdnsCnt].address, address);
+        mqttMdns[mqttMdnsCnt].port = port;
+        aePrintf("MQTT: + %s:%d\n", mqttMdns[mqttMdnsCnt].address, mqttMdns[mqttMdnsCnt].port);
+        mqttMdnsCnt++;
+    } else {
+        aePrintf("MQTT: - %s:%d ignored\n", address, port);
+    }
+}
+
+// Discover brokers advertised via mDNS. Returns false while query is in progress
+bool mqttMdnsDiscover(unsigned long t) {
+    mqttMdnsIndex = 0;
+    mqttMdnsCnt = 0;
+    memset(mqttMdns, 0, sizeof(mqttMdns));
+#ifdef ESP8266
+    // Query runs in background, answers are collected by MDNS.update()
+    if (mqttMdnsQuery == NULL) {
+        aePrintln(F("MQTT: Querying MDNS for broker"));
+        // Multicast answers may be missed in light sleep
+        WiFi.setSleepMode(WIFI_NONE_SLEEP);
+        mqttMdnsQuery = MDNS.installServiceQuery(MQTT_MdnsService, "tcp", nullptr);
+        mqttMdnsQueryStarted = t;
+        if (mqttMdnsQuery == NULL) {
+            aePrintln(F("MQTT: MDNS query failed"));
+            WiFi.setSleepMode(wifiTimeCritical ? WIFI_NONE_SLEEP : WIFI_LIGHT_SLEEP);
+            return true;
+        }
+        return false;
+    }
+    MDNS.update();
+    if (!timedOut(t, mqttMdnsQueryStarted, MQTT_MdnsTimeout)) return false;
+
+    int n = MDNS.answerCount(mqttMdnsQuery);
+    aePrintf("MQTT: %d brokers advertised:\n", n);
+    for (int i = 0; i < n; ++i) {
+        IPAddress ip = MDNS.hasAnswerIP4Address(mqttMdnsQuery, i) ? MDNS.answerIP4Address(mqttMdnsQuery, i, 0) : IPAddress((uint32_t)0);
+        mqttMdnsAdd(ip, MDNS.hasAnswerPort(mqttMdnsQuery, i) ? MDNS.answerPort(mqttMdnsQuery, i) : 0);
+    }
+    mqttMdnsStop();
+#else
+    aePrintln(F("MQTT: Querying MDNS for broker"));
+    WiFi.setSleepMode(WIFI_NONE_SLEEP);
+    int n = MDNS.queryService(MQTT_MdnsService, "tcp", (uint16_t)MQTT_MdnsTimeout);
+    WiFi.setSleepMode(wifiTimeCritical ? WIFI_NONE_SLEEP : WIFI_LIGHT_SLEEP);
+
+    aePrintf("MQTT: %d brokers advertised:\n", n);
+    for (int i = 0; i < n; ++i) {
+        mqttMdnsAdd(MDNS.IP(i), MDNS.port(i));
+    }
+#endif
+    return true;
+}
+
+// Save broker connected to as the one to try first next time
+void mqttRememberBroker() {
+    mqttBrokerCacheFailed = false;
+    if (mqttBrokerCached) return;
+    if ((strcmp(commsConfig.brokerAddress, mqttServerAddress) != 0) || (commsConfig.brokerPort != mqttServerPort)) {
+        strncpy(commsConfig.brokerAddress, mqttServerAddress, sizeof(commsConfig.brokerAddress) - 1);
+        commsConfig.brokerPort = mqttServerPort;
+        storageSave();
+    }
+}
+#endif
+
+// Choose broker to connect to. Returns 1 if broker is chosen, 0 if discovery is in progress
+// and -1 if no broker is available
+int mqttResolveBroker(unsigned long t) {
+    char willTopic[MQTT_MAX_TOPIC_LEN];
+#ifdef MQTT_MDNS
+    // Cached broker first, discovery is used only if it fails
+    mqttBrokerCached = (mqttMdnsCnt <= 0) && !mqttBrokerCacheFailed && (commsConfig.brokerPort != 0);
+    if (mqttBrokerCached) {
+        mqttTopic(willTopic, "*");
+        aePrintf("MQTT: Connecting cached broker %s:%d as %s\r\n", commsConfig.brokerAddress, commsConfig.brokerPort, willTopic);
+        strcpy(mqttServerAddress, commsConfig.brokerAddress);
+        mqttServerPort = commsConfig.brokerPort;
+        mqttClient.setServer(mqttServerAddress, mqttServerPort);
+        return 1;
+    }
+
+    if (mqttMdnsCnt <= 0) {
+        if (!mqttMdnsDiscover(t)) return 0;
+        // Nothing found: try cached broker again next time
+        if (mqttMdnsCnt <= 0) mqttBrokerCacheFailed = false;
+    }
+
+    if (mqttMdnsCnt > 0) {
+        mqttTopic(willTopic, "*");
+        aePrintf("MQTT: Connecting broker #%d %s:%d as %s\r\n", mqttMdnsIndex, mqttMdns[mqttMdnsIndex].address, mqttMdns[mqttMdnsIndex].port, willTopic);
+        strcpy(mqttServerAddress, mqttMdns[mqttMdnsIndex].address);
+        mqttServerPort = mqttMdns[mqttMdnsIndex].port;
+        mqttClient.setServer(mqttServerAddress, mqttServerPort);
+        mqttMdnsIndex++;
+        if (mqttMdnsIndex >= mqttMdnsCnt) {
+            mqttMdnsCnt = 0;
+            mqttMdnsIndex = 0;
+        }
+    } else {
+        return -1;
+    }
+#else
+    mqttTopic(willTopic, "*");
+    aePrintf("MQTT: Connecting broker %s:%d as %s\r\n", MQTT_Address, MQTT_Port, willTopic);
+    mqttClient.setServer(MQTT_Address, MQTT_Port);
+    strcpy(mqttServerAddress, MQTT_Address);
+    mqttServerPort = MQTT_Port;
+#endif
+    return 1;
+}
+
+#ifdef MQTT_TLS
+#ifdef ESP8266
+struct MqttTlsRtc {
+    uint32_t magic;
+    BearSSL::Session session;
+};
+
+// TLS session survives reset and deep sleep in RTC memory (but not power loss)
+void mqttTlsSessionSave() {
+    MqttTlsRtc rtc;
+    rtc.magic = MQTT_TlsRtcMagic;
+    rtc.session = mqttTlsSession;
+    ESP.rtcUserMemoryWrite(MQTT_TlsRtcOffset, (uint32_t*)&rtc, sizeof(rtc));
+}
+
+void mqttTlsSessionLoad() {
+    MqttTlsRtc rtc;
+    if (ESP.rtcUserMemoryRead(MQTT_TlsRtcOffset, (uint32_t*)&rtc, sizeof(rtc)) && (rtc.magic == MQTT_TlsRtcMagic)) {
+        mqttTlsSession = rtc.session;
+    }
+}
+#endif
+
+// Certificate check, session to resume and buffer sizes. Probing broker for Maximum Fragment Length
+// support takes extra connection, so it is done once per broker in a separate step
+void mqttTlsSetup() {
+#ifdef ESP8266
+#if defined(MQTT_TlsFingerprint)
+    wifiClient.setFingerprint(MQTT_TlsFingerprint);
+#elif defined(MQTT_TlsCA)
+    wifiClient.setTrustAnchors(&mqttTlsCA);
+    // Certificate validity is checked against current time if it is known already
+    time_t now = time(nullptr);
+    if (now > 1600000000) wifiClient.setX509Time(now);
+#else
+    wifiClient.setInsecure();
+#endif
+    wifiClient.setSession(&mqttTlsSession);
+    if ((strcmp(mqttTlsProbedAddress, mqttServerAddress) != 0) || (mqttTlsProbedPort != mqttServerPort)) {
+        mqttTlsMfln = BearSSL::WiFiClientSecure::probeMaxFragmentLength(mqttServerAddress, mqttServerPort, MQTT_TlsRxBuffer);
+        strcpy(mqttTlsProbedAddress, mqttServerAddress);
+        mqttTlsProbedPort = mqttServerPort;
+        aePrintf("TLS: Fragment length %d %s\r\n", MQTT_TlsRxBuffer, mqttTlsMfln ? "accepted" : "not supported");
+    }
+    wifiClient.setBufferSizes(mqttTlsMfln ? MQTT_TlsRxBuffer : 16384, MQTT_TlsTxBuffer);
+#else
+#ifdef MQTT_TlsCA
+    wifiClient.setCACert(MQTT_TlsCA);
+#else
+    wifiClient.setInsecure();
+#endif
+#endif
+}
+
+void mqttTlsOpening() {
+#ifdef ESP8266
+    mqttTlsPrevious = mqttTlsSession;
+#ifdef UMM_STATS_FULL
+    umm_free_heap_size_min_reset();
+#endif
+#endif
+    mqttTlsFreeHeap = ESP.getFreeHeap();
+    mqttTlsStarted = millis();
+}
+
+// Handshake time (including TCP connect) and heap held by TLS connection
+void mqttTlsOpened() {
+    mqttTlsTime = millis() - mqttTlsStarted;
+    mqttTlsHeap = (long)mqttTlsFreeHeap - (long)ESP.getFreeHeap();
+#ifdef ESP8266
+    // Session parameters are unchanged if broker accepted session id offered
+    BearSSL::Session empty;
+    mqttTlsResumed =
+        (memcmp(&mqttTlsPrevious, &empty, sizeof(empty)) != 0) &&
+        (memcmp(&mqttTlsPrevious, &mqttTlsSession, sizeof(mqttTlsSession)) == 0);
+    if (!mqttTlsResumed) mqttTlsSessionSave();
+#endif
+    aePrintf("TLS: %s handshake %lu ms, %ld bytes of heap\r\n", mqttTlsResumed ? "Resumed" : "Full", mqttTlsTime, mqttTlsHeap);
+}
+#endif
+
+// Advance broker connection by one step
+void mqttConnectStep(unsigned long t) {
+    char topic[MQTT_MAX_TOPIC_LEN];
+    int rc;
+
+    switch (mqttStep) {
+    case mqttStepResolve:
+        rc = mqttResolveBroker(t);
+        if (rc == 0) break; // Discovery in progress
+        if (rc < 0) {
+            mqttConnectFailed(t);
+            return;
+        }
+        mqttClient.setCallback(mqttCallbackProxy);
+#ifdef MQTT_TLS
+        mqttStepNext(mqttStepTls, t);
+        break;
+
+    case mqttStepTls:
+        mqttTlsSetup();
+#endif
+        mqttStepNext(mqttStepOpen, t);
+        break;
+
+    case mqttStepOpen:
+        // TCP connect (and TLS handshake) can't be made asynchronous with WiFiClient, so it is limited by timeout
+        wifiClient.setTimeout(MQTT_OpenTimeout);
+#ifdef MQTT_TLS
+        mqttTlsOpening();
+#endif
+        if (!mqttClient.open()) {
+            mqttConnectFailed(t);
+            return;
+        }
+#ifdef MQTT_TLS
+        mqttTlsOpened();
+#endif
+        mqttStepNext(mqttStepConnect, t);
+        break;
+
+    case mqttStepConnect:
+        mqttTopic(topic, TOPIC_Online);
+        if (!mqttClient.connectBegin(commsConfig.hostName, NULL, NULL, topic, 0, true, "0")) {
+            mqttConnectFailed(t);
+            return;
+        }
+        mqttStepNext(mqttStepConnAck, t);
+        break;
+
+    case mqttStepConnAck:
+        rc = mqttClient.connectPoll();
+        if ((rc < 0) || ((rc == 0) && timedOut(t, mqttStepStarted, MQTT_ConnAckTimeout))) {
+            mqttConnectFailed(t);
+            return;
+        }
+        if (rc > 0) {
+            // Subscriptions of resumed session are not repeated, except first connection after boot:
+            // firmware may have been changed
+            mqttSubscribed = mqttClient.sessionPresent() && (commsBootToOnline != 0);
+            commsConnectAttempts = commsConnectAttempt;
+#if WIFI_FastConnect
+            wifiFastBrokerFailures = 0;
+#endif
+            commsConnectAttempt = 0;
+            aePrintln(F("MQTT: Connected"));
+#ifdef MQTT_MDNS
+            mqttRememberBroker();
+#endif
+#ifdef MQTT_MAX_PACKET_SIZE
+            mqttClient.setBufferSize(MQTT_MAX_PACKET_SIZE);
+#endif
+
+#ifdef TIMEZONE
+            // adjust time zone
+            configTime(TIMEZONE, mqttServerAddress, NTP_SERVER1, NTP_SERVER2);
+            tzset();
+#endif  
+            mqttStepNext(mqttStepSubscribe, t);
+        }
+        break;
+
+    case mqttStepSubscribe:
+        mqttSubscribeTopic(TOPIC_Reset);
+        mqttSubscribeTopic(TOPIC_FactoryReset);
+        mqttSubscribeTopic(TOPIC_EnableOTA);
+        mqttSubscribeTopicRaw(TOPIC_HA_Status);
+
+#ifndef WIFI_HostName
+        mqttSubscribeTopic(TOPIC_SetName);
+#endif  
+
+#ifndef MQTT_Root
+        mqttSubscribeTopic(TOPIC_SetRoot);
+#endif  
+
+#ifndef MQTT_PayloadFormat
+        mqttSubscribeTopic(TOPIC_SetPayloadFormat);
+#endif  
+        mqttStepNext(mqttStepAnnounce, t);
+        break;
+
+    case mqttStepAnnounce:
+        mqttPublish(TOPIC_Online, (char*)"1", true);
+        mqttPublish(TOPIC_PayloadFormat, (char*)(mqttPayloadCbor() ? "cbor" : "text"), true);
+        mqttOnlineReported = t;
+        mqttHeartbeatDelay = commsHeartbeatDelay();
+        mqttPublishDeviceInfo();
+        mqttPublishRSSI();
+        mqttStepCallback = 0;
+        mqttStepNext(mqttStepCallbacks, t);
+        break;
+
+    case mqttStepCallbacks:
+        // One module per pass
+        while ((mqttStepCallback < mqttCbsCount) && (mqttCbs[mqttStepCallback].connect == NULL)) mqttStepCallback++;
+        if (mqttStepCallback < mqttCbsCount) {
+            mqttCbs[mqttStepCallback++].connect();
+            break;
+        }
+        commsPaused = 0;
+        mqttSubscribed = false;
+        commsConnectTime = t - commsConnectStarted;
+        if (commsBootToOnline == 0) commsBootToOnline = t;
+        if (wifiRoamStarted != 0) {
+            wifiRoams++;
+            wifiRoamTime = t - wifiRoamStarted;
+            wifiRoamStarted = 0;
+        }
+        aePrintf("MQTT: Online in %lu ms (WiFi %lu ms), %lu ms since boot\r\n", commsConnectTime, wifiConnectTime, t);
+        mqttPublishConnectionStats();
+        mqttStepNext(mqttStepOnline, t);
+        break;
+
+    case mqttStepOnline:
+        break;
+    }
+}
+#pragma endregion
+
+//**************************************************************************
+//                     UDP control (LAN path bypassing broker)
+//**************************************************************************
+#pragma region UDP control
+#ifdef COMMS_UdpPort
+void udpPut32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+uint32_t udpGet32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void udpMac(const uint8_t* data, unsigned int length, uint8_t* mac) {
+    uint8_t out[32];
+#ifdef ESP8266
+    br_hmac_context hmac;
+    br_hmac_init(&hmac, &udpKey, 0);
+    br_hmac_update(&hmac, data, length);
+    br_hmac_out(&hmac, out);
+#else
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+        (const unsigned char*)COMMS_UdpKey, strlen(COMMS_UdpKey), data, length, out);
+#endif
+    memcpy(mac, out, UDP_MacSize);
+}
+
+// Anti-replay: sequence must be new and not older than UDP_SeqWindow
+bool udpSeqAccept(uint32_t seq) {
+    if (seq > udpLastSeq) {
+        uint32_t shift = seq - udpLastSeq;
+        udpSeqMask = (shift < UDP_SeqWindow) ? ((udpSeqMask << shift) | 1) : 1;
+        udpLastSeq = seq;
+        return true;
+    }
+    uint32_t age = udpLastSeq - seq;
+    if ((age >= UDP_SeqWindow) || (udpSeqMask & ((uint32_t)1 << age))) return false;
+    udpSeqMask |= (uint32_t)1 << age;
+    return true;
+}
+
+void udpReply(uint32_t seq, uint8_t status) {
+    uint8_t reply[UDP_HeaderSize + 5 + UDP_MacSize];
+    reply[0] = UDP_Version;
+    reply[1] = 'R';
+    udpPut32(reply + 2, udpNonce);
+    udpPut32(reply + 6, seq);
+    reply[UDP_HeaderSize] = status;
+    udpPut32(reply + UDP_HeaderSize + 1, udpLastSeq);
+    udpMac(reply, UDP_HeaderSize + 5, reply + UDP_HeaderSize + 5);
+    commsUdp.beginPacket(commsUdp.remoteIP(), commsUdp.remotePort());
+    commsUdp.write(reply, sizeof(reply));
+    commsUdp.endPacket();
+}
+
+// Receive one command per pass and execute it by the same module handlers as MQTT messages.
+// Handlers publish resulting state to MQTT as usual (queued while broker is not available)
+void udpLoop() {
+    if (!udpStarted) {
+#ifdef ESP8266
+        udpNonce = ESP.random();
+        br_hmac_key_init(&udpKey, &br_sha256_vtable, COMMS_UdpKey, strlen(COMMS_UdpKey));
+#else
+        udpNonce = esp_random();
+#endif
+        udpStarted = commsUdp.begin(COMMS_UdpPort);
+        if (udpStarted) aePrintf("UDP: Listening on port %d\r\n", COMMS_UdpPort);
+        return;
+    }
+
+    int size = commsUdp.parsePacket();
+    if (size <= 0) return;
+    uint8_t packet[UDP_PacketSize + 1];
+    if ((size > UDP_PacketSize) || (size < UDP_HeaderSize + 1 + UDP_MacSize)) {
+        udpRejected++;
+        return;
+    }
+    size = commsUdp.read(packet, size);
+    unsigned int signedSize = size - UDP_MacSize;
+
+    uint8_t mac[UDP_MacSize];
+    udpMac(packet, signedSize, mac);
+    uint8_t diff = 0;
+    for (int i = 0; i < UDP_MacSize; i++) diff |= mac[i] ^ packet[signedSize + i];
+    if ((diff != 0) || (packet[0] != UDP_Version) || (packet[1] != 'C')) {
+        udpRejected++;
+        return;
+    }
+
+    uint32_t seq = udpGet32(packet + 6);
+    if ((udpGet32(packet + 2) != udpNonce) || !udpSeqAccept(seq)) {
+        udpRejected++;
+        udpReply(seq, udpStale);
+        return;
+    }
+
+    char topic[MQTT_MAX_TOPIC_LEN];
+    unsigned int topicLength = packet[UDP_HeaderSize];
+    char* name = (char*)packet + UDP_HeaderSize + 1;
+    unsigned int payload = UDP_HeaderSize + 1 + topicLength;
+    mqttTopic(topic, (char*)"");
+    // Topic name is not a template: '%' is not allowed
+    if ((payload > signedSize) || (strlen(topic) + topicLength >= sizeof(topic))
+        || (memchr(name, '%', topicLength) != NULL) || (memchr(name, 0, topicLength) != NULL)) {
+        udpRejected++;
+        udpReply(seq, udpMalformed);
+        return;
+    }
+    strncat(topic, name, topicLength);
+    // Handlers may treat payload as string
+    packet[signedSize] = 0;
+
+    udpCommands++;
+    bool handled = !mqttDisableCallback && mqttDispatch(topic, packet + payload, signedSize - payload);
+    udpReply(seq, handled ? udpOk : udpUnknown);
+}
+#endif
+#pragma endregion
+
+//**************************************************************************
 //**************************************************************************
 //                            Comms engine
 //**************************************************************************
@@ -524,14 +1785,30 @@ void commsLoop() {
     if (commsConfig.disabled || commsOffline) return;
 
     static bool wasConnected = false;
-    static unsigned long onlineReported = 0;
     static unsigned long rssiChecked = 0;
+    static unsigned long rssiReported = 0;
+    static unsigned long queueFlushed = 0;
+    static unsigned long droppedReported = 0;
 
     unsigned long t = millis();
+
+    // Activity is an event: it is queued while broker is not connected
+    static bool activityReported = false;
+    bool a = (mqttActivity != 0) && (!timedOut(t, mqttActivity, MQTT_ActivityTimeout));
+    if ((a != activityReported) && mqttPublish(TOPIC_Activity, (char*)(a ? "1" : "0"), false)) {
+        activityReported = a;
+    }
+
+    if (wifiScan != wifiScanNone) wifiScanLoop(t);
+
     // Check if connection is not timed out
     if (WiFi.status() == WL_CONNECTED) {  // WiFi is already connected
         if (commsConnecting > 0) {
             commsConnecting = 0;
+            wifiConnectTime = t - commsConnectStarted;
+#if WIFI_FastConnect
+            wifiRememberConnection(wifiRoamStarted != 0);
+#endif
             aePrint(F("WIFI: Connected as "));
 #ifdef ESP8266
             aePrint(WiFi.hostname());
@@ -546,6 +1823,10 @@ void commsLoop() {
             return; // Split activity to not overload loop
         }
 
+#ifdef COMMS_UdpPort
+        udpLoop();
+#endif
+
         // Handle OTA things
         if (otaEnabled > 0) {
             if (!timedOut(t, otaEnabled, CONFIG_Timeout)) {
@@ -555,7 +1836,8 @@ void commsLoop() {
                     ArduinoOTA.setHostname(commsConfig.hostName);
                     ArduinoOTA.setPassword(WIFI_Password);
                     ArduinoOTA.onStart([]() {
-                        mqttPublish(TOPIC_Online, (long)0, true);
+                        mqttPublish(TOPIC_Online, (char*)"0", true);
+                        mqttQueueFlush(mqttQueueCount());
                         storageSave();
 #ifdef LittleFS
                         LittleFS.end();
@@ -574,7 +1856,7 @@ void commsLoop() {
                     ArduinoOTA.handle();
                 }
             } else {
-                mqttPublish(TOPIC_Online, (long)0, true);
+                mqttPublish(TOPIC_Online, (char*)"0", true);
                 aePrintln(F("OTA: Timeout waiting for update. Restarting"));
                 commsRestart();
             }
@@ -582,26 +1864,41 @@ void commsLoop() {
 
         // Handle MQTT connection and loops
         if (mqttClient.loop()) {
+            if (mqttStep != mqttStepOnline) {
+                mqttConnectStep(t);
+                return; // Split activity to not overload loop
+            }
             wasConnected = true;
-            static bool activityReported = false;
-            bool a = (mqttActivity != 0) && (!timedOut(t, mqttActivity, MQTT_ActivityTimeout));
-            if ((a != activityReported) && mqttPublish(TOPIC_Activity, a ? 1 : 0, false)) {
-                activityReported = a;
+
+            // Send staged and queued messages in paced bursts
+            if (!mqttQueueEmpty() && ((MQTT_CoalesceWindow == 0) || timedOut(t, queueFlushed, MQTT_CoalesceWindow))) {
+                queueFlushed = t;
+                mqttQueueFlush(MQTT_QueueBurst);
+                unsigned long dropped = mqttQueueDroppedStates() + mqttQueueDroppedEvents();
+                if (mqttQueueEmpty() && (dropped != droppedReported)) {
+                    aePrintf("MQTT: %lu queued messages dropped\r\n", dropped - droppedReported);
+                    droppedReported = dropped;
+                    mqttPublishStats();
+                }
             }
 
             if (timedOut(t, rssiChecked, 5000)) {
                 int rssi = WiFi.RSSI();
                 int d = (rssi > commsRSSI) ? rssi - commsRSSI : commsRSSI - rssi;
-                if ((timedOut(t, rssiChecked, COMMS_RSSITimeout) && (d > 5)) || (d > 20)) {
-                    mqttPublishDeviceInfo();
+                if ((timedOut(t, rssiReported, COMMS_RSSITimeout) && (d > 5)) || (d > 20)) {
+                    mqttPublishRSSI();
+                    rssiReported = t;
                 }
+                wifiRoamCheck(t, rssi);
                 rssiChecked = t;
             }
 
-            // Report online status every 10 minutes
-            if (timedOut(t, onlineReported, (unsigned long)600000)) {
-                onlineReported = t;
-                mqttPublish(TOPIC_Online, (long)1, true);
+            // Report online status every ~10 minutes
+            if (timedOut(t, mqttOnlineReported, mqttHeartbeatDelay)) {
+                mqttOnlineReported = t;
+                mqttHeartbeatDelay = commsHeartbeatDelay();
+                mqttPublish(TOPIC_Online, (char*)"1", true);
+                mqttPublishStats();
             }
 
 
@@ -610,108 +1907,17 @@ void commsLoop() {
             if (wasConnected) {
                 aePrintln(F("MQTT: Connection lost"));
                 wasConnected = false;
+                // Whole fleet loses connection at once when broker restarts: spread first attempts
+                if (wifiRoamStarted == 0) commsPause(t, commsRandom() % COMMS_BackoffMin, true);
             }
+            // Connection lost after CONNACK: start over
+            if (mqttStep > mqttStepConnAck) mqttStep = mqttStepResolve;
             if (commsPaused == 0) {
-                bool tryConnect = true;
-                char willTopic[MQTT_MAX_TOPIC_LEN];
-#ifdef MQTT_MDNS
-                if (mqttMdnsCnt <= 0) {
-                    mqttMdnsIndex = 0;
-                    memset(mqttMdns, 0, sizeof(mqttMdns));
-
-                    aePrintln(F("MQTT: Querying MDNS for broker"));
-                    WiFi.setSleepMode(WIFI_NONE_SLEEP);
-                    int n = MDNS.queryService("mqtt", "tcp", 3000U);
-                    WiFi.setSleepMode(wifiTimeCritical ? WIFI_NONE_SLEEP : WIFI_LIGHT_SLEEP);
-
-                    aePrintf("MQTT: %d brokers advertised:\n", n);
-                    mqttMdnsCnt = 0;
-                    for (int i = 0; i < n; ++i) {
-                        IPAddress ip = MDNS.IP(i);
-                        char address[16];
-                        sprintf(address, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
-                        bool valid = (ip[0] || ip[1] || ip[2] || ip[3]);
-                        if (valid && (mqttMdnsCnt < mqttMdnsSize)) {
-                            strcpy(mqttMdns[mqttMdnsCnt].address, address);
-                            mqttMdns[mqttMdnsCnt].port = MDNS.port(i);
-                            aePrintf("MQTT: + %s:%d\n", mqttMdns[mqttMdnsCnt].address, mqttMdns[mqttMdnsCnt].port);
-                            mqttMdnsCnt++;
-                        } else {
-                            aePrintf("MQTT: - %s:%d ignored\n", address, MDNS.port(i));
-                        }
-                    }
-                }
-
-                if (mqttMdnsCnt > 0) {
-                    mqttTopic(willTopic, "*");
-                    aePrintf("MQTT: Connecting broker #%d %s:%d as %s\r\n", mqttMdnsIndex, mqttMdns[mqttMdnsIndex].address, mqttMdns[mqttMdnsIndex].port, willTopic);
-                    mqttClient.setServer(mqttMdns[mqttMdnsIndex].address, mqttMdns[mqttMdnsIndex].port);
-                    strcpy(mqttServerAddress, mqttMdns[mqttMdnsIndex].address);
-                    mqttMdnsIndex++;
-                    if (mqttMdnsIndex >= mqttMdnsCnt) {
-                        mqttMdnsCnt = 0;
-                        mqttMdnsIndex = 0;
-                    }
-                } else {
-                    tryConnect = false;
-                }
-#else
-                mqttTopic(willTopic, "*");
-                aePrintf("MQTT: Connecting broker %s:%d as %s\r\n", MQTT_Address, MQTT_Port, willTopic);
-                mqttClient.setServer(MQTT_Address, MQTT_Port);
-                strcpy(mqttServerAddress, MQTT_Address);
-#endif
-
-                mqttClient.setCallback(mqttCallbackProxy);
-
-                mqttTopic(willTopic, TOPIC_Online);
-                if (tryConnect && mqttClient.connect(commsConfig.hostName, willTopic, 0, true, "0")) {
-                    commsConnectAttempt = 0;
-                    aePrintln(F("MQTT: Connected"));
-#ifdef MQTT_MAX_PACKET_SIZE
-                    mqttClient.setBufferSize(MQTT_MAX_PACKET_SIZE);
-#endif
-
-#ifdef TIMEZONE
-                    // adjust time zone
-                    configTime(TIMEZONE, mqttServerAddress, NTP_SERVER1, NTP_SERVER2);
-                    tzset();
-#endif  
-
-                    // Subscribe
-                    mqttSubscribeTopic(TOPIC_Reset);
-                    mqttSubscribeTopic(TOPIC_FactoryReset);
-                    mqttSubscribeTopic(TOPIC_EnableOTA);
-                    mqttSubscribeTopicRaw(TOPIC_HA_Status);
-
-#ifndef WIFI_HostName
-                    mqttSubscribeTopic(TOPIC_SetName);
-#endif  
-
-#ifndef MQTT_Root
-                    mqttSubscribeTopic(TOPIC_SetRoot);
-#endif  
-                    mqttPublish(TOPIC_Online, (long)1, true);
-                    onlineReported = t;
-                    mqttPublishDeviceInfo();
-
-                    for (int i = 0; i < mqttCbsCount; i++) {
-                        if (mqttCbs[i].connect != NULL) mqttCbs[i].connect();
-                    }
-
+                mqttConnectStep(t);
+            } else if (timedOut(t, commsPaused, commsPauseDelay)) {
+                if (commsPauseResume) {
                     commsPaused = 0;
-                    wasConnected = true;
                 } else {
-                    aePrint(F("MQTT: Connection error #")); aePrintln(mqttClient.state());
-                    commsPaused = t;
-                }
-                return; // Split activity to not overload loop
-            } else {
-#ifdef MQTT_MDNS 
-                if (timedOut(t, commsPaused, ((mqttMdnsCnt > 0) ? COMMS_ConnectNextTimeout : COMMS_ConnectTimeout))) {
-#else
-                if (timedOut(t, commsPaused, COMMS_ConnectTimeout)) {
-#endif
                     commsReconnect();
                 }
             }
@@ -719,9 +1925,36 @@ void commsLoop() {
 
     } else {
         commsHAConnected = false;
-        if (timedOut(t, commsConnecting, COMMS_ConnectTimeout)) {
+        if ((wifiRoamStarted != 0) && (commsConnecting > 0) && timedOut(t, commsConnecting, WIFI_FastConnectTimeout)) {
+            aePrintln(F("WIFI: Roaming failed"));
+            wifiRoamStarted = 0;
+            WiFi.disconnect();
+            wifiBegin();
+            commsConnecting = t;
+            return;
+        }
+#if WIFI_FastConnect
+        if (wifiFastConnecting && timedOut(t, commsConnecting, WIFI_FastConnectTimeout)) {
+            aePrintln(F("WIFI: Fast connect failed, scanning"));
+            wifiFastFailed = true;
+            WiFi.disconnect();
+            wifiBegin();
+            commsConnecting = t;
+            return;
+        }
+#endif
+        // Failed association waits like broker connection does: devices restarted by the same power cut
+        // or AP reboot don't retry in sync. Lost connection is retried after a short random delay
+        if (commsPaused != 0) {
+            if (timedOut(t, commsPaused, commsPauseDelay)) commsReconnect();
+        } else if (commsConnecting == 0) {
+            aePrintln(F("WIFI: Connection lost"));
+            WiFi.disconnect();
+            commsPause(t, commsRandom() % COMMS_BackoffMin, false);
+        } else if (timedOut(t, commsConnecting, COMMS_ConnectTimeout)) {
             aePrint(F("WIFI: Connection error #")); aePrintln(WiFi.status());
-            commsReconnect();
+            WiFi.disconnect();
+            commsPause(t, commsBackoff(commsConnectAttempt), false);
         }
     }
 }
@@ -760,7 +1993,8 @@ bool commsTimeIsValid() {
 void commsRestart() {
     storageSave();
     aePrintln(F("Restarting device..."));
-    mqttPublish(TOPIC_Online, (long)0, true);
+    mqttPublish(TOPIC_Online, (char*)"0", true);
+    mqttQueueFlush(mqttQueueCount());
     delay(1000);;
     ESP.restart();
 }
@@ -784,6 +2018,32 @@ void commsInit(bool isTimeCritical) {
     mqttActivity = 0;
     wifiTimeCritical = isTimeCritical;
     storageRegisterBlock(COMMS_StorageId, &commsConfig, sizeof(commsConfig));
+#ifdef MQTT_PersistentSession
+    mqttClient.setCleanSession(false);
+#endif
+#if defined(MQTT_TLS) && defined(ESP8266)
+    mqttTlsSessionLoad();
+#endif
+#if WIFI_FastConnect
+    wifiRoamLoad();
+#endif
+#ifdef MQTT_PayloadFormat
+    commsConfig.payloadFormat = MQTT_PayloadFormat;
+#else
+    if (commsConfig.payloadFormat != MQTT_PayloadCbor) commsConfig.payloadFormat = MQTT_PayloadText;
+#endif
+#ifdef MQTT_MDNS
+    // Storage written by older firmware may contain garbage here
+    IPAddress brokerIP;
+    commsConfig.brokerAddress[sizeof(commsConfig.brokerAddress) - 1] = 0;
+    if ((commsConfig.brokerPort == 0) || !brokerIP.fromString(commsConfig.brokerAddress)) {
+        memset(commsConfig.brokerAddress, 0, sizeof(commsConfig.brokerAddress));
+        commsConfig.brokerPort = 0;
+    }
+#endif
+    if ((commsConfig.wifiChannel < 1) || (commsConfig.wifiChannel > 14) || (commsConfig.wifiIP == 0) || (commsConfig.wifiNetwork >= WIFI_Networks)) {
+        commsConfig.wifiChannel = 0;
+    }
 #ifdef WIFI_HostName
     uint8_t macAddr[6];
     char macS[16];
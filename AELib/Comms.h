@@ -2,6 +2,8 @@
 #define comms_h
 
 #include <time.h>
+#include "JsonWriter.h"
+#include "Cbor.h"
 
 #define COMMS_StorageId 'C'
 
@@ -9,6 +11,21 @@
 #define MQTT_CONNECT std::function<void()> connect
 #define MQTT_MAX_TOPIC_LEN 128
 
+// Module state publishing format (MQTT_StateFormat bit mask, see Config.h):
+// one retained topic per value and/or one aggregated document per module in "State/<Module>" topic
+#define MQTT_StateTopics 0x01
+#define MQTT_StateJson 0x02
+#ifndef MQTT_StateFormat
+#define MQTT_StateFormat MQTT_StateTopics
+#endif
+// Maximum size of aggregated state document
+#define MQTT_StateSize 256
+
+// Numeric and state payloads encoding (MQTT_PayloadFormat, see Config.h).
+// Text topics (strings, DeviceInfo, Online, Activity, Stats) are never CBOR encoded
+#define MQTT_PayloadText 0
+#define MQTT_PayloadCbor 1
+
 // Exported functions:
 // WiFi
 char* wifiHostName();
@@ -46,13 +63,41 @@ bool mqttPublish(char* TOPIC_Name, char* topicVar, long value, bool retained);
 bool mqttPublish(char* TOPIC_Name, char* topicVar1, char* topicVar2, long value, bool retained);
 
 bool mqttPublish(char* TOPIC_Name, char* value, bool retained);
+// Floating point value rounded to "decimals" digits after the point
+bool mqttPublish(char* TOPIC_Name, float value, int decimals, bool retained);
 bool mqttPublish(char* TOPIC_Name, char* topicVar, char* value, bool retained);
 bool mqttPublish(char* TOPIC_Name, char* topicVar1, char* topicVar2, char* value, bool retained);
+// QoS (0 or 1) of events published to topics conforming TOPIC_Name template, "%s" matches any text within
+// a topic level (e.g. "Btn%s" for all button events). Overrides MQTT_EventQos, retained messages are sent with QoS 0
+void mqttTopicQos(char* TOPIC_Name, byte qos);
 
 // RAW topic names (no templating)
 void mqttSubscribeTopicRaw(char* topic);
 bool mqttPublishRaw(char* topic, long value, bool retained);
 bool mqttPublishRaw(char* topic, char* value, bool retained);
+bool mqttPublishRaw(char* topic, float value, int decimals, bool retained);
+bool mqttPublishRaw(char* topic, const uint8_t* payload, unsigned int length, bool retained);
+// True if numeric and state payloads are CBOR encoded
+bool mqttPayloadCbor();
+
+// Aggregated module state document
+struct MqttState {
+    bool cbor;
+    JsonWriter json;
+    CborWriter cborWriter;
+    char buffer[MQTT_StateSize];
+};
+void mqttStateBegin(MqttState* state);
+void mqttStateAdd(MqttState* state, char* key, long value);
+void mqttStateAdd(MqttState* state, char* key, char* value);
+void mqttStateAdd(MqttState* state, char* key, float value, int decimals);
+/// <summary>Complete state document and publish it</summary>
+/// <returns>False if document does not fit MQTT_StateSize or can't be published</returns>
+bool mqttPublishState(char* TOPIC_Name, MqttState* state, bool retained);
+
+// Number of PUBLISH packets and bytes (MQTT level) sent to broker since boot
+unsigned long mqttTxMessages();
+unsigned long mqttTxBytes();
 
 // Parsers
 /// <summary>Check if string is "boolean": 
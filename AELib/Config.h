@@ -18,16 +18,58 @@
 // #define WIFI_SSID "SSID"
 // #define WIFI_Password  "WiFi password"
 
+/// Additional networks: device connects to the strongest AP of known networks
+// #define WIFI_SSID2 "SSID2"
+// #define WIFI_Password2 "WiFi password 2"
+// #define WIFI_SSID3 "SSID3"
+// #define WIFI_Password3 "WiFi password 3"
+
+/// Roaming: if RSSI stays below WIFI_RoamThreshold (dBm) for 30 seconds, device scans for known APs
+/// in background (not more often than once per WIFI_ScanInterval ms) and moves to AP which is
+/// at least WIFI_RoamHysteresis dB stronger. Set threshold to -127 to disable roaming
+// #define WIFI_RoamThreshold -75
+// #define WIFI_RoamHysteresis 8
+// #define WIFI_ScanInterval 300000
+
 /// Device host name and MQTT ClientId, default is "ESP_%s"
 /// "%s" will be replaced with device' MAC address
 /// "SetName" MQTT command will not be available if hostname defined
 // #define WIFI_HostName "NightLight"
 
+/// AP (BSSID, channel) and DHCP lease of last successful connection are saved in EEPROM and
+/// used to reconnect without scan and DHCP; full scan is used if fast connect fails.
+/// Set to 0 to always use DHCP:
+// #define WIFI_FastConnect 0
+
+/// Reconnect policy: delay between connection attempts doubles from COMMS_BackoffMin up to
+/// COMMS_BackoffMax (ms) and is randomized by COMMS_BackoffJitter percent (seeded from MAC),
+/// so devices don't reconnect to restarted broker all at once
+// #define COMMS_BackoffMin 3000
+// #define COMMS_BackoffMax 60000
+// #define COMMS_BackoffJitter 50
+
 /// MQTT Broker configuration.
-/// Device will search Broker via mDNS service if not defined:
+/// Device will search Broker via mDNS service if not defined
+/// (last connected broker is saved in EEPROM and tried first):
 // #define MQTT_Address "MQTT Broker address"
 // #define MQTT_Port 1883
 
+/// MQTT over TLS (use broker TLS port, e.g. 8883; mDNS discovery looks for "_secure-mqtt._tcp").
+/// Broker certificate is checked by SHA1 fingerprint or CA certificate (PEM), not checked if neither is defined.
+/// TLS session is resumed on reconnect (kept in RAM and RTC memory), so full handshake is done only once.
+/// Receive buffer smaller than 16384 bytes is used if broker supports Maximum Fragment Length extension:
+// #define MQTT_TLS
+// #define MQTT_TlsFingerprint "AA:BB:CC:DD:EE:FF:00:11:22:33:44:55:66:77:88:99:AA:BB:CC:DD"
+// #define MQTT_TlsCA "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n"
+// #define MQTT_TlsRxBuffer 1024
+// #define MQTT_TlsTxBuffer 512
+
+/// Local UDP control: commands (same topics as MQTT commands, relative to device root, e.g. "Relay1/SetState")
+/// are accepted on this UDP port directly from LAN, authenticated by HMAC-SHA256 with COMMS_UdpKey.
+/// Works while broker is unavailable; resulting state is still published to MQTT. See tools/udp_control.py
+// #define COMMS_UdpPort 4210
+// #define COMMS_UdpKey "UDP control secret"
+
 /// Log on anonymously if not defined
 // #define MQTT_User "MQTTUserName"
 // #define MQTT_Password "12345"
@@ -41,9 +83,51 @@
 /// * "%s"
 // #define MQTT_Root "test/%s/"
 
-/// Re-define PubSubClient maximum data packet size if required:
+/// Re-define MqttClient maximum data packet size if required:
 // #define MQTT_MAX_PACKET_SIZE 1024
 
+/// MQTT protocol version of built-in MqttClient: 4 (MQTT 3.1.1, default) or 5.
+/// MQTT 5 client replaces frequently published topic names with topic aliases (if broker allows them)
+/// and sets message expiry interval (seconds) for not retained messages (events)
+// #define MQTT_Version 5
+// #define MQTT5_TopicAliases 16
+// #define MQTT_EventExpiry 60
+
+/// MQTT keep alive interval, seconds. PINGREQ is sent only if nothing else was sent within this interval
+// #define MQTT_KeepAlive 30
+
+/// Persistent MQTT session (clean session = 0, client id is device host name): broker keeps device
+/// subscriptions (QoS 1) and queues commands sent while device is offline. Session expiry (MQTT 5), s:
+// #define MQTT_PersistentSession
+// #define MQTT_SessionExpiry 3600
+
+/// QoS of not retained messages (events, e.g. button clicks), 0 (default) or 1.
+/// Up to MQTT_InFlight QoS 1 messages wait for PUBACK and are retransmitted if not acknowledged.
+/// mqttTopicQos() sets QoS of selected topics, up to MQTT_QosTopicsSize templates
+// #define MQTT_EventQos 1
+// #define MQTT_InFlight 4
+// #define MQTT_QosTopicsSize 8
+
+/// Outbound message queue. Messages published while broker is not available are kept in RAM
+/// and sent in paced bursts after reconnect. Only latest value is kept for retained topics,
+/// not retained messages (events) are kept in FIFO order. Defaults are in MqttQueue.cpp / Comms.cpp
+// #define MQTT_QueueSize 2048
+// #define MQTT_QueueMaxEvents 32
+// #define MQTT_QueueBurst 8
+
+/// Retained (state) messages are sent once per window (ms): if topic is updated several times
+/// within the window only the last value is sent. 0 means "once per aeLoop() pass".
+/// Staged states are sent right away before an event is published
+// #define MQTT_CoalesceWindow 200
+
+/// Module state publishing format: one retained topic per value (MQTT_StateTopics, default),
+/// one JSON document per module in "State/<Module>" topic (MQTT_StateJson) or both
+// #define MQTT_StateFormat (MQTT_StateTopics | MQTT_StateJson)
+
+/// Numeric values and State/<Module> documents encoding: MQTT_PayloadText (default) or MQTT_PayloadCbor.
+/// If not defined, format can be changed per device using SetPayloadFormat MQTT command
+// #define MQTT_PayloadFormat MQTT_PayloadCbor
+
 
 /// Synchronize device time to TIMEZONE is set and NTP server is available.
 /// Check "tz.h" for timezone constants
@@ -78,6 +162,88 @@
 /// * btnLongPressed() will trigger BEFORE button release
 // #define BUTTONS_EASY_MODE
 
+/// Maximum number of buttons, up to 32 (default 16)
+// #define ButtonsSize 16
+/// Button state must be stable this long to be accepted (contact bounce filter), ms
+// #define ClashTimeout ((unsigned long)25)
+/// Hold-to-repeat defaults for btnRepeat(pin): first tick after delay, then every interval, ms
+// #define BUTTONS_RepeatDelay ((unsigned long)400)
+// #define BUTTONS_RepeatInterval ((unsigned long)100)
+/// Publish every repeat tick (Btn#HoldTick), not only Btn#Hold / Btn#HoldEnd
+// #define BUTTONS_PublishHoldTicks
+/// Measure latency from button edge to MQTT publish and report histograms to "Buttons/Latency"
+/// every BUTTONS_LatencyReport ms (default 10 minutes)
+// #define BUTTONS_Latency
+// #define BUTTONS_LatencyReport ((unsigned long)600000)
+/// Publish button events as {"Count":n,"Edge":<unix time of the edge>} instead of plain count
+// #define BUTTONS_PublishEdgeTime
+
+/////////////////////////////////////////////////////////////////////
+///                 Ladder.h module configuration
+/////////////////////////////////////////////////////////////////////
+
+/// ADC input of the resistor ladder
+// #define LADDER_Pin A0
+/// ADC sampling interval, us. ESP8266 WiFi drops connection if ADC is read more often than every ~5 ms
+// #define LADDER_Interval ((unsigned long)10000)
+/// Reading must fall into the same band this many samples in a row to be accepted
+// #define LADDER_Samples 2
+/// Reading leaves current key band only if it is closer to another key value by this margin
+// #define LADDER_Hysteresis 16
+
+/////////////////////////////////////////////////////////////////////
+///                 Bindings.h module configuration
+/////////////////////////////////////////////////////////////////////
+
+/// Number of local button bindings stored in EEPROM (12 bytes each)
+// #define BINDINGS_Max 16
+
+/////////////////////////////////////////////////////////////////////
+///                 Relays.h module configuration
+/////////////////////////////////////////////////////////////////////
+
+/// Inrush current budget: relays switched on within their settle time hold their weight,
+/// pending relay is switched on only if its weight fits (relay heavier than budget is switched alone)
+// #define RELAYS_InrushBudget 4
+/// Weight and settle time (ms) of relays without relayInrush(pin, weight, settle) call
+// #define RELAYS_InrushWeight 1
+// #define RELAYS_SettleTime ((unsigned long)75)
+
+/////////////////////////////////////////////////////////////////////
+///                 Expander.h module configuration
+/////////////////////////////////////////////////////////////////////
+
+/// Expander inputs without INT line are polled this often, ms
+// #define EXPANDER_PollInterval ((unsigned long)20)
+/// I2C bus clock set by expInit() (I2C_SDA / I2C_SCL below are used if defined)
+// #define EXPANDER_I2CClock 400000
+/// Maximum number of relays / binary sensors (default 16 each)
+// #define RelaysSize 16
+// #define BNS_MAX_SENSORS 16
+
+/////////////////////////////////////////////////////////////////////
+///                 Encoder.h module configuration
+/////////////////////////////////////////////////////////////////////
+
+/// Encoder turns are collected and reported this often, ms
+// #define ENCODER_Interval ((unsigned long)50)
+/// Detents closer than AccelTime ms are accelerated up to AccelMax detents per click
+// #define ENCODER_AccelTime ((unsigned long)40)
+// #define ENCODER_AccelMax 5
+/// Quadrature steps per detent for encRegister() without stepsPerDetent
+// #define ENCODER_StepsPerDetent 4
+
+/////////////////////////////////////////////////////////////////////
+///                 Peers.h module configuration
+/////////////////////////////////////////////////////////////////////
+
+/// ESP-NOW encryption key shared by paired devices, exactly 16 characters. Not encrypted if not defined
+// #define PEERS_Key "0123456789ABCDEF"
+/// Maximum number of paired devices (ESP8266 supports up to 6 encrypted peers)
+// #define PEERS_Max 6
+/// Pairing mode duration, ms
+// #define PEERS_PairTimeout ((unsigned long)(30 * 1000))
+
 /////////////////////////////////////////////////////////////////////
 ///                 Dimmer.h module configuration
 /////////////////////////////////////////////////////////////////////
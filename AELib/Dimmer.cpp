@@ -68,6 +68,8 @@ static char* TOPIC_SetMiredsRange PROGMEM = "Dimmer/SetMiredsRange";
 static char* TOPIC_Mireds PROGMEM = "Dimmer/Mireds";
 static char* TOPIC_SetMireds PROGMEM = "Dimmer/SetMireds";
 
+static char* TOPIC_DimmerState PROGMEM = "State/Dimmer";
+
 
 struct DimmerConfig {
     byte mode;
@@ -194,38 +196,83 @@ void transitionLoop() {
 #pragma endregion 
 
 #pragma region mqttPublish
+// Publish value to its own retained topic if per-value topics are enabled
+void dimmerPublishValue(char* topic, long value) {
+#if (MQTT_StateFormat & MQTT_StateTopics)
+    mqttPublish(topic, value, true);
+#endif
+}
+void dimmerPublishValue(char* topic, char* value) {
+#if (MQTT_StateFormat & MQTT_StateTopics)
+    mqttPublish(topic, value, true);
+#endif
+}
+
+#if (MQTT_StateFormat & MQTT_StateJson)
+void dimmerPublishState() {
+    MqttState state;
+    char s[16];
+    mqttStateBegin(&state);
+    mqttStateAdd(&state, "Mode", (long)dimmerConfig.mode);
+    mqttStateAdd(&state, "State", (long)(dimmerState ? 1 : 0));
+    mqttStateAdd(&state, "Brightness", (long)dimmerBrightness);
+    if (dimmerConfig.mode == 1) {
+        mqttStateAdd(&state, "State2", (long)(dimmerState2 ? 1 : 0));
+        mqttStateAdd(&state, "Brightness2", (long)dimmerBrightness2);
+    }
+    if (dimmerConfig.mode == 2) {
+        mqttStateAdd(&state, "Temperature", (long)dimmerTemperature);
+        mqttStateAdd(&state, "Mireds", (long)dimmerMireds);
+        sprintf(s, "%d,%d", dimmerConfig.rangeMin, dimmerConfig.rangeMax);
+        mqttStateAdd(&state, "WorkRange", s);
+        sprintf(s, "%d,%d", dimmerConfig.miredsMin, dimmerConfig.miredsMax);
+        mqttStateAdd(&state, "MiredsRange", s);
+    }
+    mqttStateAdd(&state, "Transition", (long)dimmerTransition);
+    mqttPublishState(TOPIC_DimmerState, &state, true);
+}
+#endif
+
 void dimmerMqttPublish() {
     if (!mqttConnected()) return;
-    unsigned long t = millis();
+    bool changed = false;
 
     static int _state = -1;
-    if ((_state != dimmerState) && mqttPublish(TOPIC_State, dimmerState ? 1 : 0, true)) {
+    if (_state != dimmerState) {
         _state = dimmerState;
+        dimmerPublishValue(TOPIC_State, dimmerState ? 1 : 0);
+        changed = true;
     }
 
     static int _brightness = -1;
-    if ((_brightness != dimmerBrightness) && mqttPublish(TOPIC_Brightness, dimmerBrightness, true)) {
+    if (_brightness != dimmerBrightness) {
         _brightness = dimmerBrightness;
+        dimmerPublishValue(TOPIC_Brightness, dimmerBrightness);
+        changed = true;
     }
 
     if (dimmerConfig.mode == 1) {
         static int _state2 = -1;
-        if ((_state2 != dimmerState2) && mqttPublish(TOPIC_State2, dimmerState2 ? 1 : 0, true)) {
+        if (_state2 != dimmerState2) {
             _state2 = dimmerState2;
+            dimmerPublishValue(TOPIC_State2, dimmerState2 ? 1 : 0);
+            changed = true;
         }
 
         static int _brightness2 = -1;
-        if ((_brightness2 != dimmerBrightness2) && mqttPublish(TOPIC_Brightness2, dimmerBrightness2, true)) {
+        if (_brightness2 != dimmerBrightness2) {
             _brightness2 = dimmerBrightness2;
+            dimmerPublishValue(TOPIC_Brightness2, dimmerBrightness2);
+            changed = true;
         }
     }
     if (dimmerConfig.mode == 2) {
         static int _temperature = -1;
-        if ((_temperature != dimmerTemperature) &&
-            mqttPublish(TOPIC_Temperature, dimmerTemperature, true) &&
-            mqttPublish(TOPIC_Mireds, dimmerMireds, true)
-            ) {
+        if (_temperature != dimmerTemperature) {
             _temperature = dimmerTemperature;
+            dimmerPublishValue(TOPIC_Temperature, dimmerTemperature);
+            dimmerPublishValue(TOPIC_Mireds, dimmerMireds);
+            changed = true;
         }
 
         static int _rangeMin = -1;
@@ -233,10 +280,10 @@ void dimmerMqttPublish() {
         if ((_rangeMin != dimmerConfig.rangeMin) || (_rangeMax != dimmerConfig.rangeMax)) {
             char s[16];
             sprintf(s, "%d,%d", dimmerConfig.rangeMin, dimmerConfig.rangeMax);
-            if (mqttPublish(TOPIC_Range, s, true)) {
-                _rangeMin = dimmerConfig.rangeMin;
-                _rangeMax = dimmerConfig.rangeMax;
-            }
+            _rangeMin = dimmerConfig.rangeMin;
+            _rangeMax = dimmerConfig.rangeMax;
+            dimmerPublishValue(TOPIC_Range, s);
+            changed = true;
         }
 
         static int _miredsMin = -1;
@@ -244,18 +291,23 @@ void dimmerMqttPublish() {
         if ((_miredsMin != dimmerConfig.miredsMin) || (_miredsMax != dimmerConfig.miredsMax)) {
             char s[16];
             sprintf(s, "%d,%d", dimmerConfig.miredsMin, dimmerConfig.miredsMax);
-            if (mqttPublish(TOPIC_MiredsRange, s, true)) {
-                _miredsMin = dimmerConfig.miredsMin;
-                _miredsMax = dimmerConfig.miredsMax;
-            }
+            _miredsMin = dimmerConfig.miredsMin;
+            _miredsMax = dimmerConfig.miredsMax;
+            dimmerPublishValue(TOPIC_MiredsRange, s);
+            changed = true;
         }
     }
 
-
     static long _transition = -1;
-    if ((_transition != dimmerTransition) && mqttPublish(TOPIC_Transition, dimmerTransition, true)) {
+    if (_transition != dimmerTransition) {
         _transition = dimmerTransition;
+        dimmerPublishValue(TOPIC_Transition, dimmerTransition);
+        changed = true;
     }
+
+#if (MQTT_StateFormat & MQTT_StateJson)
+    if (changed) dimmerPublishState();
+#endif
 }
 
 #pragma endregion 
@@ -492,6 +544,27 @@ void dimmerSwitch() {
     }
     transitionStart();
 }
+void dimmerAdjust(int delta) {
+    if (delta == 0) return;
+    if (delta > 0) {
+        dimmerState = true;
+        if (dimmerConfig.mode == 1) dimmerState2 = true;
+    }
+    dimmerBrightness = constrain(dimmerBrightness + delta, 1, 255);
+    if (dimmerConfig.mode == 1) {
+        dimmerBrightness2 = constrain(dimmerBrightness2 + delta, 1, 255);
+    }
+    transitionStart();
+}
+void dimmerSetLevel(int brightness) {
+    dimmerState = (brightness > 0);
+    if (dimmerConfig.mode == 1) dimmerState2 = dimmerState;
+    if (brightness > 0) {
+        dimmerBrightness = constrain(brightness, 1, 255);
+        if (dimmerConfig.mode == 1) dimmerBrightness2 = dimmerBrightness;
+    }
+    transitionStart();
+}
 void dimmerStartGlowing() {
     dimmerState = true;
     dimmerGlowUp = true;
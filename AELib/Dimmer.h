@@ -4,6 +4,10 @@
 #define DIMMER_StorageId 'D'
 
 void dimmerSwitch();
+// Change brightness by delta (1..255), switching dimmer on if delta is positive
+void dimmerAdjust(int delta);
+// Switch on with brightness (1..255) or off if brightness is 0
+void dimmerSetLevel(int brightness);
 void dimmerStartGlowing();
 void dimmerStopGlowing();
 
@@ -0,0 +1,214 @@
+#include <Arduino.h>
+#ifdef ESP32
+#include <soc/gpio_reg.h>
+#endif
+
+#include "AELib.h"
+#include "Comms.h"
+#include "Encoder.h"
+#include "Buttons.h"
+#include "Dimmer.h"
+
+// Turn on debug output
+//#define Debug
+
+// Turns are collected and reported this often, ms
+#ifndef ENCODER_Interval
+#define ENCODER_Interval ((unsigned long)50)
+#endif
+// Detents closer than this are accelerated, up to ENCODER_AccelMax detents per click, ms
+#ifndef ENCODER_AccelTime
+#define ENCODER_AccelTime ((unsigned long)40)
+#endif
+#ifndef ENCODER_AccelMax
+#define ENCODER_AccelMax 5
+#endif
+#ifndef ENCODER_StepsPerDetent
+#define ENCODER_StepsPerDetent 4
+#endif
+#define ENCODER_HandlersSize 4
+
+// first %s is encoder number
+#define TOPIC_Delta "Encoder%s/Delta"
+
+// GPIO input register(s) read at once by interrupt: both channels are sampled together
+#ifdef ESP32
+typedef uint64_t EncInputs;
+#define encReadInputs() (((EncInputs)REG_READ(GPIO_IN1_REG) << 32) | REG_READ(GPIO_IN_REG))
+#elif defined(ESP8266)
+typedef uint32_t EncInputs;
+#define encReadInputs() (GPI)
+#endif
+
+struct Encoder {
+    byte pinA;
+    byte pinB;
+    byte stepsPerDetent;
+#ifdef encReadInputs
+    EncInputs bitA;
+    EncInputs bitB;
+#endif
+    // Interrupt state
+    byte state;             // A << 1 | B
+    int8_t steps;           // Quadrature steps towards the next detent
+    int8_t direction;       // Of the last detent, acceleration restarts on reverse
+    unsigned long detentOn; // micros
+    volatile long count;    // Accelerated detents not taken by encLoop yet
+    // Loop state
+    long position;
+    int dimmerStep;         // 0: not attached to dimmer
+};
+
+struct EncHandlers {
+    ENC_HANDLER;
+};
+
+byte encCount = 0;
+Encoder encoders[ENCODER_Max];
+
+unsigned int encHandlersCount = 0;
+EncHandlers encHandlers[ENCODER_HandlersSize];
+
+bool encEnableMQTT = false;
+
+#pragma region Interrupt
+// Step for transition from previous (high bits) to current state (low bits). Both channels changed
+// at once (missed state) count as no step; contact bounce produces steps back and forth
+static const int8_t encTransitions[16] = {
+     0, -1,  1,  0,
+     1,  0,  0, -1,
+    -1,  0,  0,  1,
+     0,  1, -1,  0
+};
+
+byte IRAM_ATTR encReadState(Encoder* e) {
+#ifdef encReadInputs
+    EncInputs inputs = encReadInputs();
+    return (((inputs & e->bitA) != 0) ? 2 : 0) | (((inputs & e->bitB) != 0) ? 1 : 0);
+#else
+    return ((digitalRead(e->pinA) == HIGH) ? 2 : 0) | ((digitalRead(e->pinB) == HIGH) ? 1 : 0);
+#endif
+}
+
+// Shared by both channels of all encoders
+void IRAM_ATTR encInterrupt() {
+    unsigned long us = micros();
+    for (byte i = 0; i < encCount; i++) {
+        Encoder* e = &encoders[i];
+        byte state = encReadState(e);
+        if (state == e->state) continue;
+        e->steps += encTransitions[(e->state << 2) | state];
+        e->state = state;
+        if ((e->steps < e->stepsPerDetent) && (e->steps > -e->stepsPerDetent)) continue;
+
+        int8_t direction = (e->steps > 0) ? 1 : -1;
+        e->steps = 0;
+        long delta = 1;
+        unsigned long dt = us - e->detentOn;
+        if ((direction == e->direction) && (dt < ENCODER_AccelTime * 1000)) {
+            delta += (ENCODER_AccelMax - 1) * (ENCODER_AccelTime * 1000 - dt) / (ENCODER_AccelTime * 1000);
+        }
+        e->direction = direction;
+        e->detentOn = us;
+        e->count += direction * delta;
+    }
+}
+#pragma endregion
+
+#pragma region Encoders API
+int encRegister(byte pinA, byte pinB, int btnPin, byte stepsPerDetent) {
+    if ((encCount >= ENCODER_Max) || (pinA == 16) || (pinB == 16) || (stepsPerDetent == 0)) return -1;
+    Encoder* e = &encoders[encCount];
+    e->pinA = pinA;
+    e->pinB = pinB;
+    e->stepsPerDetent = stepsPerDetent;
+#ifdef encReadInputs
+    e->bitA = (EncInputs)1 << pinA;
+    e->bitB = (EncInputs)1 << pinB;
+#endif
+    e->steps = 0;
+    e->direction = 0;
+    e->detentOn = 0;
+    e->count = 0;
+    e->position = 0;
+    e->dimmerStep = 0;
+
+    pinMode(pinA, INPUT_PULLUP);
+    pinMode(pinB, INPUT_PULLUP);
+    e->state = encReadState(e);
+    if (btnPin >= 0) btnRegister(btnPin, false, true);
+
+    // Interrupt may come as soon as it is attached
+    encCount++;
+    attachInterrupt(pinA, encInterrupt, CHANGE);
+    attachInterrupt(pinB, encInterrupt, CHANGE);
+    return encCount;
+}
+
+int encRegister(byte pinA, byte pinB, int btnPin) {
+    return encRegister(pinA, pinB, btnPin, ENCODER_StepsPerDetent);
+}
+
+int encRegister(byte pinA, byte pinB) {
+    return encRegister(pinA, pinB, -1);
+}
+
+void encAttachDimmer(byte encoder, int step) {
+    if ((encoder < 1) || (encoder > encCount)) return;
+    encoders[encoder - 1].dimmerStep = step;
+}
+
+long encPosition(byte encoder) {
+    if ((encoder < 1) || (encoder > encCount)) return 0;
+    return encoders[encoder - 1].position;
+}
+
+void encRegisterHandler(ENC_HANDLER) {
+    if (encHandlersCount >= ENCODER_HandlersSize) return;
+    encHandlers[encHandlersCount++].handler = handler;
+}
+#pragma endregion
+
+#pragma region Loop, Init
+void encLoop() {
+    static unsigned long _tmBatched = 0;
+    unsigned long t = millis();
+    if (!timedOut(t, _tmBatched, ENCODER_Interval - 1)) return;
+    _tmBatched = t;
+
+    for (int i = 0; i < encCount; i++) {
+        Encoder* e = &encoders[i];
+        noInterrupts();
+        long delta = e->count;
+        e->count = 0;
+        interrupts();
+        if (delta == 0) continue;
+
+        if (delta > 32767) delta = 32767;
+        if (delta < -32767) delta = -32767;
+        e->position += delta;
+        triggerActivity();
+#ifdef Debug
+        aePrintf("Encoder%d: %ld\r\n", i + 1, delta);
+#endif
+        if (e->dimmerStep != 0) dimmerAdjust((int)delta * e->dimmerStep);
+        for (int h = 0; h < encHandlersCount; h++) {
+            encHandlers[h].handler(i + 1, (int)delta);
+        }
+        if (encEnableMQTT && mqttConnected()) {
+            char ens[4];
+            sprintf(ens, "%d", i + 1);
+            mqttPublish(TOPIC_Delta, ens, delta, false);
+        }
+    }
+}
+
+void encInit(bool mqtt) {
+    encEnableMQTT = mqtt;
+    aeRegisterLoop(encLoop);
+}
+
+void encInit() {
+    encInit(true);
+}
+#pragma endregion
@@ -0,0 +1,30 @@
+#ifndef encoder_h
+#define encoder_h
+
+// Quadrature rotary encoders. Both channels are decoded by interrupt, so steps are not lost at any
+// spin speed; turns are accumulated in detents and reported in batches every ENCODER_Interval
+#define ENCODER_Max 4
+
+// Called with the encoder number (in registration order, from 1) and detents turned since the last
+// batch, accelerated if turned fast. Positive delta is A leading B: swap pins to reverse direction
+#define ENC_HANDLER std::function<void(byte encoder, int delta)> handler
+
+// Register encoder on pins A and B (native GPIOs with interrupts, not 16 or expander pins).
+// Returns encoder number or -1 on error. btnPin: push button of the knob registered with Buttons
+// module (all gestures and btnPublishKeypressEvent work for it as usual), -1 if none.
+// stepsPerDetent: quadrature steps per click, 4 for most knobs, 2 or 1 for half / quarter step ones
+int encRegister(byte pinA, byte pinB, int btnPin, byte stepsPerDetent);
+int encRegister(byte pinA, byte pinB, int btnPin);
+int encRegister(byte pinA, byte pinB);
+
+// Turns of the encoder change dimmer brightness by step per detent, turning up switches dimmer on
+void encAttachDimmer(byte encoder, int step);
+// Detents turned since registration
+long encPosition(byte encoder);
+
+void encRegisterHandler(ENC_HANDLER);
+
+// mqtt: publish batched turns as "Encoder#/Delta" events
+void encInit(bool mqtt);
+void encInit();
+#endif
@@ -0,0 +1,285 @@
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "AELib.h"
+#include "Expander.h"
+
+// Turn on debug output
+//#define Debug
+
+// Inputs of expanders without INT line are read this often; INT line held low is rechecked as well, ms
+#ifndef EXPANDER_PollInterval
+#define EXPANDER_PollInterval ((unsigned long)20)
+#endif
+#ifndef EXPANDER_I2CClock
+#define EXPANDER_I2CClock 400000
+#endif
+// Chip not responding is configured again after
+#define EXPANDER_RetryInterval ((unsigned long)5000)
+#define EXPANDER_HandlersSize 4
+
+// MCP23017 registers, IOCON.BANK = 0: port A and B registers are interleaved and written / read in one transaction
+#define MCP_IODIR 0x00
+#define MCP_GPINTEN 0x04
+#define MCP_IOCON 0x0A
+#define MCP_GPPU 0x0C
+#define MCP_GPIO 0x12
+#define MCP_OLAT 0x14
+// INTA / INTB mirrored, open drain: INT lines of several chips may be wired together
+#define MCP_IOCON_Value 0x4444
+
+struct Expander {
+    byte address;
+    ExpanderType type;
+    int intPin;
+    bool ready; // Configured; false after I2C error
+    bool dirty; // Output latch changed and not written yet
+    uint16_t inputs; // Pin levels from the last read
+    uint16_t outputs; // Output latch
+    uint16_t directions; // 1: input
+    uint16_t pullUps;
+    unsigned long failedOn;
+};
+
+struct ExpHandlers {
+    EXP_HANDLER;
+};
+
+byte expCount = 0;
+Expander expanders[EXPANDER_Max];
+
+unsigned int expHandlersCount = 0;
+ExpHandlers expHandlers[EXPANDER_HandlersSize];
+
+// Set by INT line interrupt: micros of the first edge not served yet
+volatile bool expInterrupted = false;
+volatile unsigned long expInterruptedOn = 0;
+
+void IRAM_ATTR expInterrupt() {
+    if (!expInterrupted) {
+        expInterruptedOn = micros();
+        expInterrupted = true;
+    }
+}
+
+#pragma region I2C
+bool expWritePort(Expander* e, byte reg, uint16_t value) {
+    Wire.beginTransmission(e->address);
+    if (e->type == expMCP23017) {
+        Wire.write(reg);
+        Wire.write((byte)(value & 0xFF));
+        Wire.write((byte)(value >> 8));
+    } else {
+        Wire.write((byte)(value & 0xFF));
+    }
+    return Wire.endTransmission() == 0;
+}
+
+bool expReadPort(Expander* e, uint16_t* value) {
+    byte size = 1;
+    if (e->type == expMCP23017) {
+        Wire.beginTransmission(e->address);
+        Wire.write(MCP_GPIO);
+        if (Wire.endTransmission(false) != 0) return false;
+        size = 2;
+    }
+    if (Wire.requestFrom(e->address, size) != size) return false;
+    *value = Wire.read();
+    if (size == 2) *value |= (uint16_t)Wire.read() << 8;
+    return true;
+}
+
+void expFailed(Expander* e) {
+    if (e->ready) aePrintf("Expander 0x%02X: not responding\r\n", e->address);
+    e->ready = false;
+    e->failedOn = millis();
+}
+
+// PCF8574 has no direction register: inputs are pins latched high (weak pull-up)
+uint16_t expPcfPort(Expander* e) {
+    return e->outputs | e->directions;
+}
+
+void expRead(Expander* e, unsigned long us) {
+    uint16_t value;
+    if (!expReadPort(e, &value)) {
+        expFailed(e);
+        return;
+    }
+    uint16_t changed = (value ^ e->inputs) & e->directions;
+    e->inputs = value;
+    while (changed != 0) {
+        int bit = __builtin_ctz(changed);
+        changed &= changed - 1;
+        byte pin = EXPANDER_PinBase + (e - expanders) * 16 + bit;
+        for (int i = 0; i < expHandlersCount; i++) {
+            expHandlers[i].handler(pin, (value & (1 << bit)) != 0, us);
+        }
+    }
+}
+
+bool expConfigure(Expander* e) {
+    bool ok;
+    if (e->type == expMCP23017) {
+        ok = expWritePort(e, MCP_IOCON, MCP_IOCON_Value)
+            && expWritePort(e, MCP_OLAT, e->outputs)
+            && expWritePort(e, MCP_IODIR, e->directions)
+            && expWritePort(e, MCP_GPPU, e->pullUps)
+            && expWritePort(e, MCP_GPINTEN, (e->intPin >= 0) ? e->directions : 0);
+    } else {
+        ok = expWritePort(e, 0, expPcfPort(e));
+    }
+    if (!ok) {
+        expFailed(e);
+        return false;
+    }
+    if (!e->ready) aePrintf("Expander 0x%02X: ready\r\n", e->address);
+    e->ready = true;
+    e->dirty = false;
+    expRead(e, micros());
+    return e->ready;
+}
+#pragma endregion
+
+#pragma region Pins
+Expander* expFind(byte pin, uint16_t* bit) {
+    if (!expIsPin(pin)) return NULL;
+    int index = (pin - EXPANDER_PinBase) / 16;
+    if (index >= expCount) return NULL;
+    *bit = 1 << ((pin - EXPANDER_PinBase) % 16);
+    return &expanders[index];
+}
+
+bool expIsPin(byte pin) {
+    return (pin >= EXPANDER_PinBase) && (pin < EXPANDER_PinsEnd);
+}
+
+void expPinMode(byte pin, byte mode) {
+    uint16_t bit;
+    Expander* e = expFind(pin, &bit);
+    if (e == NULL) {
+        if (!expIsPin(pin)) pinMode(pin, mode);
+        return;
+    }
+    if (mode == OUTPUT) {
+        e->directions &= ~bit;
+    } else {
+        e->directions |= bit;
+    }
+    if (mode == INPUT_PULLUP) {
+        e->pullUps |= bit;
+    } else {
+        e->pullUps &= ~bit;
+    }
+    // Registration time only: whole chip configuration is rewritten
+    expConfigure(e);
+}
+
+int expDigitalRead(byte pin) {
+    uint16_t bit;
+    Expander* e = expFind(pin, &bit);
+    if (e == NULL) return expIsPin(pin) ? LOW : digitalRead(pin);
+    uint16_t levels = ((e->directions & bit) != 0) ? e->inputs : e->outputs;
+    return ((levels & bit) != 0) ? HIGH : LOW;
+}
+
+void expDigitalWrite(byte pin, byte value) {
+    uint16_t bit;
+    Expander* e = expFind(pin, &bit);
+    if (e == NULL) {
+        if (!expIsPin(pin)) digitalWrite(pin, value);
+        return;
+    }
+    uint16_t outputs = (value == LOW) ? (e->outputs & ~bit) : (e->outputs | bit);
+    if (outputs == e->outputs) return;
+    e->outputs = outputs;
+    e->dirty = true;
+}
+
+void expFlush() {
+    for (int i = 0; i < expCount; i++) {
+        Expander* e = &expanders[i];
+        if (!e->dirty || !e->ready) continue;
+        bool ok = (e->type == expMCP23017) ? expWritePort(e, MCP_OLAT, e->outputs) : expWritePort(e, 0, expPcfPort(e));
+        if (ok) {
+            e->dirty = false;
+        } else {
+            expFailed(e);
+        }
+    }
+}
+#pragma endregion
+
+#pragma region Loop, Init
+void expLoop() {
+    static unsigned long _tmPolled = 0;
+    unsigned long t = millis();
+
+    noInterrupts();
+    bool interrupted = expInterrupted;
+    unsigned long us = expInterruptedOn;
+    expInterrupted = false;
+    interrupts();
+
+    bool poll = timedOut(t, _tmPolled, EXPANDER_PollInterval);
+    if (poll) _tmPolled = t;
+
+    for (int i = 0; i < expCount; i++) {
+        Expander* e = &expanders[i];
+        if (!e->ready) {
+            // Outputs are restored from the latch by configuration
+            if (timedOut(t, e->failedOn, EXPANDER_RetryInterval)) expConfigure(e);
+            continue;
+        }
+        if (e->directions == 0) continue;
+        if (e->intPin < 0) {
+            if (poll) expRead(e, micros());
+        } else if (interrupted) {
+            expRead(e, us);
+        } else if (poll && (digitalRead(e->intPin) == LOW)) {
+            // Edge missed while previous read was in progress: chip keeps INT low until inputs are read
+            expRead(e, micros());
+        }
+    }
+    expFlush();
+}
+
+void expRegisterHandler(EXP_HANDLER) {
+    if (expHandlersCount >= EXPANDER_HandlersSize) return;
+    expHandlers[expHandlersCount++].handler = handler;
+}
+
+int expRegister(byte address, ExpanderType type, int intPin) {
+    if (expCount >= EXPANDER_Max) return -1;
+    Expander* e = &expanders[expCount];
+    e->address = address;
+    e->type = type;
+    e->intPin = intPin;
+    e->ready = false;
+    e->dirty = false;
+    e->directions = (type == expMCP23017) ? 0xFFFF : 0x00FF;
+    // Released buttons with pull-ups read high
+    e->inputs = e->directions;
+    e->outputs = 0;
+    e->pullUps = 0;
+    e->failedOn = millis();
+    expCount++;
+
+    if (intPin >= 0) {
+        pinMode(intPin, INPUT_PULLUP);
+        attachInterrupt(intPin, expInterrupt, FALLING);
+    }
+    if (!expConfigure(e)) aePrintf("Expander 0x%02X: not responding\r\n", address);
+    return EXPANDER_PinBase + (expCount - 1) * 16;
+}
+
+void expInit() {
+#if defined(I2C_SDA) && defined(I2C_SCL)
+    Wire.begin(I2C_SDA, I2C_SCL);
+#else
+    Wire.begin();
+#endif
+    Wire.setClock(EXPANDER_I2CClock);
+    aeRegisterLoop(expLoop);
+}
+#pragma endregion
@@ -0,0 +1,34 @@
+#ifndef expander_h
+#define expander_h
+
+// I2C GPIO expanders. Expander pins get virtual numbers starting from EXPANDER_PinBase, 16 per chip
+// in registration order: first chip pins are EXPANDER_PinBase + 0..15 (PCF8574: 0..7)
+#define EXPANDER_PinBase 64
+#define EXPANDER_Max 4
+#define EXPANDER_PinsEnd (EXPANDER_PinBase + EXPANDER_Max * 16)
+
+enum ExpanderType {
+    expMCP23017 = 1,
+    expPCF8574 = 2
+};
+
+// Called for every input pin change found by expander read, "us" is micros of the INT line edge (or of the read if polled)
+#define EXP_HANDLER std::function<void(byte pin, bool level, unsigned long us)> handler
+
+// Register expander chip, returns virtual number of its first pin or -1 on error.
+// intPin: GPIO connected to chip INT output (several chips may share one line), -1 to poll inputs
+int expRegister(byte address, ExpanderType type, int intPin);
+
+bool expIsPin(byte pin);
+// pinMode / digitalRead / digitalWrite for both native and expander pins.
+// Expander inputs are read from the last burst read; outputs are written to the latch and sent by expFlush()
+void expPinMode(byte pin, byte mode);
+int expDigitalRead(byte pin);
+void expDigitalWrite(byte pin, byte value);
+// Write changed output latches: one I2C transaction per chip
+void expFlush();
+
+void expRegisterHandler(EXP_HANDLER);
+
+void expInit();
+#endif
@@ -0,0 +1,83 @@
+#include <Arduino.h>
+
+#include "AELib.h"
+#include "JsonWriter.h"
+
+void jsonAppend(JsonWriter* json, const char* s, unsigned int length) {
+    if (json->overflow || (json->length + length >= json->size)) {
+        json->overflow = true;
+        return;
+    }
+    memcpy(json->buffer + json->length, s, length);
+    json->length += length;
+    json->buffer[json->length] = 0;
+}
+
+void jsonAppend(JsonWriter* json, const char* s) {
+    jsonAppend(json, s, strlen(s));
+}
+
+void jsonString(JsonWriter* json, const char* s) {
+    jsonAppend(json, "\"", 1);
+    while (*s) {
+        char c = *s++;
+        if ((c == '"') || (c == '\\')) {
+            char e[2] = { '\\', c };
+            jsonAppend(json, e, 2);
+        } else if ((byte)c < 0x20) {
+            char e[8];
+            sprintf(e, "\\u%04x", (byte)c);
+            jsonAppend(json, e);
+        } else {
+            jsonAppend(json, &c, 1);
+        }
+    }
+    jsonAppend(json, "\"", 1);
+}
+
+void jsonKey(JsonWriter* json, char* key) {
+    if (json->length > 1) jsonAppend(json, ",", 1);
+    jsonString(json, key);
+    jsonAppend(json, ":", 1);
+}
+
+void jsonBegin(JsonWriter* json, char* buffer, unsigned int size) {
+    json->buffer = buffer;
+    json->size = size;
+    json->length = 0;
+    json->overflow = (size < 3);
+    if (size > 0) buffer[0] = 0;
+    jsonAppend(json, "{", 1);
+}
+
+void jsonAdd(JsonWriter* json, char* key, long value) {
+    char s[16];
+    sprintf(s, "%ld", value);
+    jsonKey(json, key);
+    jsonAppend(json, s);
+}
+
+void jsonAdd(JsonWriter* json, char* key, char* value) {
+    jsonKey(json, key);
+    if (value != NULL) {
+        jsonString(json, value);
+    } else {
+        jsonAppend(json, "null", 4);
+    }
+}
+
+void jsonAdd(JsonWriter* json, char* key, float value, int decimals) {
+    char s[24];
+    jsonKey(json, key);
+    if (isnan(value) || isinf(value)) {
+        jsonAppend(json, "null", 4);
+    } else {
+        dtostrf(value, 0, decimals, s);
+        jsonAppend(json, s);
+    }
+}
+
+bool jsonEnd(JsonWriter* json) {
+    jsonAppend(json, "}", 1);
+    return !json->overflow;
+}
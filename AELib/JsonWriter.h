@@ -0,0 +1,29 @@
+#ifndef json_writer_h
+#define json_writer_h
+
+// Minimalistic streaming JSON object writer. Writes into caller provided buffer, no heap allocations.
+// Usage:
+//   char b[64];
+//   JsonWriter json;
+//   jsonBegin(&json, b, sizeof(b));
+//   jsonAdd(&json, "Temperature", 23.5, 1);
+//   jsonAdd(&json, "Humidity", (long)45);
+//   if (jsonEnd(&json)) mqttPublish(TOPIC, b, true);
+
+struct JsonWriter {
+    char* buffer;
+    unsigned int size;
+    unsigned int length;
+    bool overflow;
+};
+
+void jsonBegin(JsonWriter* json, char* buffer, unsigned int size);
+void jsonAdd(JsonWriter* json, char* key, long value);
+void jsonAdd(JsonWriter* json, char* key, char* value);
+void jsonAdd(JsonWriter* json, char* key, float value, int decimals);
+
+/// <summary>Close JSON object</summary>
+/// <returns>False if buffer was too small to hold the whole document</returns>
+bool jsonEnd(JsonWriter* json);
+
+#endif
@@ -0,0 +1,147 @@
+#include <Arduino.h>
+
+#include "AELib.h"
+#include "Ladder.h"
+
+// Turn on debug output
+//#define Debug
+
+#ifndef LADDER_Pin
+#define LADDER_Pin A0
+#endif
+// ADC is sampled this often, us. ESP8266 WiFi loses connection if ADC is read more often than every few ms
+#ifndef LADDER_Interval
+#define LADDER_Interval ((unsigned long)10000)
+#endif
+// Reading must fall into the same band this many samples in a row to be accepted
+#ifndef LADDER_Samples
+#define LADDER_Samples 2
+#endif
+// Reading leaves current band only if it is closer to another band value by this margin
+#ifndef LADDER_Hysteresis
+#define LADDER_Hysteresis 16
+#endif
+#define LADDER_BandsSize (LADDER_Max * 2 + 1)
+#define LADDER_HandlersSize 2
+
+// Reading value and keys pressed, bit per key. Band 0 is idle (no keys)
+struct LadderBand {
+    int value;
+    byte keys;
+};
+
+struct LadderHandlers {
+    LADDER_HANDLER;
+};
+
+byte ladderCount = 0;
+byte ladderBandsCount = 1;
+LadderBand ladderBands[LADDER_BandsSize] = { { 1023, 0 } };
+
+unsigned int ladderHandlersCount = 0;
+LadderHandlers ladderHandlers[LADDER_HandlersSize];
+
+// Accepted band and the band seen in the last samples
+byte ladderBand = 0;
+byte ladderCandidate = 0;
+byte ladderCandidateSamples = 0;
+unsigned long ladderCandidateOn = 0;
+unsigned long ladderSampledOn = 0;
+
+#pragma region Classification
+int ladderDistance(byte band, int value) {
+    int d = value - ladderBands[band].value;
+    return (d < 0) ? -d : d;
+}
+
+// Nearest band wins, but current one is kept until reading is closer to another by hysteresis margin:
+// readings around the middle between two bands do not flip keys back and forth
+byte ladderClassify(int value) {
+    byte nearest = 0;
+    for (byte i = 1; i < ladderBandsCount; i++) {
+        if (ladderDistance(i, value) < ladderDistance(nearest, value)) nearest = i;
+    }
+    if ((nearest != ladderBand) && (ladderDistance(nearest, value) + LADDER_Hysteresis >= ladderDistance(ladderBand, value))) {
+        return ladderBand;
+    }
+    return nearest;
+}
+
+void ladderAccept(byte band, unsigned long us) {
+    byte changed = ladderBands[band].keys ^ ladderBands[ladderBand].keys;
+    ladderBand = band;
+    while (changed != 0) {
+        int key = __builtin_ctz(changed);
+        changed &= changed - 1;
+        bool pressed = (ladderBands[band].keys & (1 << key)) != 0;
+        for (int i = 0; i < ladderHandlersCount; i++) {
+            ladderHandlers[i].handler(LADDER_PinBase + key, pressed, us);
+        }
+    }
+}
+
+void ladderSample(unsigned long us) {
+    int value = analogRead(LADDER_Pin);
+    byte band = ladderClassify(value);
+    if (band != ladderCandidate) {
+        ladderCandidate = band;
+        ladderCandidateSamples = 0;
+        ladderCandidateOn = us;
+    }
+    if (ladderCandidateSamples < LADDER_Samples) ladderCandidateSamples++;
+    if ((ladderCandidateSamples >= LADDER_Samples) && (band != ladderBand)) {
+#ifdef Debug
+        aePrintf("Ladder: %d -> band %d\r\n", value, band);
+#endif
+        ladderAccept(band, ladderCandidateOn);
+    }
+}
+#pragma endregion
+
+#pragma region Ladder API
+bool ladderAddBand(int value, byte keys) {
+    if ((ladderBandsCount >= LADDER_BandsSize) || (value < 0) || (value > 1023)) return false;
+    ladderBands[ladderBandsCount].value = value;
+    ladderBands[ladderBandsCount].keys = keys;
+    ladderBandsCount++;
+    return true;
+}
+
+int ladderRegister(int value) {
+    if ((ladderCount >= LADDER_Max) || !ladderAddBand(value, 1 << ladderCount)) return -1;
+    return LADDER_PinBase + ladderCount++;
+}
+
+bool ladderRegisterCombination(int value, byte pin1, byte pin2) {
+    if (!ladderIsPin(pin1) || !ladderIsPin(pin2)) return false;
+    return ladderAddBand(value, (1 << (pin1 - LADDER_PinBase)) | (1 << (pin2 - LADDER_PinBase)));
+}
+
+bool ladderIsPin(byte pin) {
+    return (pin >= LADDER_PinBase) && (pin < LADDER_PinBase + ladderCount);
+}
+
+void ladderRegisterHandler(LADDER_HANDLER) {
+    if (ladderHandlersCount >= LADDER_HandlersSize) return;
+    ladderHandlers[ladderHandlersCount++].handler = handler;
+}
+#pragma endregion
+
+#pragma region Loop, Init
+void ladderLoop() {
+    if (ladderBandsCount < 2) return;
+    unsigned long us = micros();
+    if ((unsigned long)(us - ladderSampledOn) < LADDER_Interval) return;
+    ladderSampledOn = us;
+    ladderSample(us);
+}
+
+void ladderInit(int idleValue) {
+    ladderBands[0].value = idleValue;
+    aeRegisterLoop(ladderLoop);
+}
+
+void ladderInit() {
+    ladderInit(1023);
+}
+#pragma endregion
@@ -0,0 +1,27 @@
+#ifndef ladder_h
+#define ladder_h
+
+#include "Expander.h"
+
+// Several buttons on the single ADC input through a resistor ladder. Every key (or combination of keys
+// pressed together) gives its own ADC reading. Keys get virtual pin numbers starting from LADDER_PinBase
+// and are registered with btnRegister() as usual
+#define LADDER_PinBase EXPANDER_PinsEnd
+#define LADDER_Max 8
+#define LADDER_PinsEnd (LADDER_PinBase + LADDER_Max)
+
+// Called for every key change, "us" is micros of the first sample of the new reading
+#define LADDER_HANDLER std::function<void(byte pin, bool pressed, unsigned long us)> handler
+
+// Register key reading value (0..1023), returns virtual pin number or -1 on error
+int ladderRegister(int value);
+// Register reading value of two keys pressed together (ladders with binary weighted resistors)
+bool ladderRegisterCombination(int value, byte pin1, byte pin2);
+
+bool ladderIsPin(byte pin);
+void ladderRegisterHandler(LADDER_HANDLER);
+
+// idleValue: reading with no key pressed
+void ladderInit(int idleValue);
+void ladderInit();
+#endif
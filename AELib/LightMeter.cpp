@@ -85,11 +85,8 @@ bool lmValid() {
 #pragma region MQTT publishing
 
 void lmPublishSettings() {
-  char b[31];
-  dtostrf( lmConfig.sunriseLevel, 0, 1, b);
-  mqttPublish(TOPIC_LMSunriseLevel, b, true);
-  dtostrf( lmConfig.sunsetLevel, 0, 1, b);
-  mqttPublish(TOPIC_LMSunsetLevel, b, true);
+  mqttPublish(TOPIC_LMSunriseLevel, lmConfig.sunriseLevel, 1, true);
+  mqttPublish(TOPIC_LMSunsetLevel, lmConfig.sunsetLevel, 1, true);
 }
 
 void lmPublishStatus() {
@@ -101,7 +98,6 @@ void lmPublishStatus() {
     }
     if (valid == 0) return;
 
-    char b[31];
     bool hindex = false;
     float delta;
 
@@ -112,8 +108,7 @@ void lmPublishStatus() {
           unsigned long t = millis();
           static unsigned long publishedOn;
           if ((delta > lmLevel / 3) || ((unsigned long)(t - publishedOn) > (unsigned long)60000)) {
-              dtostrf(lmLevel, 0, 1, b);
-              if (mqttPublish(TOPIC_LMLevel, b, true)) {
+              if (mqttPublish(TOPIC_LMLevel, lmLevel, 1, true)) {
                   _lmLevel = lmLevel;
                   publishedOn = t;
               }
@@ -123,8 +118,7 @@ void lmPublishStatus() {
     if( lmssEnabled ) {
         static float _lmFilteredLevel = -1;
         if( (lmFilteredLevel>0) && (lmFilteredLevel != _lmFilteredLevel) ) {
-            dtostrf(lmFilteredLevel, 0, 1, b);
-            if (mqttPublish(TOPIC_LMFilteredLevel, b, true)) {
+            if (mqttPublish(TOPIC_LMFilteredLevel, lmFilteredLevel, 1, true)) {
                 _lmFilteredLevel = lmFilteredLevel;
             }
         }
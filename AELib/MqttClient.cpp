@@ -0,0 +1,664 @@
+#include <Arduino.h>
+
+#include "AELib.h"
+#include "MqttClient.h"
+
+//#define Debug
+
+// Keep alive interval requested in CONNECT, seconds
+#ifdef MQTT_KeepAlive
+#define MQTTC_KeepAlive MQTT_KeepAlive
+#else
+#define MQTTC_KeepAlive 15
+#endif
+// Incoming traffic is checked every MQTTC_InIdleFactor keep alive intervals while device is publishing
+#define MQTTC_InIdleFactor 4
+// Time to wait for PUBACK before QoS 1 message is sent again (MQTT 3.1.1 only:
+// MQTT 5 allows retransmission on reconnect only)
+#define MQTTC_RetryTimeout ((unsigned long)10000)
+#define MQTTC_SocketTimeout ((unsigned long)15000)
+
+// Control packet types
+#define MQTTC_CONNECT 0x10
+#define MQTTC_CONNACK 0x20
+#define MQTTC_PUBLISH 0x30
+#define MQTTC_PUBACK 0x40
+#define MQTTC_SUBSCRIBE 0x82
+#define MQTTC_PINGREQ 0xC0
+#define MQTTC_PINGRESP 0xD0
+#define MQTTC_DISCONNECT 0xE0
+
+// Properties
+#define MQTT5_PropMessageExpiry 0x02
+#define MQTT5_PropSessionExpiry 0x11
+#define MQTT5_PropServerKeepAlive 0x13
+#define MQTT5_PropTopicAliasMax 0x22
+#define MQTT5_PropTopicAlias 0x23
+#define MQTT5_PropMaxPacketSize 0x27
+
+#pragma region Encoding helpers
+unsigned int mqttcVarintSize(unsigned long value) {
+    return (value < 128) ? 1 : (value < 16384) ? 2 : (value < 2097152) ? 3 : 4;
+}
+
+uint8_t* mqttcWriteVarint(uint8_t* p, unsigned long value) {
+    do {
+        uint8_t b = value & 0x7F;
+        value >>= 7;
+        *p++ = (value > 0) ? (b | 0x80) : b;
+    } while (value > 0);
+    return p;
+}
+
+uint8_t* mqttcWriteInt(uint8_t* p, unsigned long value, unsigned int size) {
+    for (int i = size - 1; i >= 0; i--) *p++ = value >> (8 * i);
+    return p;
+}
+
+uint8_t* mqttcWriteString(uint8_t* p, const char* s, unsigned int length) {
+    p = mqttcWriteInt(p, length, 2);
+    memmove(p, s, length);
+    return p + length;
+}
+
+// Returns NULL if value exceeds buffer
+uint8_t* mqttcReadVarint(uint8_t* p, uint8_t* end, unsigned long* value) {
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        if (p >= end) return NULL;
+        *value |= (unsigned long)(*p & 0x7F) << (7 * i);
+        if ((*p++ & 0x80) == 0) return p;
+    }
+    return NULL;
+}
+
+unsigned long mqttcReadInt(uint8_t* p, unsigned int size) {
+    unsigned long value = 0;
+    for (unsigned int i = 0; i < size; i++) value = (value << 8) | p[i];
+    return value;
+}
+
+// Read property id and its integer value (if any), skip string and binary ones.
+// Returns pointer to the next property or NULL if property is malformed
+uint8_t* mqttcReadProperty(uint8_t* p, uint8_t* end, uint8_t* id, unsigned long* value) {
+    if (p >= end) return NULL;
+    *id = *p++;
+    *value = 0;
+    unsigned int size;
+    switch (*id) {
+    case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+        size = 1; break;
+    case 0x13: case 0x21: case 0x22: case 0x23:
+        size = 2; break;
+    case 0x02: case 0x11: case 0x18: case 0x27:
+        size = 4; break;
+    case 0x0B:
+        return mqttcReadVarint(p, end, value);
+    case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+        if (p + 2 > end) return NULL;
+        size = 2 + mqttcReadInt(p, 2);
+        return (p + size <= end) ? p + size : NULL;
+    case 0x26: // User property: string pair
+        if (p + 2 > end) return NULL;
+        p += 2 + mqttcReadInt(p, 2);
+        if (p + 2 > end) return NULL;
+        size = 2 + mqttcReadInt(p, 2);
+        return (p + size <= end) ? p + size : NULL;
+    default:
+        return NULL;
+    }
+    if (p + size > end) return NULL;
+    *value = mqttcReadInt(p, size);
+    return p + size;
+}
+#pragma endregion
+
+MqttClient::MqttClient(Client& client) {
+    this->client = &client;
+    address[0] = 0;
+    port = 1883;
+    callback = NULL;
+    clientState = MQTTC_Disconnected;
+    publishSize = 0;
+    aliased = 0;
+    pings = 0;
+    retransmits = 0;
+    cleanSession = true;
+    sessionResumed = false;
+    nextPacketId = 1;
+    memset(inFlight, 0, sizeof(inFlight));
+    resetSession();
+}
+
+MqttClient& MqttClient::setServer(const char* address, uint16_t port) {
+    strncpy(this->address, address, sizeof(this->address) - 1);
+    this->address[sizeof(this->address) - 1] = 0;
+    this->port = port;
+    return *this;
+}
+
+MqttClient& MqttClient::setCallback(MQTTC_CALLBACK callback) {
+    this->callback = callback;
+    return *this;
+}
+
+bool MqttClient::setBufferSize(uint16_t size) {
+    return (size <= MQTTC_BufferSize);
+}
+
+void MqttClient::resetSession() {
+    keepAlive = MQTTC_KeepAlive;
+    aliasMax = 0;
+    serverMaxPacketSize = 0;
+#if (MQTT_Version == 5)
+    aliasCount = 0;
+    aliasPoolUsed = 0;
+    memset(topicHits, 0, sizeof(topicHits));
+#endif
+    pingOutstanding = false;
+    sessionResumed = false;
+}
+
+void MqttClient::setCleanSession(bool cleanSession) {
+    this->cleanSession = cleanSession;
+}
+
+bool MqttClient::sessionPresent() {
+    return sessionResumed;
+}
+
+uint16_t MqttClient::packetId() {
+    uint16_t id = nextPacketId++;
+    if (nextPacketId == 0) nextPacketId = 1;
+    return id;
+}
+
+#pragma region Packet I/O
+// Send packet which body of "length" bytes is built at MQTTC_HeaderSize offset of the buffer
+bool MqttClient::write(uint8_t header, unsigned int length) {
+    unsigned int n = mqttcVarintSize(length);
+    uint8_t* p = buffer + MQTTC_HeaderSize - 1 - n;
+    *p = header;
+    mqttcWriteVarint(p + 1, length);
+    unsigned int size = 1 + n + length;
+    publishSize = size;
+    lastOutActivity = millis();
+    return (client->write(p, size) == size);
+}
+
+bool MqttClient::readByte(uint8_t* b, unsigned long started) {
+    while (!client->available()) {
+        if (!client->connected() || timedOut(millis(), started, MQTTC_SocketTimeout)) return false;
+        yield();
+    }
+    *b = client->read();
+    return true;
+}
+
+// Read whole packet: header is stored in rxHeader, body at the beginning of the buffer.
+// Packets exceeding buffer size are skipped (returned length is 0)
+bool MqttClient::readPacket(unsigned int* length) {
+    unsigned long started = millis();
+    uint8_t b;
+    if (!readByte(&rxHeader, started)) return false;
+
+    unsigned long remaining = 0;
+    for (int i = 0; i < 4; i++) {
+        if (!readByte(&b, started)) return false;
+        remaining |= (unsigned long)(b & 0x7F) << (7 * i);
+        if ((b & 0x80) == 0) break;
+    }
+
+    *length = (remaining <= MQTTC_BufferSize) ? remaining : 0;
+    for (unsigned long i = 0; i < remaining; i++) {
+        if (!readByte(&b, started)) return false;
+        if (i < *length) buffer[i] = b;
+    }
+    lastInActivity = millis();
+    return true;
+}
+#pragma endregion
+
+#pragma region Connect / Disconnect
+bool MqttClient::connect(const char* id, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+    return connect(id, NULL, NULL, willTopic, willQos, willRetain, willMessage);
+}
+
+bool MqttClient::connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+    if (connected()) return true;
+    if (!open() || !connectBegin(id, user, pass, willTopic, willQos, willRetain, willMessage)) return false;
+    unsigned long started = millis();
+    int rc;
+    while ((rc = connectPoll()) == 0) {
+        if (timedOut(millis(), started, MQTTC_SocketTimeout)) {
+            clientState = MQTTC_ConnectionTimeout;
+            client->stop();
+            return false;
+        }
+        yield();
+    }
+    return (rc > 0);
+}
+
+bool MqttClient::open() {
+    if (client->connected()) client->stop();
+    if ((address[0] == 0) || !client->connect(address, port)) {
+        clientState = MQTTC_ConnectFailed;
+        return false;
+    }
+    return true;
+}
+
+bool MqttClient::connectBegin(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+    resetSession();
+
+    // Check if CONNECT packet fits the buffer
+#if (MQTT_Version == 5)
+    unsigned int length = 10 + 1 + 5 + (cleanSession ? 0 : 5) + 2 + strlen(id);
+    if (willTopic != NULL) length += 1;
+#else
+    unsigned int length = 10 + 2 + strlen(id);
+#endif
+    if (willTopic != NULL) length += 2 + strlen(willTopic) + 2 + strlen(willMessage);
+    if (user != NULL) length += 2 + strlen(user);
+    if (pass != NULL) length += 2 + strlen(pass);
+    if (!client->connected() || (MQTTC_HeaderSize + length > MQTTC_BufferSize)) {
+        clientState = MQTTC_ConnectFailed;
+        client->stop();
+        return false;
+    }
+
+    uint8_t* p = buffer + MQTTC_HeaderSize;
+    p = mqttcWriteString(p, "MQTT", 4);
+    *p++ = MQTT_Version;
+    uint8_t flags = cleanSession ? 0x02 : 0; // Clean start
+    if (willTopic != NULL) flags |= 0x04 | ((willQos & 0x03) << 3) | (willRetain ? 0x20 : 0);
+    if (user != NULL) flags |= 0x80;
+    if (pass != NULL) flags |= 0x40;
+    *p++ = flags;
+    p = mqttcWriteInt(p, keepAlive, 2);
+#if (MQTT_Version == 5)
+    // Properties: maximum packet size device is able to receive, session expiry for persistent session
+    *p++ = cleanSession ? 5 : 10;
+    *p++ = MQTT5_PropMaxPacketSize;
+    p = mqttcWriteInt(p, MQTTC_BufferSize, 4);
+    if (!cleanSession) {
+        *p++ = MQTT5_PropSessionExpiry;
+        p = mqttcWriteInt(p, MQTT_SessionExpiry, 4);
+    }
+#endif
+
+    p = mqttcWriteString(p, id, strlen(id));
+    if (willTopic != NULL) {
+#if (MQTT_Version == 5)
+        *p++ = 0; // No will properties
+#endif
+        p = mqttcWriteString(p, willTopic, strlen(willTopic));
+        p = mqttcWriteString(p, willMessage, strlen(willMessage));
+    }
+    if (user != NULL) p = mqttcWriteString(p, user, strlen(user));
+    if (pass != NULL) p = mqttcWriteString(p, pass, strlen(pass));
+
+    if (!write(MQTTC_CONNECT, p - buffer - MQTTC_HeaderSize)) {
+        clientState = MQTTC_ConnectFailed;
+        client->stop();
+        return false;
+    }
+    clientState = MQTTC_Connecting;
+    return true;
+}
+
+int MqttClient::connectPoll() {
+    if (clientState != MQTTC_Connecting) return (clientState == MQTTC_Connected) ? 1 : -1;
+    if (!client->available()) {
+        if (client->connected()) return 0;
+        clientState = MQTTC_ConnectionLost;
+        return -1;
+    }
+
+    // CONNACK is just several bytes long, read it at once
+    unsigned int rxLength;
+    if (!readPacket(&rxLength) || ((rxHeader & 0xF0) != MQTTC_CONNACK)) {
+        clientState = MQTTC_ConnectFailed;
+        client->stop();
+        return -1;
+    }
+    if (!handleConnAck(rxLength)) {
+        client->stop();
+        return -1;
+    }
+    clientState = MQTTC_Connected;
+    lastInActivity = lastOutActivity = lastPingSent = millis();
+    // Messages not acknowledged in previous connection are sent again
+    for (int i = 0; i < MQTT_InFlight; i++) inFlight[i].resend = (inFlight[i].size > 0);
+    return 1;
+}
+
+bool MqttClient::handleConnAck(unsigned int length) {
+    if (length < 2) {
+        clientState = MQTTC_ConnectFailed;
+        return false;
+    }
+    if (buffer[1] != 0) {
+        // Reason code
+        clientState = buffer[1];
+        return false;
+    }
+    sessionResumed = !cleanSession && ((buffer[0] & 0x01) != 0);
+#if (MQTT_Version == 5)
+
+    unsigned long propsLength = 0;
+    uint8_t* end = buffer + length;
+    uint8_t* p = (length > 2) ? mqttcReadVarint(buffer + 2, end, &propsLength) : end;
+    if ((p != NULL) && (p + propsLength <= end)) {
+        end = p + propsLength;
+        while (p != NULL && p < end) {
+            uint8_t id;
+            unsigned long value;
+            p = mqttcReadProperty(p, end, &id, &value);
+            if (p == NULL) break;
+            switch (id) {
+            case MQTT5_PropTopicAliasMax: aliasMax = min((unsigned long)MQTT5_TopicAliases, value); break;
+            case MQTT5_PropMaxPacketSize: serverMaxPacketSize = value; break;
+            case MQTT5_PropServerKeepAlive: keepAlive = value; break;
+            }
+        }
+    }
+#ifdef Debug
+    aePrintf("MQTT: Connected, topic aliases: %u, max packet: %lu, keep alive: %u\r\n", aliasMax, serverMaxPacketSize, keepAlive);
+#endif
+#endif
+    return true;
+}
+
+void MqttClient::disconnect() {
+    if (client->connected()) {
+        write(MQTTC_DISCONNECT, 0);
+        client->flush();
+    }
+    client->stop();
+    clientState = MQTTC_Disconnected;
+}
+
+bool MqttClient::connected() {
+    if (client->connected()) return (clientState == MQTTC_Connected);
+    if (clientState == MQTTC_Connected) {
+        clientState = MQTTC_ConnectionLost;
+        client->stop();
+    }
+    return false;
+}
+
+int MqttClient::state() {
+    return clientState;
+}
+#pragma endregion
+
+#pragma region Publish / Subscribe
+#if (MQTT_Version == 5)
+// Returns alias (1..aliasMax) for the topic or 0 if topic is not aliased.
+// Topics get alias on the second publish since connect, while there are free aliases
+uint16_t MqttClient::topicAlias(const char* topic, bool* isNew) {
+    *isNew = false;
+    if (aliasMax == 0) return 0;
+    for (uint16_t i = 0; i < aliasCount; i++) {
+        if (strcmp(aliasPool + aliasTopics[i], topic) == 0) return i + 1;
+    }
+
+    // FNV-1a hash to count publishes per topic
+    uint32_t hash = 2166136261UL;
+    for (const char* c = topic; *c; c++) hash = (hash ^ (uint8_t)*c) * 16777619UL;
+    uint8_t* hits = &topicHits[hash % sizeof(topicHits)];
+    if (*hits < 255) (*hits)++;
+
+    unsigned int size = strlen(topic) + 1;
+    if ((*hits < 2) || (aliasCount >= aliasMax) || (aliasPoolUsed + size > MQTT5_AliasPoolSize)) return 0;
+    aliasTopics[aliasCount] = aliasPoolUsed;
+    memcpy(aliasPool + aliasPoolUsed, topic, size);
+    aliasPoolUsed += size;
+    aliasCount++;
+    *isNew = true;
+    return aliasCount;
+}
+#endif
+
+bool MqttClient::publish(const char* topic, const char* payload, bool retained) {
+    return publish(topic, (const uint8_t*)payload, (payload != NULL) ? strlen(payload) : 0, retained);
+}
+
+bool MqttClient::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    return publish(topic, payload, length, retained, 0);
+}
+
+bool MqttClient::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained, uint8_t qos) {
+    if (!connected()) return false;
+
+    // Check packet size assuming topic name is sent
+    unsigned int topicLength = strlen(topic);
+#if (MQTT_Version == 5)
+    unsigned int expiry = (!retained && (MQTT_EventExpiry > 0)) ? 5 : 0;
+    unsigned int propsLength = ((aliasMax > 0) ? 3 : 0) + expiry;
+    unsigned int bodyLength = 2 + topicLength + 1 + propsLength + length;
+#else
+    unsigned int bodyLength = 2 + topicLength + length;
+#endif
+    unsigned int packetLength = 1 + mqttcVarintSize(bodyLength) + bodyLength;
+    if ((MQTTC_HeaderSize + bodyLength + 2 > MQTTC_BufferSize)
+        || ((serverMaxPacketSize > 0) && (packetLength + 2 > serverMaxPacketSize))) return false;
+
+    // QoS 1 packet is kept for retransmission: too long messages are sent with QoS 0
+    InFlight* slot = NULL;
+    if (qos > 0) {
+        if (packetLength + 2 <= MQTT_InFlightPacketSize) {
+            for (int i = 0; (i < MQTT_InFlight) && (slot == NULL); i++) {
+                if (inFlight[i].size == 0) slot = &inFlight[i];
+            }
+            if (slot == NULL) return false;
+        }
+    }
+
+    uint8_t* p = buffer + MQTTC_HeaderSize;
+#if (MQTT_Version == 5)
+    // Stored QoS 1 packets must not refer aliases: they may be sent again in next connection
+    bool isNew = false;
+    uint16_t alias = (slot == NULL) ? topicAlias(topic, &isNew) : 0;
+    propsLength = ((alias > 0) ? 3 : 0) + expiry;
+
+    if ((alias > 0) && !isNew) {
+        p = mqttcWriteInt(p, 0, 2);
+    } else {
+        p = mqttcWriteString(p, topic, topicLength);
+    }
+    if (slot != NULL) p = mqttcWriteInt(p, slot->packetId = packetId(), 2);
+    p = mqttcWriteVarint(p, propsLength);
+    if (alias > 0) {
+        *p++ = MQTT5_PropTopicAlias;
+        p = mqttcWriteInt(p, alias, 2);
+    }
+    if (expiry > 0) {
+        *p++ = MQTT5_PropMessageExpiry;
+        p = mqttcWriteInt(p, MQTT_EventExpiry, 4);
+    }
+#else
+    p = mqttcWriteString(p, topic, topicLength);
+    if (slot != NULL) p = mqttcWriteInt(p, slot->packetId = packetId(), 2);
+#endif
+    if (length > 0) memmove(p, payload, length);
+    p += length;
+
+    uint8_t header = MQTTC_PUBLISH | (retained ? 0x01 : 0) | ((slot != NULL) ? 0x02 : 0);
+    if (!write(header, p - buffer - MQTTC_HeaderSize)) return false;
+    if (slot != NULL) {
+        // Packet is written right before the end of the body
+        slot->size = publishSize;
+        slot->sent = lastOutActivity;
+        slot->resend = false;
+        memcpy(slot->packet, p - publishSize, publishSize);
+    }
+#if (MQTT_Version == 5)
+    if ((alias > 0) && !isNew) aliased++;
+#endif
+    return true;
+}
+
+bool MqttClient::inFlightFull() {
+    for (int i = 0; i < MQTT_InFlight; i++) {
+        if (inFlight[i].size == 0) return false;
+    }
+    return true;
+}
+
+bool MqttClient::subscribe(const char* topic) {
+    return subscribe(topic, 0);
+}
+
+bool MqttClient::subscribe(const char* topic, uint8_t qos) {
+    if (!connected()) return false;
+    unsigned int topicLength = strlen(topic);
+    if (MQTTC_HeaderSize + 2 + 1 + 2 + topicLength + 1 > MQTTC_BufferSize) return false;
+
+    uint8_t* p = buffer + MQTTC_HeaderSize;
+    p = mqttcWriteInt(p, packetId(), 2);
+#if (MQTT_Version == 5)
+    *p++ = 0; // No properties
+#endif
+    p = mqttcWriteString(p, topic, topicLength);
+    *p++ = qos & 0x03; // Options: maximum QoS
+    return write(MQTTC_SUBSCRIBE, p - buffer - MQTTC_HeaderSize);
+}
+
+unsigned int MqttClient::lastPublishSize() {
+    return publishSize;
+}
+
+unsigned long MqttClient::aliasedCount() {
+    return aliased;
+}
+
+unsigned long MqttClient::pingCount() {
+    return pings;
+}
+
+unsigned long MqttClient::retransmitCount() {
+    return retransmits;
+}
+#pragma endregion
+
+#pragma region Loop
+void MqttClient::handlePublish(unsigned int length) {
+    uint8_t* end = buffer + length;
+    if (length < 2) return;
+    unsigned int topicLength = mqttcReadInt(buffer, 2);
+    uint8_t* p = buffer + 2 + topicLength;
+    uint8_t qos = (rxHeader >> 1) & 0x03;
+    uint16_t packetId = 0;
+    if (qos > 0) {
+        if (p + 2 > end) return;
+        packetId = mqttcReadInt(p, 2);
+        p += 2;
+    }
+#if (MQTT_Version == 5)
+    unsigned long propsLength;
+    p = mqttcReadVarint(p, end, &propsLength);
+    if ((p == NULL) || (p + propsLength > end)) return;
+    p += propsLength;
+#else
+    if (p > end) return;
+#endif
+
+    // Acknowledge before the callback: handlers may restart the device (Reset, FactoryReset), and
+    // unacknowledged message would be delivered again after reboot. Buffer still holds the message
+    if (qos == 1) {
+        uint8_t ack[4] = { MQTTC_PUBACK, 2 };
+        mqttcWriteInt(ack + 2, packetId, 2);
+        lastOutActivity = millis();
+        client->write(ack, sizeof(ack));
+    }
+
+    // Make topic zero terminated: move it over topic length field
+    memmove(buffer, buffer + 2, topicLength);
+    buffer[topicLength] = 0;
+    if (callback != NULL) callback((char*)buffer, p, end - p);
+}
+
+void MqttClient::handlePubAck(unsigned int length) {
+    if (length < 2) return;
+    uint16_t id = ((uint16_t)buffer[0] << 8) | buffer[1];
+    for (int i = 0; i < MQTT_InFlight; i++) {
+        if ((inFlight[i].size > 0) && (inFlight[i].packetId == id)) inFlight[i].size = 0;
+    }
+}
+
+// Send one unacknowledged QoS 1 message again (with DUP flag) if it is due
+void MqttClient::retransmit(unsigned long t) {
+    for (int i = 0; i < MQTT_InFlight; i++) {
+        InFlight* slot = &inFlight[i];
+        if (slot->size == 0) continue;
+#if (MQTT_Version == 5)
+        if (!slot->resend) continue;
+#else
+        if (!slot->resend && !timedOut(t, slot->sent, MQTTC_RetryTimeout)) continue;
+#endif
+        slot->packet[0] |= 0x08;
+        client->write(slot->packet, slot->size);
+        slot->sent = lastOutActivity = t;
+        slot->resend = false;
+        retransmits++;
+        return;
+    }
+}
+
+bool MqttClient::loop() {
+    if (!connected()) return false;
+
+    unsigned long t = millis();
+    // Any packet sent proves client liveness to broker, so PINGREQ is sent only after keep alive
+    // interval without outgoing packets. Publishes are acknowledged by TCP, so broker liveness
+    // is checked with PINGREQ less often while device is publishing
+    unsigned long interval = keepAlive * 1000UL;
+    if ((keepAlive > 0) && pingOutstanding) {
+        if (timedOut(t, lastPingSent, interval)) {
+            clientState = MQTTC_ConnectionTimeout;
+            client->stop();
+            return false;
+        }
+    } else if ((keepAlive > 0) &&
+        (timedOut(t, lastOutActivity, interval) ||
+         (timedOut(t, lastInActivity, interval) && timedOut(t, lastPingSent, interval * MQTTC_InIdleFactor)))) {
+        buffer[MQTTC_HeaderSize - 2] = MQTTC_PINGREQ;
+        buffer[MQTTC_HeaderSize - 1] = 0;
+        client->write(buffer + MQTTC_HeaderSize - 2, 2);
+        lastOutActivity = lastInActivity = lastPingSent = t;
+        pingOutstanding = true;
+        pings++;
+    }
+
+    retransmit(t);
+
+    if (client->available()) {
+        unsigned int length;
+        if (!readPacket(&length)) {
+            clientState = MQTTC_ConnectionLost;
+            client->stop();
+            return false;
+        }
+        switch (rxHeader & 0xF0) {
+        case MQTTC_PUBLISH:
+            handlePublish(length);
+            break;
+        case MQTTC_PINGRESP:
+            pingOutstanding = false;
+            break;
+        case MQTTC_PUBACK:
+            handlePubAck(length);
+            break;
+        case MQTTC_DISCONNECT:
+            aePrintf("MQTT: Disconnected by broker, reason 0x%02X\r\n", (length > 0) ? buffer[0] : 0);
+            clientState = MQTTC_ConnectionLost;
+            client->stop();
+            return false;
+        }
+    }
+    return true;
+}
+#pragma endregion
@@ -0,0 +1,176 @@
+#ifndef mqtt_client_h
+#define mqtt_client_h
+
+#include <Arduino.h>
+#include <functional>
+#include <Client.h>
+
+// Minimalistic MQTT 3.1.1 / MQTT 5 client, PubSubClient compatible interface.
+// * connection can be established step by step without blocking the loop: open(), connectBegin(), connectPoll()
+// * persistent sessions (clean session = 0) and QoS 1 publishing with a small in-flight window:
+//   unacknowledged messages are retransmitted from loop() and after reconnect
+// MQTT 5 (MQTT_Version is set to 5 in Config.h) adds:
+// * topic aliases for frequently published topics (if broker allows them in CONNACK)
+// * message expiry interval for not retained messages (events)
+
+// MQTT protocol version: 4 (3.1.1) or 5
+#ifndef MQTT_Version
+#define MQTT_Version 4
+#endif
+
+#define MQTTC_CALLBACK std::function<void(char*, uint8_t*, unsigned int)>
+
+// state() codes, same as PubSubClient ones. Positive values are CONNACK reason codes
+#define MQTTC_ConnectionTimeout -4
+#define MQTTC_ConnectionLost -3
+#define MQTTC_ConnectFailed -2
+#define MQTTC_Disconnected -1
+#define MQTTC_Connected 0
+#define MQTTC_Connecting -5
+
+// Fixed header maximum size: packet type and up to 4 bytes of remaining length
+#define MQTTC_HeaderSize 5
+// Packet buffer size: maximum size of packet to be sent or received
+#ifdef MQTT_MAX_PACKET_SIZE
+#define MQTTC_BufferSize MQTT_MAX_PACKET_SIZE
+#else
+#define MQTTC_BufferSize 384
+#endif
+
+// Maximum number of outgoing QoS 1 messages waiting for PUBACK
+#ifndef MQTT_InFlight
+#define MQTT_InFlight 4
+#endif
+// Maximum size of QoS 1 PUBLISH packet kept for retransmission, bytes. Larger messages are sent with QoS 0
+#ifndef MQTT_InFlightPacketSize
+#define MQTT_InFlightPacketSize 128
+#endif
+// Session expiry interval requested for persistent sessions (MQTT 5), seconds
+#ifndef MQTT_SessionExpiry
+#define MQTT_SessionExpiry 3600
+#endif
+
+// Maximum number of topic aliases used by device (actual number is limited by broker)
+#ifndef MQTT5_TopicAliases
+#define MQTT5_TopicAliases 16
+#endif
+// Memory to store aliased topic names, bytes
+#ifndef MQTT5_AliasPoolSize
+#define MQTT5_AliasPoolSize 768
+#endif
+// Message expiry interval for not retained messages (events), seconds. 0 means "never expire"
+#ifndef MQTT_EventExpiry
+#define MQTT_EventExpiry 60
+#endif
+
+class MqttClient {
+public:
+    MqttClient(Client& client);
+
+    MqttClient& setServer(const char* address, uint16_t port);
+    MqttClient& setCallback(MQTTC_CALLBACK callback);
+    // Buffer is allocated statically, returns false if size requested is greater than MQTTC_BufferSize
+    bool setBufferSize(uint16_t size);
+    // Clean session (default) or persistent session: broker keeps subscriptions and queues QoS 1
+    // messages while device is offline. Takes effect on next connect
+    void setCleanSession(bool cleanSession);
+
+    // Blocking connection
+    bool connect(const char* id, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage);
+    bool connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage);
+
+    // Step by step connection
+    // Open TCP connection, takes up to client timeout (see Client::setTimeout())
+    bool open();
+    // Send CONNECT packet over open TCP connection
+    bool connectBegin(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage);
+    // Check if CONNACK is received: 1 - connected, 0 - still waiting, -1 - connection refused or lost (see state())
+    int connectPoll();
+    void disconnect();
+    bool connected();
+    int state();
+    // True if broker resumed previous session on connect: subscriptions are still active
+    bool sessionPresent();
+
+    bool publish(const char* topic, const char* payload, bool retained);
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained);
+    // QoS 1 message is kept until PUBACK is received. Returns false if in-flight window is full
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained, uint8_t qos);
+    bool subscribe(const char* topic);
+    bool subscribe(const char* topic, uint8_t qos);
+    // True if no more QoS 1 messages can be published until PUBACK is received
+    bool inFlightFull();
+
+    // Process incoming packets and keep alive. Returns false if not connected
+    bool loop();
+
+    // Size of the last PUBLISH packet sent, bytes
+    unsigned int lastPublishSize();
+    // Number of PUBLISH packets sent using topic alias instead of topic name
+    unsigned long aliasedCount();
+    // Number of PINGREQ packets sent
+    unsigned long pingCount();
+    // Number of QoS 1 messages retransmitted
+    unsigned long retransmitCount();
+
+private:
+    Client* client;
+    char address[64];
+    uint16_t port;
+    MQTTC_CALLBACK callback;
+    int clientState;
+    unsigned int keepAlive;
+
+    // Single buffer for both incoming and outgoing packets (same as PubSubClient):
+    // outgoing packet body is built at MQTTC_HeaderSize offset, incoming packet body is stored at 0
+    uint8_t buffer[MQTTC_BufferSize];
+    uint8_t rxHeader;
+    unsigned long lastOutActivity;
+    unsigned long lastInActivity;
+    unsigned long lastPingSent;
+    bool pingOutstanding;
+    unsigned long pings;
+    bool cleanSession;
+    bool sessionResumed;
+
+    // QoS 1 messages waiting for PUBACK, complete packets. Empty slot has size 0
+    struct InFlight {
+        uint16_t packetId;
+        uint16_t size;
+        unsigned long sent;
+        bool resend;
+        uint8_t packet[MQTT_InFlightPacketSize];
+    };
+    InFlight inFlight[MQTT_InFlight];
+    unsigned long retransmits;
+    uint16_t nextPacketId;
+
+    unsigned int publishSize;
+    unsigned long aliased;
+
+    // Negotiated in CONNACK
+    uint16_t aliasMax;
+    unsigned long serverMaxPacketSize;
+
+#if (MQTT_Version == 5)
+    // Aliased topics: alias N refers to aliasTopics[N-1]
+    uint16_t aliasCount;
+    uint16_t aliasTopics[MQTT5_TopicAliases];   // offsets in aliasPool
+    char aliasPool[MQTT5_AliasPoolSize];
+    unsigned int aliasPoolUsed;
+    uint8_t topicHits[32];
+    uint16_t topicAlias(const char* topic, bool* isNew);
+#endif
+
+    bool write(uint8_t header, unsigned int length);
+    bool readByte(uint8_t* b, unsigned long started);
+    bool readPacket(unsigned int* length);
+    bool handleConnAck(unsigned int length);
+    void handlePublish(unsigned int length);
+    void handlePubAck(unsigned int length);
+    void retransmit(unsigned long t);
+    uint16_t packetId();
+    void resetSession();
+};
+
+#endif
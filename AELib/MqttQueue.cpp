@@ -0,0 +1,237 @@
+#include <Arduino.h>
+
+#include "AELib.h"
+#include "MqttQueue.h"
+
+//#define Debug
+
+// Queue buffer size, bytes
+#ifndef MQTT_QueueSize
+#define MQTT_QueueSize 2048
+#endif
+
+// Maximum number of events (not retained messages) to keep
+#ifndef MQTT_QueueMaxEvents
+#define MQTT_QueueMaxEvents 32
+#endif
+
+#define MQTTQ_Retained 0x01
+#define MQTTQ_Deleted 0x02
+#define MQTTQ_Wrap 0x80
+
+// Every record is stored as header, zero terminated topic and payload.
+// Records never cross the end of buffer: unused tail of the buffer is skipped
+// either by MQTTQ_Wrap marker or implicitly if there is no space for header.
+struct MqttQueueRecord {
+    byte flags;
+    byte topicSize; // including terminating zero
+    unsigned short length;
+} __attribute__((packed));
+
+byte mqttQueue[MQTT_QueueSize];
+// Offset of the oldest record
+unsigned int mqttQueueHead = 0;
+// Offset of the first free byte
+unsigned int mqttQueueTail = 0;
+// Bytes used including skipped buffer tail
+unsigned int mqttQueueUsed = 0;
+
+unsigned int mqttQueueRecords = 0;
+unsigned int mqttQueueEvents = 0;
+
+unsigned long mqttQueueStatesReplaced = 0;
+unsigned long mqttQueueStatesDropped = 0;
+unsigned long mqttQueueEventsDropped = 0;
+
+#pragma region Ring buffer helpers
+// Record at offset or next record after wrap point
+unsigned int mqttQueueSkipWrap(unsigned int offset) {
+    if ((MQTT_QueueSize - offset < sizeof(MqttQueueRecord)) ||
+        (((MqttQueueRecord*)(mqttQueue + offset))->flags & MQTTQ_Wrap)) {
+        return 0;
+    }
+    return offset;
+}
+
+unsigned int mqttQueueRecordSize(MqttQueueRecord* r) {
+    return sizeof(MqttQueueRecord) + r->topicSize + r->length;
+}
+
+// Remove record at head of the queue
+void mqttQueueRemoveHead() {
+    if (mqttQueueRecords == 0) return;
+    unsigned int head = mqttQueueSkipWrap(mqttQueueHead);
+    if (head != mqttQueueHead) {
+        mqttQueueUsed -= (MQTT_QueueSize - mqttQueueHead);
+        mqttQueueHead = head;
+    }
+    MqttQueueRecord* r = (MqttQueueRecord*)(mqttQueue + mqttQueueHead);
+    unsigned int size = mqttQueueRecordSize(r);
+    if (!(r->flags & MQTTQ_Deleted) && !(r->flags & MQTTQ_Retained)) mqttQueueEvents--;
+
+    mqttQueueRecords--;
+    mqttQueueUsed -= size;
+    mqttQueueHead += size;
+    if (mqttQueueRecords == 0) {
+        mqttQueueHead = mqttQueueTail = mqttQueueUsed = 0;
+    }
+}
+
+// Remove deleted records from head of the queue
+void mqttQueueTrim() {
+    while (mqttQueueRecords > 0) {
+        MqttQueueRecord* r = (MqttQueueRecord*)(mqttQueue + mqttQueueSkipWrap(mqttQueueHead));
+        if (!(r->flags & MQTTQ_Deleted)) break;
+        mqttQueueRemoveHead();
+    }
+}
+
+// Drop oldest live record to free space in buffer
+void mqttQueueDropHead() {
+    mqttQueueTrim();
+    if (mqttQueueRecords == 0) return;
+    MqttQueueRecord* r = (MqttQueueRecord*)(mqttQueue + mqttQueueSkipWrap(mqttQueueHead));
+    if (r->flags & MQTTQ_Retained) {
+        mqttQueueStatesDropped++;
+    } else {
+        mqttQueueEventsDropped++;
+    }
+    mqttQueueRemoveHead();
+}
+
+// Allocate space for record at tail of the queue. Returns NULL if not enough space
+MqttQueueRecord* mqttQueueAllocate(unsigned int size) {
+    if (mqttQueueUsed == 0) {
+        mqttQueueHead = mqttQueueTail = 0;
+    }
+    unsigned int offset;
+    unsigned int skipped = 0;
+    if ((mqttQueueUsed > 0) && (mqttQueueTail <= mqttQueueHead)) {
+        // Free space is between tail and head
+        if (mqttQueueHead - mqttQueueTail < size) return NULL;
+        offset = mqttQueueTail;
+    } else if (MQTT_QueueSize - mqttQueueTail >= size) {
+        offset = mqttQueueTail;
+    } else {
+        // Not enough space at the end of buffer, continue from the beginning
+        if (mqttQueueHead < size) return NULL;
+        skipped = MQTT_QueueSize - mqttQueueTail;
+        if (skipped >= sizeof(MqttQueueRecord)) {
+            ((MqttQueueRecord*)(mqttQueue + mqttQueueTail))->flags = MQTTQ_Wrap;
+        }
+        offset = 0;
+    }
+    mqttQueueUsed += skipped + size;
+    mqttQueueTail = offset + size;
+    mqttQueueRecords++;
+    return (MqttQueueRecord*)(mqttQueue + offset);
+}
+
+// Mark oldest live event or all retained messages with the same topic as deleted
+void mqttQueueDelete(char* topic, bool retained) {
+    unsigned int offset = mqttQueueHead;
+    for (unsigned int i = 0; i < mqttQueueRecords; i++) {
+        offset = mqttQueueSkipWrap(offset);
+        MqttQueueRecord* r = (MqttQueueRecord*)(mqttQueue + offset);
+        if (!(r->flags & MQTTQ_Deleted)) {
+            if (retained) {
+                if ((r->flags & MQTTQ_Retained) && (strcmp(topic, (char*)(r + 1)) == 0)) {
+                    r->flags |= MQTTQ_Deleted;
+                    mqttQueueStatesReplaced++;
+                }
+            } else if (!(r->flags & MQTTQ_Retained)) {
+                r->flags |= MQTTQ_Deleted;
+                mqttQueueEvents--;
+                mqttQueueEventsDropped++;
+                return;
+            }
+        }
+        offset += mqttQueueRecordSize(r);
+    }
+}
+#pragma endregion
+
+#pragma region Queue API
+bool mqttQueuePush(char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    unsigned int topicSize = strlen(topic) + 1;
+    unsigned int size = sizeof(MqttQueueRecord) + topicSize + length;
+    if ((topicSize > 255) || (size > MQTT_QueueSize / 2)) {
+        if (retained) mqttQueueStatesDropped++; else mqttQueueEventsDropped++;
+        return false;
+    }
+
+    if (retained) {
+        // State: latest value wins
+        mqttQueueDelete(topic, true);
+    } else if (mqttQueueEvents >= MQTT_QueueMaxEvents) {
+        // Events: drop oldest one
+        mqttQueueDelete(topic, false);
+    }
+    mqttQueueTrim();
+
+    MqttQueueRecord* r;
+    while ((r = mqttQueueAllocate(size)) == NULL) {
+        mqttQueueDropHead();
+    }
+    r->flags = retained ? MQTTQ_Retained : 0;
+    r->topicSize = topicSize;
+    r->length = length;
+    memcpy((byte*)(r + 1), topic, topicSize);
+    if (length > 0) memcpy((byte*)(r + 1) + topicSize, payload, length);
+    if (!retained) mqttQueueEvents++;
+
+#ifdef Debug
+    aePrintf("MQTT: Queued %s (%u bytes), %u in queue\r\n", topic, length, mqttQueueCount());
+#endif
+    return true;
+}
+
+bool mqttQueuePeek(char** topic, uint8_t** payload, unsigned int* length, bool* retained) {
+    mqttQueueTrim();
+    if (mqttQueueRecords == 0) return false;
+    MqttQueueRecord* r = (MqttQueueRecord*)(mqttQueue + mqttQueueSkipWrap(mqttQueueHead));
+    *topic = (char*)(r + 1);
+    *payload = (uint8_t*)(r + 1) + r->topicSize;
+    *length = r->length;
+    *retained = ((r->flags & MQTTQ_Retained) != 0);
+    return true;
+}
+
+void mqttQueuePop() {
+    mqttQueueTrim();
+    mqttQueueRemoveHead();
+}
+
+bool mqttQueueEmpty() {
+    mqttQueueTrim();
+    return (mqttQueueRecords == 0);
+}
+
+unsigned int mqttQueueCount() {
+    unsigned int count = 0;
+    unsigned int offset = mqttQueueHead;
+    for (unsigned int i = 0; i < mqttQueueRecords; i++) {
+        offset = mqttQueueSkipWrap(offset);
+        MqttQueueRecord* r = (MqttQueueRecord*)(mqttQueue + offset);
+        if (!(r->flags & MQTTQ_Deleted)) count++;
+        offset += mqttQueueRecordSize(r);
+    }
+    return count;
+}
+
+unsigned int mqttQueueEventCount() {
+    return mqttQueueEvents;
+}
+
+unsigned long mqttQueueCoalesced() {
+    return mqttQueueStatesReplaced;
+}
+
+unsigned long mqttQueueDroppedStates() {
+    return mqttQueueStatesDropped;
+}
+
+unsigned long mqttQueueDroppedEvents() {
+    return mqttQueueEventsDropped;
+}
+#pragma endregion
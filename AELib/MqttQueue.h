@@ -0,0 +1,37 @@
+#ifndef mqtt_queue_h
+#define mqtt_queue_h
+
+// Outbound MQTT message queue (RAM ring buffer).
+// Retained messages are treated as device state: only the latest value per topic is kept.
+// Non-retained messages are events: kept in FIFO order, up to MQTT_QueueMaxEvents.
+// Oldest messages are dropped when the buffer is full.
+
+/// <summary>Put message into the queue</summary>
+/// <param name="topic">Complete topic name (no templating)</param>
+/// <param name="payload">Message payload, may be binary</param>
+/// <param name="length">Payload length in bytes</param>
+/// <param name="retained">Retained (state) or not retained (event) message</param>
+/// <returns>True if message was queued</returns>
+bool mqttQueuePush(char* topic, const uint8_t* payload, unsigned int length, bool retained);
+
+/// <summary>Get oldest message from the queue without removing it.
+/// Returned pointers are valid until the next mqttQueuePush() / mqttQueuePop() call</summary>
+/// <returns>False if queue is empty</returns>
+bool mqttQueuePeek(char** topic, uint8_t** payload, unsigned int* length, bool* retained);
+
+/// <summary>Remove oldest message from the queue</summary>
+void mqttQueuePop();
+
+bool mqttQueueEmpty();
+// Number of messages waiting in queue
+unsigned int mqttQueueCount();
+// Number of events (not retained messages) waiting in queue
+unsigned int mqttQueueEventCount();
+// Number of retained messages replaced by newer value of the same topic before being sent
+unsigned long mqttQueueCoalesced();
+// Number of retained (state) messages dropped due to queue overflow
+unsigned long mqttQueueDroppedStates();
+// Number of not retained (event) messages dropped due to queue overflow or events limit
+unsigned long mqttQueueDroppedEvents();
+
+#endif
@@ -0,0 +1,421 @@
+#include <Arduino.h>
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#include <espnow.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#include <esp_now.h>
+#endif
+
+#include "AELib.h"
+#include "Comms.h"
+#include "Peers.h"
+
+// Turn on debug output
+//#define Debug
+
+// Maximum number of paired peers (ESP8266 supports up to 6 encrypted peers)
+#ifndef PEERS_Max
+#define PEERS_Max 6
+#endif
+#ifndef PEERS_PairTimeout
+#define PEERS_PairTimeout ((unsigned long)(30 * 1000))
+#endif
+#define PEERS_PairInterval ((unsigned long)1000)
+// Message is resent if radio did not receive acknowledge from peer
+#define PEERS_Retries 2
+// Time to wait for send result from radio
+#define PEERS_SendTimeout ((unsigned long)100)
+#define PEERS_InboxSize 8
+#define PEERS_OutboxSize 8
+#define PEERS_HandlersSize 4
+#define PEERS_Magic 0xAE
+#define PEERS_Broadcast 0xFF
+
+static char* TOPIC_Peers PROGMEM = "Peers";
+static char* TOPIC_PeersPair PROGMEM = "Peers/Pair";
+static char* TOPIC_PeersClear PROGMEM = "Peers/Clear";
+
+struct PeersConfig {
+    uint8_t count;
+    uint8_t macs[PEERS_Max][6];
+} peersConfig;
+
+struct PeerInboxItem {
+    uint8_t mac[6];
+    PeerMessage message;
+};
+
+struct PeerOutboxItem {
+    uint8_t peer; // Index in peersConfig.macs or PEERS_Broadcast
+    uint8_t attempts;
+    PeerMessage message;
+};
+
+struct PeerHandlers {
+    PEER_HANDLER;
+};
+
+static const uint8_t peerBroadcastMac[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+PeerRadio* peerRadio = NULL;
+bool peerStarted = false;
+unsigned long peerStartAttempted = 0;
+
+// Received messages are queued by radio callback and processed in peersLoop()
+PeerInboxItem peerInbox[PEERS_InboxSize];
+volatile uint8_t peerInboxHead = 0;
+volatile uint8_t peerInboxTail = 0;
+
+PeerOutboxItem peerOutbox[PEERS_OutboxSize];
+uint8_t peerOutboxHead = 0;
+uint8_t peerOutboxCount = 0;
+// First outbox item was sent, waiting for result
+bool peerInFlight = false;
+unsigned long peerSentOn;
+// 0: no result yet, 1: delivered, 2: failed
+volatile uint8_t peerSendResult = 0;
+
+uint16_t peerSeq = 0;
+// Last message number received from every peer
+uint16_t peerLastSeq[PEERS_Max];
+bool peerLastSeqValid[PEERS_Max];
+
+unsigned long peerPairing = 0;
+unsigned long peerBeaconSentOn = 0;
+bool peerReported = false;
+
+unsigned int peerHandlersCount = 0;
+PeerHandlers peerHandlers[PEERS_HandlersSize];
+
+#pragma region ESP-NOW radio
+#ifdef ESP8266
+void peerEspNowReceive(uint8_t* mac, uint8_t* data, uint8_t length) {
+    peerReceived(mac, data, length);
+}
+
+void peerEspNowSent(uint8_t* mac, uint8_t status) {
+    peerSent(mac, status == 0);
+}
+
+bool peerEspNowBegin() {
+    if (esp_now_init() != 0) return false;
+    esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+    esp_now_register_recv_cb(peerEspNowReceive);
+    esp_now_register_send_cb(peerEspNowSent);
+    // Pairing beacons are broadcasted not encrypted
+    esp_now_add_peer((uint8_t*)peerBroadcastMac, ESP_NOW_ROLE_COMBO, 0, NULL, 0);
+    return true;
+}
+
+bool peerEspNowAddPeer(const uint8_t* mac) {
+    if (esp_now_is_peer_exist((uint8_t*)mac) > 0) return true;
+#ifdef PEERS_Key
+    return esp_now_add_peer((uint8_t*)mac, ESP_NOW_ROLE_COMBO, 0, (uint8_t*)PEERS_Key, 16) == 0;
+#else
+    return esp_now_add_peer((uint8_t*)mac, ESP_NOW_ROLE_COMBO, 0, NULL, 0) == 0;
+#endif
+}
+
+bool peerEspNowSend(const uint8_t* mac, const uint8_t* data, uint8_t length) {
+    return esp_now_send((uint8_t*)mac, (uint8_t*)data, length) == 0;
+}
+#elif defined(ESP32)
+#if (ESP_ARDUINO_VERSION_MAJOR >= 3)
+void peerEspNowReceive(const esp_now_recv_info_t* info, const uint8_t* data, int length) {
+    peerReceived(info->src_addr, data, length);
+}
+#else
+void peerEspNowReceive(const uint8_t* mac, const uint8_t* data, int length) {
+    peerReceived(mac, data, length);
+}
+#endif
+
+void peerEspNowSent(const uint8_t* mac, esp_now_send_status_t status) {
+    peerSent(mac, status == ESP_NOW_SEND_SUCCESS);
+}
+
+bool peerEspNowAddPeer(const uint8_t* mac, bool encrypt) {
+    if (esp_now_is_peer_exist(mac)) return true;
+    esp_now_peer_info_t peer;
+    memset(&peer, 0, sizeof(peer));
+    memcpy(peer.peer_addr, mac, 6);
+    peer.channel = 0;
+    peer.ifidx = WIFI_IF_STA;
+#ifdef PEERS_Key
+    if (encrypt) {
+        peer.encrypt = true;
+        memcpy(peer.lmk, PEERS_Key, 16);
+    }
+#endif
+    return esp_now_add_peer(&peer) == ESP_OK;
+}
+
+bool peerEspNowAddPeer(const uint8_t* mac) {
+    return peerEspNowAddPeer(mac, true);
+}
+
+bool peerEspNowBegin() {
+    if (esp_now_init() != ESP_OK) return false;
+    esp_now_register_recv_cb(peerEspNowReceive);
+    esp_now_register_send_cb(peerEspNowSent);
+    // Pairing beacons are broadcasted not encrypted
+    peerEspNowAddPeer(peerBroadcastMac, false);
+    return true;
+}
+
+bool peerEspNowSend(const uint8_t* mac, const uint8_t* data, uint8_t length) {
+    return esp_now_send(mac, data, length) == ESP_OK;
+}
+#endif
+
+#if defined(ESP8266) || defined(ESP32)
+PeerRadio peerEspNow = { peerEspNowBegin, peerEspNowAddPeer, peerEspNowSend };
+#endif
+#pragma endregion
+
+#pragma region Radio callbacks
+void peerReceived(const uint8_t* mac, const uint8_t* data, uint8_t length) {
+    if ((length != sizeof(PeerMessage)) || (data[0] != PEERS_Magic)) return;
+    uint8_t next = (peerInboxHead + 1) % PEERS_InboxSize;
+    // Inbox is full: message is dropped, sender will not get retry since radio acknowledged it
+    if (next == peerInboxTail) return;
+    memcpy(peerInbox[peerInboxHead].mac, mac, 6);
+    memcpy(&peerInbox[peerInboxHead].message, data, sizeof(PeerMessage));
+    peerInboxHead = next;
+}
+
+void peerSent(const uint8_t* mac, bool delivered) {
+    peerSendResult = delivered ? 1 : 2;
+}
+#pragma endregion
+
+#pragma region Peers list
+int peerIndex(const uint8_t* mac) {
+    for (int i = 0; i < peersConfig.count; i++) {
+        if (memcmp(peersConfig.macs[i], mac, 6) == 0) return i;
+    }
+    return -1;
+}
+
+int peerCount() {
+    return peersConfig.count;
+}
+
+bool peerAdd(const uint8_t* mac) {
+    if (peerIndex(mac) >= 0) return true;
+    if (peersConfig.count >= PEERS_Max) return false;
+    memcpy(peersConfig.macs[peersConfig.count], mac, 6);
+    peerLastSeqValid[peersConfig.count] = false;
+    peersConfig.count++;
+    storageSave();
+    if (peerStarted) peerRadio->addPeer(mac);
+    aePrintf("Peers: Added %02X:%02X:%02X:%02X:%02X:%02X\r\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    peerReported = false;
+    return true;
+}
+
+void peerClear() {
+    // ESP-NOW peers list is rebuilt on restart
+    memset(&peersConfig, 0, sizeof(peersConfig));
+    storageSave();
+    peerOutboxCount = 0;
+    peerInFlight = false;
+    peerReported = false;
+}
+
+void peerPair() {
+    aePrintln(F("Peers: Pairing"));
+    peerPairing = millis();
+    peerBeaconSentOn = 0;
+    if (peerPairing == 0) peerPairing = 1;
+}
+#pragma endregion
+
+#pragma region Sending
+bool peerQueue(uint8_t peer, PeerMessage* message) {
+    if (peerOutboxCount >= PEERS_OutboxSize) return false;
+    PeerOutboxItem* item = &peerOutbox[(peerOutboxHead + peerOutboxCount) % PEERS_OutboxSize];
+    item->peer = peer;
+    item->attempts = 0;
+    item->message = *message;
+    peerOutboxCount++;
+    return true;
+}
+
+void peerMessage(PeerMessage* message, uint8_t type, uint8_t index, uint8_t index2, uint8_t value, uint8_t count) {
+    message->magic = PEERS_Magic;
+    message->type = type;
+    message->seq = ++peerSeq;
+    message->index = index;
+    message->index2 = index2;
+    message->value = value;
+    message->count = count;
+}
+
+// Same message (and message number) to every peer
+bool peerQueueAll(uint8_t type, uint8_t index, uint8_t index2, uint8_t value, uint8_t count) {
+    if (peersConfig.count == 0) return false;
+    if (peerOutboxCount + peersConfig.count > PEERS_OutboxSize) return false;
+    PeerMessage message;
+    peerMessage(&message, type, index, index2, value, count);
+    for (int i = 0; i < peersConfig.count; i++) peerQueue(i, &message);
+    return true;
+}
+
+bool peerSendButton(byte button, byte button2, byte event, byte count) {
+    return peerQueueAll(peerButton, button, button2, event, count);
+}
+
+bool peerSendRelay(byte relay, byte command) {
+    return peerQueueAll(peerRelay, relay, 0, command, 0);
+}
+
+bool peerSendRelayState(byte relay, bool state) {
+    return peerQueueAll(peerRelayState, relay, 0, state ? 1 : 0, 0);
+}
+
+void peerOutboxNext() {
+    peerOutboxHead = (peerOutboxHead + 1) % PEERS_OutboxSize;
+    peerOutboxCount--;
+    peerInFlight = false;
+}
+
+// One message in flight: next one is sent when radio reports result of previous
+void peerSendLoop(unsigned long t) {
+    if (peerInFlight) {
+        uint8_t result = peerSendResult;
+        if ((result == 0) && !timedOut(t, peerSentOn, PEERS_SendTimeout)) return;
+        PeerOutboxItem* item = &peerOutbox[peerOutboxHead];
+        if ((result == 1) || (item->peer == PEERS_Broadcast) || (item->attempts > PEERS_Retries)) {
+            peerOutboxNext();
+        } else {
+            peerInFlight = false;
+        }
+    }
+    if (peerOutboxCount == 0) return;
+
+    PeerOutboxItem* item = &peerOutbox[peerOutboxHead];
+    const uint8_t* mac = (item->peer == PEERS_Broadcast) ? peerBroadcastMac : peersConfig.macs[item->peer];
+    item->attempts++;
+    peerSendResult = 0;
+    peerSentOn = t;
+    peerInFlight = peerRadio->send(mac, (const uint8_t*)&item->message, sizeof(PeerMessage));
+    if (!peerInFlight && (item->attempts > PEERS_Retries)) peerOutboxNext();
+}
+#pragma endregion
+
+#pragma region Receiving
+void peerRegisterHandler(PEER_HANDLER) {
+    if (peerHandlersCount >= PEERS_HandlersSize) return;
+    peerHandlers[peerHandlersCount++].handler = handler;
+}
+
+void peerHandle(const uint8_t* mac, PeerMessage* message) {
+    if (message->type == peerPairBeacon) {
+        if (peerPairing != 0) peerAdd(mac);
+        return;
+    }
+    // Messages from not paired devices are ignored
+    int index = peerIndex(mac);
+    if (index < 0) return;
+    if (peerLastSeqValid[index] && (peerLastSeq[index] == message->seq)) return;
+    peerLastSeq[index] = message->seq;
+    peerLastSeqValid[index] = true;
+
+#ifdef Debug
+    aePrintf("Peers: #%d type %d index %d/%d value %d count %d\r\n", index, message->type, message->index, message->index2, message->value, message->count);
+#endif
+    for (int i = 0; i < peerHandlersCount; i++) {
+        if (peerHandlers[i].handler(mac, message)) return;
+    }
+}
+#pragma endregion
+
+#pragma region MQTT support
+void peersMqttPublish() {
+    char s[PEERS_Max * 13 + 1];
+    s[0] = 0;
+    for (int i = 0; i < peersConfig.count; i++) {
+        uint8_t* m = peersConfig.macs[i];
+        sprintf(s + strlen(s), "%s%02X%02X%02X%02X%02X%02X", (i > 0) ? "," : "", m[0], m[1], m[2], m[3], m[4], m[5]);
+    }
+    peerReported = mqttPublish(TOPIC_Peers, s, true);
+}
+
+void peersMqttConnect() {
+    mqttSubscribeTopic(TOPIC_PeersPair);
+    mqttSubscribeTopic(TOPIC_PeersClear);
+    peerReported = false;
+}
+
+bool peersMqttCallback(char* topic, byte* payload, unsigned int length) {
+    if (mqttIsTopic(topic, TOPIC_PeersPair)) {
+        peerPair();
+        return true;
+    }
+    if (mqttIsTopic(topic, TOPIC_PeersClear)) {
+        peerClear();
+        return true;
+    }
+    return false;
+}
+#pragma endregion
+
+#pragma region Loop, Init
+void peersLoop() {
+    unsigned long t = millis();
+    if (!peerStarted) {
+        // No ESP-NOW on this platform and no radio installed by peerSetRadio()
+        if (peerRadio == NULL) return;
+        if ((peerStartAttempted != 0) && !timedOut(t, peerStartAttempted, PEERS_PairInterval)) return;
+        peerStartAttempted = t;
+        if (!peerRadio->begin()) return;
+        for (int i = 0; i < peersConfig.count; i++) peerRadio->addPeer(peersConfig.macs[i]);
+        peerStarted = true;
+        aePrintf("Peers: Started, %d peers\r\n", peersConfig.count);
+    }
+
+    while (peerInboxTail != peerInboxHead) {
+        PeerInboxItem item = peerInbox[peerInboxTail];
+        peerInboxTail = (peerInboxTail + 1) % PEERS_InboxSize;
+        peerHandle(item.mac, &item.message);
+    }
+
+    if (peerPairing != 0) {
+        if (timedOut(t, peerPairing, PEERS_PairTimeout)) {
+            peerPairing = 0;
+            aePrintf("Peers: Pairing finished, %d peers\r\n", peersConfig.count);
+        } else if ((peerBeaconSentOn == 0) || timedOut(t, peerBeaconSentOn, PEERS_PairInterval)) {
+            peerBeaconSentOn = t;
+            PeerMessage message;
+            peerMessage(&message, peerPairBeacon, 0, 0, 0, 0);
+            peerQueue(PEERS_Broadcast, &message);
+        }
+    }
+
+    peerSendLoop(t);
+
+    if (!peerReported && mqttConnected()) peersMqttPublish();
+}
+
+void peerSetRadio(PeerRadio* radio) {
+    peerRadio = radio;
+}
+
+void peerInit() {
+    storageRegisterBlock(PEERS_StorageId, &peersConfig, sizeof(peersConfig));
+    if (peersConfig.count > PEERS_Max) peerClear();
+#if defined(ESP8266) || defined(ESP32)
+    if (peerRadio == NULL) peerRadio = &peerEspNow;
+#endif
+    // Message numbers start from random value: receivers still remember the last one sent before restart
+#ifdef ESP8266
+    peerSeq = ESP.random();
+#elif defined(ESP32)
+    peerSeq = esp_random();
+#endif
+    mqttRegisterCallbacks(peersMqttCallback, peersMqttConnect);
+    aeRegisterLoop(peersLoop);
+}
+#pragma endregion
@@ -0,0 +1,66 @@
+#ifndef peers_h
+#define peers_h
+
+#define PEERS_StorageId 'P'
+
+// Device-to-device events over ESP-NOW. Events are sent to all paired peers
+enum PeerMessageType {
+    peerPairBeacon = 1, // Pairing beacon (broadcast while pairing mode is on)
+    peerButton = 2,     // Button event: index (and index2 for two buttons pressed together), value = PeerButtonEvent, count = clicks
+    peerRelay = 3,      // Relay command: index = relay number, value = PEER_Off / PEER_On / PEER_Toggle
+    peerRelayState = 4  // Relay state notification: index = relay number, value = 0 / 1
+};
+
+enum PeerButtonEvent {
+    peerPressed = 1,
+    peerLongPressed = 2,
+    peerVeryLongPressed = 3,
+    peerHoldStart = 4,
+    peerHoldEnd = 5         // count = repeat ticks
+};
+
+#define PEER_Off 0
+#define PEER_On 1
+#define PEER_Toggle 2
+
+struct PeerMessage {
+    uint8_t magic;
+    uint8_t type;
+    // Sender's message number: duplicates caused by lost acknowledges are dropped
+    uint16_t seq;
+    uint8_t index;
+    uint8_t index2;
+    uint8_t value;
+    uint8_t count;
+};
+
+#define PEER_HANDLER std::function<bool(const uint8_t* mac, const PeerMessage* message)> handler
+
+// Radio used by Peers module. ESP-NOW is used by default; another radio (e.g. simulated one to test
+// peers logic on host) may be installed by peerSetRadio() before peerInit()
+struct PeerRadio {
+    bool (*begin)();
+    bool (*addPeer)(const uint8_t* mac);
+    bool (*send)(const uint8_t* mac, const uint8_t* data, uint8_t length);
+};
+void peerSetRadio(PeerRadio* radio);
+// Radio callbacks, may be called from WiFi task context
+void peerReceived(const uint8_t* mac, const uint8_t* data, uint8_t length);
+void peerSent(const uint8_t* mac, bool delivered);
+
+// Add peer by MAC address (saved in EEPROM)
+bool peerAdd(const uint8_t* mac);
+// Pairing mode for PEERS_PairTimeout: devices in pairing mode at the same time add each other
+void peerPair();
+void peerClear();
+int peerCount();
+
+bool peerSendButton(byte button, byte button2, byte event, byte count);
+bool peerSendRelay(byte relay, byte command);
+bool peerSendRelayState(byte relay, bool state);
+
+// Handlers are called in registration order until one returns true
+void peerRegisterHandler(PEER_HANDLER);
+
+void peerInit();
+#endif
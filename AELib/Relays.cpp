@@ -3,12 +3,16 @@
 #include "AELib.h"
 #include "Comms.h"
 #include "Relays.h"
+#include "Expander.h"
+#include "Peers.h"
 
 // Turn on debug output
 //#define Debug
 
 // Maximum number of relays supported
-#define RelaysSize 8
+#ifndef RelaysSize
+#define RelaysSize 16
+#endif
 
 // first %s is relay name
 #define TOPIC_State "Relay%s/State"
@@ -17,7 +21,19 @@
 
 //Mininum relay switch timeout
 #define TriggerDelay ((unsigned long)(300))
-#define LoopDelay ((unsigned long)75)
+
+// Inrush current budget shared by all relays: relays switched on within their settle time hold their
+// weight, pending relay is switched on if its weight fits. Relay heavier than the budget is switched alone
+#ifndef RELAYS_InrushBudget
+#define RELAYS_InrushBudget 4
+#endif
+// Defaults for relays without relayInrush() call
+#ifndef RELAYS_InrushWeight
+#define RELAYS_InrushWeight 1
+#endif
+#ifndef RELAYS_SettleTime
+#define RELAYS_SettleTime ((unsigned long)75)
+#endif
 
 // Normal relay
 // LOW == OFF
@@ -30,6 +46,10 @@ struct Relay {
 
     unsigned long triggeredOn;
     int reportedState;
+
+    byte weight; // Inrush current weight
+    unsigned long settle; // Inrush current lasts this long after switching on, ms
+    bool inrush; // Last switched on (not off)
 };
 
 byte relayCount = 0;
@@ -57,6 +77,10 @@ Relay* relayFind(byte pin) {
     return NULL;
 }
 
+int relayPin(byte relay) {
+    return ((relay >= 1) && (relay <= relayCount)) ? relays[relay - 1].pin : -1;
+}
+
 bool relayState(byte pin) {
     Relay* relay = relayFind(pin);
     return ((relay != NULL) && relay->state);
@@ -75,19 +99,28 @@ bool relaySwitch(byte pin) {
 
 void relayRegister(byte pin, bool inverted, bool state) {
     if (relayCount < RelaysSize) {
-        pinMode(pin, OUTPUT);
-        digitalWrite( pin, state != inverted ? HIGH : LOW);
+        expDigitalWrite(pin, state != inverted ? HIGH : LOW);
+        expPinMode(pin, OUTPUT);
 
         relays[relayCount].pin = pin;
         relays[relayCount].inverted = inverted;
         relays[relayCount].reportedState = -1;
         relays[relayCount].state = state;
+        relays[relayCount].weight = RELAYS_InrushWeight;
+        relays[relayCount].settle = RELAYS_SettleTime;
+        relays[relayCount].inrush = false;
         relayCount++;
     }
 }
 void relayRegister(byte pin, bool inverted) {
     relayRegister(pin, inverted, false);
 }
+void relayInrush(byte pin, byte weight, unsigned long settle) {
+    Relay* relay = relayFind(pin);
+    if (relay == NULL) return;
+    relay->weight = weight;
+    relay->settle = settle;
+}
 //**************************************************************************
 //                         MQTT support functions
 //**************************************************************************
@@ -131,35 +164,42 @@ bool relaysMQTTCallback(char* topic, byte* payload, unsigned int length) {
 //                            Relays engine
 //**************************************************************************
 
-bool relayLoop(Relay* relay) {
-    unsigned long t = millis();
+// Switch relay if its state was changed and it fits inrush budget, "load" is weight of relays still settling
+bool relayLoop(Relay* relay, unsigned long t, int* load) {
+    if ((unsigned long)(t - relay->triggeredOn) <= TriggerDelay) return false;
 
-    if ((unsigned long)(t - relay->triggeredOn) > TriggerDelay) {
-        bool currentState = (digitalRead(relay->pin) == HIGH);
-        if (relay->inverted) currentState = !currentState;
+    bool currentState = (expDigitalRead(relay->pin) == HIGH);
+    if (relay->inverted) currentState = !currentState;
+    if (relay->state == currentState) return false;
 
-        if (relay->state != currentState) {
-            bool s = relay->state;
-            if (relay->inverted) s = !s;
-            digitalWrite(relay->pin, s ? HIGH : LOW);
-            relay->triggeredOn = t;
-            return true;
-        }
+    // Switching off draws no inrush current
+    if (relay->state) {
+        if ((*load > 0) && (*load + relay->weight > RELAYS_InrushBudget)) return false;
+        *load += relay->weight;
     }
-    return false;
+    bool s = relay->state;
+    if (relay->inverted) s = !s;
+    expDigitalWrite(relay->pin, s ? HIGH : LOW);
+    relay->triggeredOn = t;
+    relay->inrush = relay->state;
+    // Paired devices (e.g. wall switches) may reflect relay state
+    peerSendRelayState(relay - relays + 1, relay->state);
+    return true;
 }
 
-unsigned long lastCheck = 0;
-
 void relaysLoop() {
     unsigned long t = millis();
-    if ((unsigned long)(t - lastCheck) < LoopDelay) return;
-    lastCheck = t;
-
+    int load = 0;
+    for (int i = 0; i < relayCount; i++) {
+        Relay* relay = &relays[i];
+        if (relay->inrush && ((unsigned long)(t - relay->triggeredOn) < relay->settle)) load += relay->weight;
+    }
+    // Pending relays are switched in registration order; ones not fitting the budget wait for the next pass
     for (int i = 0; i < relayCount; i++) {
-        // Switch one relay per loop iteration to spread inrush currents over time:
-        if (relayLoop(&relays[i])) break;
+        relayLoop(&relays[i], t, &load);
     }
+    // Expander relays switched in this pass share one port write
+    expFlush();
 
     if (relayEnableMQTT && mqttConnected()) {
         for (int i = 0; i < relayCount; i++) {
@@ -174,11 +214,27 @@ void relaysLoop() {
     }
 }
 
+//**************************************************************************
+//                    Commands from paired devices (ESP-NOW)
+//**************************************************************************
+
+bool relaysPeerHandler(const uint8_t* mac, const PeerMessage* message) {
+    if ((message->type != peerRelay) || (message->index < 1) || (message->index > relayCount)) return false;
+    Relay* relay = &relays[message->index - 1];
+    if (message->value == PEER_Toggle) {
+        relaySwitch(relay->pin);
+    } else {
+        relaySetState(relay->pin, message->value == PEER_On);
+    }
+    return true;
+}
+
 void relayInit(bool enableMQTT) {
     relayEnableMQTT = enableMQTT;
     if (relayEnableMQTT) {
         mqttRegisterCallbacks(relaysMQTTCallback, relaysMQTTConnect);
     }
+    peerRegisterHandler(relaysPeerHandler);
     aeRegisterLoop(relaysLoop);
 }
 
@@ -3,6 +3,10 @@
 
 void relayRegister(byte pin, bool inverted, bool state);
 void relayRegister(byte pin, bool inverted);
+// Inrush current weight of relay load and time it lasts after switching on, ms (see RELAYS_InrushBudget)
+void relayInrush(byte pin, byte weight, unsigned long settle);
+// Pin of relay number (in registration order, from 1), -1 if there is no such relay
+int relayPin(byte relay);
 bool relayState(byte pin);
 bool relaySetState(byte pin, bool state);
 bool relaySwitch(byte pin);
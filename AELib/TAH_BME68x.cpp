@@ -19,6 +19,7 @@ static char* TOPIC_HeatIndex PROGMEM = "Sensors/HeatIndex";
 static char* TOPIC_AbsHumidity PROGMEM = "Sensors/AbsHumidity";
 static char* TOPIC_Pressure PROGMEM = "Sensors/Pressure";
 static char* TOPIC_IAQ PROGMEM = "Sensors/IAQ";
+static char* TOPIC_TAHState PROGMEM = "State/TAH";
 
 #define ValidityTimeout ((unsigned long)(30*1000))
 
@@ -106,45 +107,70 @@ void tahPublishStatus() {
 	}
 
 	int valid = tahAvailable() ? 1 : 0;
-	if (valid != _valid) {
-		if (mqttPublish(TOPIC_TAHValid, valid, true)) _valid = valid;
-	}
-	if (valid == 0) return;
-
-	char b[31];
-	bool hindex = false;
+	bool validChanged = (valid != _valid);
+	bool temperatureChanged = false;
+	bool humidityChanged = false;
+	bool pressureChanged = false;
+	bool iaqChanged = false;
 	float delta;
+	_valid = valid;
 
-	delta = tahTemperature - _temperature;  if (delta < 0) delta = -delta;
+	if (valid) {
+		delta = tahTemperature - _temperature;  if (delta < 0) delta = -delta;
+		if (delta > 0.2) {
+			temperatureChanged = true;
+			_temperature = tahTemperature;
+		}
 
-	if (delta > 0.2) {
-		hindex = true;
-		dtostrf(((float)((int)(tahTemperature * 5))) / 5.0, 0, 1, b);
-		if (mqttPublish(TOPIC_Temperature, b, true)) _temperature = tahTemperature;
-	}
+		delta = tahHumidity - _humidity;  if (delta < 0) delta = -delta;
+		if (delta > 1.4) {
+			humidityChanged = true;
+			_humidity = tahHumidity;
+		}
 
-	delta = tahHumidity - _humidity;  if (delta < 0) delta = -delta;
-	if (delta > 1.4) {
-		hindex = true;
-		if (mqttPublish(TOPIC_Humidity, (int)tahHumidity, true)) _humidity = tahHumidity;
-	}
+		delta = tahPressure - _pressure;  if (delta < 0) delta = -delta;
+		if (delta > 1.4) {
+			pressureChanged = true;
+			_pressure = tahPressure;
+		}
 
-	delta = tahPressure - _pressure;  if (delta < 0) delta = -delta;
-	if (delta > 1.4) {
-		if (mqttPublish(TOPIC_Pressure, (int)tahPressure, true)) _pressure = tahPressure;
+		delta = tahIAQ - _iaq;  if (delta < 0) delta = -delta;
+		if (delta > 3) {
+			iaqChanged = true;
+			_iaq = tahIAQ;
+		}
 	}
 
-	delta = tahIAQ - _iaq;  if (delta < 0) delta = -delta;
-	if (delta > 3) {
-		if (mqttPublish(TOPIC_IAQ, (round(tahIAQ/5))*5.0, true)) _iaq = tahIAQ;
+#if (MQTT_StateFormat & MQTT_StateTopics)
+	if (validChanged) mqttPublish(TOPIC_TAHValid, valid, true);
+	if (temperatureChanged) {
+		mqttPublish(TOPIC_Temperature, ((float)((int)(tahTemperature * 5))) / 5.0, 1, true);
+	}
+	if (humidityChanged) mqttPublish(TOPIC_Humidity, (int)tahHumidity, true);
+	if (pressureChanged) mqttPublish(TOPIC_Pressure, (int)tahPressure, true);
+	if (iaqChanged) mqttPublish(TOPIC_IAQ, (round(tahIAQ/5))*5.0, true);
+	if (temperatureChanged || humidityChanged) {
+		mqttPublish(TOPIC_HeatIndex, ((float)((int)(tahHeatIndex() * 2))) / 2.0, 1, true);
+		mqttPublish(TOPIC_AbsHumidity, ((float)((int)(tahAbsHumidity() * 2))) / 2.0, 1, true);
 	}
+#endif
 
-	if (hindex) {
-		dtostrf(((float)((int)(tahHeatIndex() * 2))) / 2.0, 0, 1, b);
-		mqttPublish(TOPIC_HeatIndex, b, true);
-		dtostrf(((float)((int)(tahAbsHumidity() * 2))) / 2.0, 0, 1, b);
-		mqttPublish(TOPIC_AbsHumidity, b, true);
+#if (MQTT_StateFormat & MQTT_StateJson)
+	if (validChanged || temperatureChanged || humidityChanged || pressureChanged || iaqChanged) {
+		MqttState state;
+		mqttStateBegin(&state);
+		mqttStateAdd(&state, "Valid", (long)valid);
+		if (valid) {
+			mqttStateAdd(&state, "Temperature", ((float)((int)(tahTemperature * 5))) / (float)5.0, 1);
+			mqttStateAdd(&state, "Humidity", (long)tahHumidity);
+			mqttStateAdd(&state, "HeatIndex", ((float)((int)(tahHeatIndex() * 2))) / (float)2.0, 1);
+			mqttStateAdd(&state, "AbsHumidity", ((float)((int)(tahAbsHumidity() * 2))) / (float)2.0, 1);
+			mqttStateAdd(&state, "Pressure", (long)tahPressure);
+			mqttStateAdd(&state, "IAQ", (long)(round(tahIAQ / 5) * 5));
+		}
+		mqttPublishState(TOPIC_TAHState, &state, true);
 	}
+#endif
 }
 
 void tahLoop() {
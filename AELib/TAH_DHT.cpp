@@ -16,6 +16,7 @@ static char* TOPIC_Temperature PROGMEM = "Sensors/Temperature";
 static char* TOPIC_Humidity PROGMEM = "Sensors/Humidity";
 static char* TOPIC_AbsHumidity PROGMEM = "Sensors/AbsHumidity";
 static char* TOPIC_HeatIndex PROGMEM = "Sensors/HeatIndex";
+static char* TOPIC_TAHState PROGMEM = "State/TAH";
 
 #define DetectionTimeout ((unsigned long)(15*1000))
 #define ValidityTimeout ((unsigned long)(30*1000))
@@ -60,38 +61,56 @@ int tahGetVOC() {
 void publishStatus() {
   if( !mqttConnected() ) return;
   static int _valid = -1;
+  static float _temperature = -1000;
+  static float _humidity = -1000;
   int valid = ((unsigned long)(millis() - tahUpdatedOn) < ValidityTimeout ) ? 1 : 0;
-  if( valid != _valid ) {
-    if( mqttPublish( TOPIC_TAHValid, valid, true ) ) _valid = valid;
-  }
-  if( valid==0 ) return;
-  
-  char b[31];
-  bool hindex = false;
+  bool validChanged = ( valid != _valid );
+  bool temperatureChanged = false;
+  bool humidityChanged = false;
   float delta;
-  
-  static float _temperature = -1000;
-  delta = tahTemperature - _temperature;  if(delta<0) delta = -delta;
-  if( delta > TemperatureAccuracy ){
-    hindex = true;
-    dtostrf( tahTemperature, 0, 1, b );
-    if( mqttPublish( TOPIC_Temperature, b, true ) ) _temperature = tahTemperature;
+  _valid = valid;
+
+  if( valid ) {
+    delta = tahTemperature - _temperature;  if(delta<0) delta = -delta;
+    if( delta > TemperatureAccuracy ){
+      temperatureChanged = true;
+      _temperature = tahTemperature;
+    }
+
+    delta = tahHumidity - _humidity;  if(delta<0) delta = -delta;
+    if( delta > HumidityAccuracy ){
+      humidityChanged = true;
+      _humidity = tahHumidity;
+    }
   }
 
-  static float _humidity = -1000;
-  delta = tahHumidity - _humidity;  if(delta<0) delta = -delta;
-  if( delta > HumidityAccuracy ){
-    hindex = true;
-    if( mqttPublish( TOPIC_Humidity, (int)tahHumidity, true ) ) _humidity = tahHumidity;
+#if (MQTT_StateFormat & MQTT_StateTopics)
+  if( validChanged ) mqttPublish( TOPIC_TAHValid, valid, true );
+  if( temperatureChanged ) {
+    mqttPublish( TOPIC_Temperature, tahTemperature, 1, true );
   }
-  
-  if( hindex ) {
-    dtostrf( tahGetHeatIndex(), 0, 1, b );
-    mqttPublish( TOPIC_HeatIndex, b, true );
+  if( humidityChanged ) mqttPublish( TOPIC_Humidity, (int)tahHumidity, true );
+  if( temperatureChanged || humidityChanged ) {
+    mqttPublish( TOPIC_HeatIndex, tahGetHeatIndex(), 1, true );
     float absHumidity = tahGetAbsHumidity();
-    dtostrf( ((float)((int)(absHumidity*5)))/5.0, 0, 1, b );
-    mqttPublish( TOPIC_AbsHumidity, b, true );
+    mqttPublish( TOPIC_AbsHumidity, ((float)((int)(absHumidity*5)))/5.0, 1, true );
+  }
+#endif
+
+#if (MQTT_StateFormat & MQTT_StateJson)
+  if( validChanged || temperatureChanged || humidityChanged ) {
+    MqttState state;
+    mqttStateBegin( &state );
+    mqttStateAdd( &state, "Valid", (long)valid );
+    if( valid ) {
+      mqttStateAdd( &state, "Temperature", tahTemperature, 1 );
+      mqttStateAdd( &state, "Humidity", (long)tahHumidity );
+      mqttStateAdd( &state, "HeatIndex", tahGetHeatIndex(), 1 );
+      mqttStateAdd( &state, "AbsHumidity", ((float)((int)(tahGetAbsHumidity()*5)))/(float)5.0, 1 );
+    }
+    mqttPublishState( TOPIC_TAHState, &state, true );
   }
+#endif
 }
 
 bool tahAvailable() {
@@ -11,6 +11,7 @@ static char* TOPIC_Temperature PROGMEM = "Sensors/Temperature";
 static char* TOPIC_Humidity PROGMEM = "Sensors/Humidity";
 static char* TOPIC_HeatIndex PROGMEM = "Sensors/HeatIndex";
 static char* TOPIC_AbsHumidity PROGMEM = "Sensors/AbsHumidity";
+static char* TOPIC_TAHState PROGMEM = "State/TAH";
 
 #define ValidityTimeout ((unsigned long)(30*1000))
 
@@ -88,40 +89,56 @@ void tahPublishStatus() {
   if( !mqttConnected() ) return;
 
   static int _valid = -1;
+  static float _temperature = -1000;
+  static float _humidity = -1000;
   int valid = tahAvailable() ? 1 : 0;
-  if( valid != _valid ) {
-    if( mqttPublish( TOPIC_TAHValid, valid, true ) ) _valid = valid;
-  }
-  if( valid==0 ) return;
-  
-  char b[31];
-  bool hindex = false;
+  bool validChanged = ( valid != _valid );
+  bool temperatureChanged = false;
+  bool humidityChanged = false;
   float delta;
+  _valid = valid;
+
+  if( valid ) {
+    delta = tahTemperature - _temperature;  if(delta<0) delta = -delta;
+    //aePrintf("t=%f, _t=%f, delta=%f\n", tahTemperature, _temperature, delta );
+    if( delta > 0.2 ){
+      temperatureChanged = true;
+      _temperature = tahTemperature;
+    }
 
-  static float _temperature = -1000;
-  delta = tahTemperature - _temperature;  if(delta<0) delta = -delta;
-
-  //aePrintf("t=%f, _t=%f, delta=%f\n", tahTemperature, _temperature, delta );
-
-  if( delta > 0.2 ){
-    hindex = true;
-    dtostrf( ((float)((int)(tahTemperature*5)))/5.0, 0, 1, b );
-    if( mqttPublish( TOPIC_Temperature, b, true ) ) _temperature = tahTemperature;
+    delta = tahHumidity - _humidity;  if(delta<0) delta = -delta;
+    if( delta > 1.4 ){
+      humidityChanged = true;
+      _humidity = tahHumidity;
+    }
   }
 
-  static float _humidity = -1000;
-  delta = tahHumidity - _humidity;  if(delta<0) delta = -delta;
-  if( delta > 1.4 ){
-    hindex = true;
-    if( mqttPublish( TOPIC_Humidity, (int)tahHumidity, true ) ) _humidity = tahHumidity;
+#if (MQTT_StateFormat & MQTT_StateTopics)
+  if( validChanged ) mqttPublish( TOPIC_TAHValid, valid, true );
+  if( temperatureChanged ) {
+    mqttPublish( TOPIC_Temperature, ((float)((int)(tahTemperature*5)))/5.0, 1, true );
   }
-  
-  if( hindex ) {
-    dtostrf( ((float)((int)(tahHeatIndex()*2)))/2.0, 0, 1, b );
-    mqttPublish( TOPIC_HeatIndex, b, true );
-    dtostrf( ((float)((int)(tahAbsHumidity()*2)))/2.0, 0, 1, b );
-    mqttPublish( TOPIC_AbsHumidity, b, true );
+  if( humidityChanged ) mqttPublish( TOPIC_Humidity, (int)tahHumidity, true );
+  if( temperatureChanged || humidityChanged ) {
+    mqttPublish( TOPIC_HeatIndex, ((float)((int)(tahHeatIndex()*2)))/2.0, 1, true );
+    mqttPublish( TOPIC_AbsHumidity, ((float)((int)(tahAbsHumidity()*2)))/2.0, 1, true );
+  }
+#endif
+
+#if (MQTT_StateFormat & MQTT_StateJson)
+  if( validChanged || temperatureChanged || humidityChanged ) {
+    MqttState state;
+    mqttStateBegin( &state );
+    mqttStateAdd( &state, "Valid", (long)valid );
+    if( valid ) {
+      mqttStateAdd( &state, "Temperature", ((float)((int)(tahTemperature*5)))/(float)5.0, 1 );
+      mqttStateAdd( &state, "Humidity", (long)tahHumidity );
+      mqttStateAdd( &state, "HeatIndex", ((float)((int)(tahHeatIndex()*2)))/(float)2.0, 1 );
+      mqttStateAdd( &state, "AbsHumidity", ((float)((int)(tahAbsHumidity()*2)))/(float)2.0, 1 );
+    }
+    mqttPublishState( TOPIC_TAHState, &state, true );
   }
+#endif
 }
 
 void tahLoop() {
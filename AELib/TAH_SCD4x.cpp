@@ -16,6 +16,7 @@ static char* TOPIC_Humidity PROGMEM = "Sensors/Humidity";
 static char* TOPIC_HeatIndex PROGMEM = "Sensors/HeatIndex";
 static char* TOPIC_AbsHumidity PROGMEM = "Sensors/AbsHumidity";
 static char* TOPIC_CO2 PROGMEM = "Sensors/CO2";
+static char* TOPIC_TAHState PROGMEM = "State/TAH";
 
 #define ValidityTimeout ((unsigned long)(30*1000))
 
@@ -103,39 +104,60 @@ void tahPublishStatus() {
 	}
 
 	int valid = tahAvailable() ? 1 : 0;
-	if (valid != _valid) {
-		if (mqttPublish(TOPIC_TAHValid, valid, true)) _valid = valid;
-	}
-	if (valid == 0) return;
-
-	char b[31];
-	bool hindex = false;
+	bool validChanged = (valid != _valid);
+	bool temperatureChanged = false;
+	bool humidityChanged = false;
+	bool co2Changed = false;
 	float delta;
+	_valid = valid;
 
-	delta = tahTemperature - _temperature;  if (delta < 0) delta = -delta;
+	if (valid) {
+		delta = tahTemperature - _temperature;  if (delta < 0) delta = -delta;
+		if (delta > 0.2) {
+			temperatureChanged = true;
+			_temperature = tahTemperature;
+		}
 
-	if (delta > 0.2) {
-		hindex = true;
-		dtostrf(((float)((int)(tahTemperature * 5))) / 5.0, 0, 1, b);
-		if (mqttPublish(TOPIC_Temperature, b, true)) _temperature = tahTemperature;
-	}
+		delta = tahHumidity - _humidity;  if (delta < 0) delta = -delta;
+		if (delta > 1.4) {
+			humidityChanged = true;
+			_humidity = tahHumidity;
+		}
 
-	delta = tahHumidity - _humidity;  if (delta < 0) delta = -delta;
-	if (delta > 1.4) {
-		hindex = true;
-		if (mqttPublish(TOPIC_Humidity, (int)tahHumidity, true)) _humidity = tahHumidity;
+		if (abs(tahCO2 - _co2) > 10) {
+			co2Changed = true;
+			_co2 = tahCO2;
+		}
 	}
 
-	if ((abs(tahCO2 - _co2) > 10) && mqttPublish(TOPIC_CO2, (int)tahCO2, true)) {
-		_co2 = tahCO2;
+#if (MQTT_StateFormat & MQTT_StateTopics)
+	if (validChanged) mqttPublish(TOPIC_TAHValid, valid, true);
+	if (temperatureChanged) {
+		mqttPublish(TOPIC_Temperature, ((float)((int)(tahTemperature * 5))) / 5.0, 1, true);
+	}
+	if (humidityChanged) mqttPublish(TOPIC_Humidity, (int)tahHumidity, true);
+	if (co2Changed) mqttPublish(TOPIC_CO2, (int)tahCO2, true);
+	if (temperatureChanged || humidityChanged) {
+		mqttPublish(TOPIC_HeatIndex, ((float)((int)(tahHeatIndex() * 2))) / 2.0, 1, true);
+		mqttPublish(TOPIC_AbsHumidity, ((float)((int)(tahAbsHumidity() * 2))) / 2.0, 1, true);
 	}
+#endif
 
-	if (hindex) {
-		dtostrf(((float)((int)(tahHeatIndex() * 2))) / 2.0, 0, 1, b);
-		mqttPublish(TOPIC_HeatIndex, b, true);
-		dtostrf(((float)((int)(tahAbsHumidity() * 2))) / 2.0, 0, 1, b);
-		mqttPublish(TOPIC_AbsHumidity, b, true);
+#if (MQTT_StateFormat & MQTT_StateJson)
+	if (validChanged || temperatureChanged || humidityChanged || co2Changed) {
+		MqttState state;
+		mqttStateBegin(&state);
+		mqttStateAdd(&state, "Valid", (long)valid);
+		if (valid) {
+			mqttStateAdd(&state, "Temperature", ((float)((int)(tahTemperature * 5))) / (float)5.0, 1);
+			mqttStateAdd(&state, "Humidity", (long)tahHumidity);
+			mqttStateAdd(&state, "HeatIndex", ((float)((int)(tahHeatIndex() * 2))) / (float)2.0, 1);
+			mqttStateAdd(&state, "AbsHumidity", ((float)((int)(tahAbsHumidity() * 2))) / (float)2.0, 1);
+			mqttStateAdd(&state, "CO2", (long)tahCO2);
+		}
+		mqttPublishState(TOPIC_TAHState, &state, true);
 	}
+#endif
 }
 
 bool tahIsError(int16_t resultCode, char* operation, bool errorsOnly = false) {
@@ -0,0 +1,289 @@
+#!/usr/bin/env python3
+"""AELib CBOR payload decoder / bridge.
+
+Devices configured with MQTT_PayloadFormat=MQTT_PayloadCbor (or "SetPayloadFormat" = "cbor")
+publish numeric values and State/<Module> documents CBOR encoded. Every device announces its
+format in the retained "<root>PayloadFormat" topic ("text" / "cbor").
+
+Modes:
+  bridge  subscribe to broker, decode CBOR payloads and print them as JSON lines
+          or republish them as text under another prefix (--out)
+  decode  decode hex encoded payload(s) from command line
+  bench   compare bytes on the wire and host decoding CPU time of text and CBOR payloads
+
+Examples:
+  cbor_bridge.py bridge --host 192.168.1.10 --prefix "SecondFloor/#"
+  cbor_bridge.py bridge --host 192.168.1.10 --out "decoded/"
+  cbor_bridge.py decode a2 6556616c6964 01
+  cbor_bridge.py bench
+
+Bridge mode requires paho-mqtt (pip install paho-mqtt), other modes have no dependencies.
+"""
+
+import argparse
+import json
+import math
+import struct
+import sys
+import timeit
+
+# Topics which are always published as text
+TEXT_TOPICS = {"Online", "DeviceInfo", "Activity", "Stats", "Connection", "PayloadFormat"}
+
+
+class CborError(ValueError):
+    pass
+
+
+def cbor_decode(data):
+    """Decode single CBOR item, whole buffer must be consumed."""
+    value, offset = _decode(bytes(data), 0)
+    if offset != len(data):
+        raise CborError("trailing bytes")
+    return value
+
+
+def _argument(data, offset, info):
+    if info < 24:
+        return info, offset
+    sizes = {24: 1, 25: 2, 26: 4, 27: 8}
+    if info not in sizes:
+        raise CborError("unsupported argument")
+    size = sizes[info]
+    if offset + size > len(data):
+        raise CborError("truncated")
+    return int.from_bytes(data[offset:offset + size], "big"), offset + size
+
+
+def _decode(data, offset):
+    if offset >= len(data):
+        raise CborError("truncated")
+    head = data[offset]
+    offset += 1
+    major, info = head >> 5, head & 0x1F
+
+    if major == 7:
+        if info == 20:
+            return False, offset
+        if info == 21:
+            return True, offset
+        if info in (22, 23):
+            return None, offset
+        formats = {25: (">e", 2), 26: (">f", 4), 27: (">d", 8)}
+        if info not in formats:
+            raise CborError("unsupported simple value")
+        fmt, size = formats[info]
+        if offset + size > len(data):
+            raise CborError("truncated")
+        return struct.unpack(fmt, data[offset:offset + size])[0], offset + size
+
+    value, offset = _argument(data, offset, info)
+    if major == 0:
+        return value, offset
+    if major == 1:
+        return -1 - value, offset
+    if major in (2, 3):
+        if offset + value > len(data):
+            raise CborError("truncated")
+        chunk = data[offset:offset + value]
+        return (chunk.decode("utf-8") if major == 3 else chunk.hex()), offset + value
+    if major == 4:
+        items = []
+        for _ in range(value):
+            item, offset = _decode(data, offset)
+            items.append(item)
+        return items, offset
+    if major == 5:
+        items = {}
+        for _ in range(value):
+            key, offset = _decode(data, offset)
+            item, offset = _decode(data, offset)
+            items[key] = item
+        return items, offset
+    raise CborError("unsupported major type")
+
+
+def cbor_encode(value, decimals=1):
+    """Encode value the same way AELib/Cbor.cpp does."""
+    def header(major, arg):
+        if arg < 24:
+            return bytes([major | arg])
+        if arg <= 0xFF:
+            return bytes([major | 24, arg])
+        if arg <= 0xFFFF:
+            return bytes([major | 25]) + arg.to_bytes(2, "big")
+        return bytes([major | 26]) + arg.to_bytes(4, "big")
+
+    if value is None:
+        return b"\xf6"
+    if isinstance(value, bool):
+        value = int(value)
+    if isinstance(value, int):
+        return header(0x00, value) if value >= 0 else header(0x20, -1 - value)
+    if isinstance(value, float):
+        if math.isnan(value) or math.isinf(value):
+            return b"\xf6"
+        value = round(value, decimals)
+        if decimals <= 0:
+            return cbor_encode(int(value))
+        return b"\xfa" + struct.pack(">f", value)
+    if isinstance(value, str):
+        raw = value.encode("utf-8")
+        return header(0x60, len(raw)) + raw
+    if isinstance(value, dict):
+        out = header(0xA0, len(value))
+        for key, item in value.items():
+            out += cbor_encode(key) + cbor_encode(item, decimals)
+        return out
+    raise TypeError(type(value))
+
+
+def text_encode(value, decimals=1):
+    """Encode value the same way text path of AELib does (sprintf / dtostrf / JsonWriter)."""
+    if isinstance(value, dict):
+        return json.dumps({k: (round(v, decimals) if isinstance(v, float) else v) for k, v in value.items()},
+                          separators=(",", ":")).encode()
+    if isinstance(value, float):
+        return ("%.*f" % (decimals, value)).encode()
+    return str(value).encode()
+
+
+def publish_size(topic, payload):
+    """Size of MQTT PUBLISH packet (QoS 0)."""
+    remaining = 2 + len(topic.encode()) + len(payload)
+    varint = 1 if remaining < 128 else 2 if remaining < 16384 else 3
+    return 1 + varint + remaining
+
+
+def round_floats(value):
+    # Single precision floats are printed with the precision they carry
+    if isinstance(value, float):
+        return float("%.7g" % value)
+    if isinstance(value, dict):
+        return {k: round_floats(v) for k, v in value.items()}
+    return value
+
+
+#region Bridge
+class Bridge:
+    def __init__(self, args):
+        self.args = args
+        self.formats = {}  # device root -> "text" / "cbor"
+
+    def device_root(self, topic):
+        roots = [r for r in self.formats if topic.startswith(r)]
+        return max(roots, key=len) if roots else None
+
+    def decode(self, topic, payload):
+        """Returns (value, was_cbor)."""
+        if topic.endswith("/PayloadFormat") or topic == "PayloadFormat":
+            root = topic[:-len("PayloadFormat")]
+            self.formats[root] = payload.decode("utf-8", "replace").strip().lower()
+            return self.formats[root], False
+
+        root = self.device_root(topic)
+        name = topic[len(root):] if root is not None else topic
+        if (root is not None) and (self.formats[root] == "cbor") and payload \
+                and (name not in TEXT_TOPICS) and not name.split("/")[-1].startswith("Set"):
+            # String values are published as text in CBOR mode as well:
+            # payload is CBOR only if it is decoded completely
+            try:
+                return round_floats(cbor_decode(payload)), True
+            except (CborError, UnicodeDecodeError):
+                pass
+        return payload.decode("utf-8", "replace"), False
+
+    def on_message(self, client, userdata, msg):
+        value, was_cbor = self.decode(msg.topic, msg.payload)
+        if self.args.out:
+            if not was_cbor:
+                return
+            text = json.dumps(value, separators=(",", ":")) if isinstance(value, dict) else str(value)
+            client.publish(self.args.out + msg.topic, text, retain=msg.retain)
+        else:
+            print(json.dumps({"topic": msg.topic, "cbor": was_cbor, "retained": bool(msg.retain), "value": value}))
+            sys.stdout.flush()
+
+    def run(self):
+        try:
+            import paho.mqtt.client as mqtt
+        except ImportError:
+            sys.exit("paho-mqtt is required for bridge mode: pip install paho-mqtt")
+        try:
+            client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION1)
+        except AttributeError:
+            client = mqtt.Client()
+        if self.args.user:
+            client.username_pw_set(self.args.user, self.args.password)
+        client.on_message = self.on_message
+        client.on_connect = lambda c, u, f, rc: c.subscribe(self.args.prefix)
+        client.connect(self.args.host, self.args.port)
+        client.loop_forever()
+#endregion
+
+
+#region Benchmark
+BENCH_ROOT = "SecondFloor/Bedroom/ESP_XXXXXXXXXXXX/"
+BENCH_SAMPLES = [
+    ("Sensors/Temperature", 23.5, 1),
+    ("Sensors/Humidity", 45, 0),
+    ("Sensors/Pressure", 754.6, 0),
+    ("Sensors/CO2", 1250, 0),
+    ("Relays/1/State", 1, 0),
+    ("Dimmer/Brightness", 712, 0),
+    ("State/TAH", {"Valid": 1, "Temperature": 23.5, "Humidity": 45, "HeatIndex": 24.1, "AbsHumidity": 9.6}, 1),
+    ("State/Dimmer", {"Mode": 2, "State": 1, "Brightness": 712, "Temperature": 34, "Mireds": 300,
+                      "WorkRange": "1,1023", "MiredsRange": "153,500", "Transition": 500}, 1),
+]
+
+
+def bench(args):
+    print("%-20s %10s %10s %10s %10s %12s %12s" %
+          ("Topic", "Text, B", "CBOR, B", "Text pkt", "CBOR pkt", "Text, us", "CBOR, us"))
+    total_text = total_cbor = 0
+    for name, value, decimals in BENCH_SAMPLES:
+        topic = BENCH_ROOT + name
+        text = text_encode(value, decimals)
+        cbor = cbor_encode(value, decimals)
+        assert round_floats(cbor_decode(cbor)) == round_floats(json.loads(text)), name
+        t_text = min(timeit.repeat(lambda: json.loads(text), number=args.iterations, repeat=3)) / args.iterations
+        t_cbor = min(timeit.repeat(lambda: cbor_decode(cbor), number=args.iterations, repeat=3)) / args.iterations
+        p_text, p_cbor = publish_size(topic, text), publish_size(topic, cbor)
+        total_text += p_text
+        total_cbor += p_cbor
+        print("%-20s %10d %10d %10d %10d %12.2f %12.2f" %
+              (name, len(text), len(cbor), p_text, p_cbor, t_text * 1e6, t_cbor * 1e6))
+    print("Total PUBLISH bytes: text %d, CBOR %d (%.0f%%)" % (total_text, total_cbor, 100.0 * total_cbor / total_text))
+    print("Host decoding time: text payloads use C json module, CBOR payloads this pure Python decoder")
+#endregion
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    p = sub.add_parser("bridge", help="decode messages received from broker")
+    p.add_argument("--host", default="localhost")
+    p.add_argument("--port", type=int, default=1883)
+    p.add_argument("--user")
+    p.add_argument("--password")
+    p.add_argument("--prefix", default="#", help="subscription topic filter")
+    p.add_argument("--out", help="republish decoded values under this prefix instead of printing")
+
+    p = sub.add_parser("decode", help="decode hex encoded payload")
+    p.add_argument("hex", nargs="+")
+
+    p = sub.add_parser("bench", help="compare text and CBOR payloads")
+    p.add_argument("--iterations", type=int, default=20000)
+
+    args = parser.parse_args()
+    if args.mode == "bridge":
+        Bridge(args).run()
+    elif args.mode == "decode":
+        print(json.dumps(round_floats(cbor_decode(bytes.fromhex("".join(args.hex))))))
+    else:
+        bench(args)
+
+
+if __name__ == "__main__":
+    main()
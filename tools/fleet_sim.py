@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Fleet reconnect simulation: fixed retry timeouts vs exponential backoff with jitter.
+
+Models a fleet of AELib devices losing the broker at the same moment (broker restart) and
+reconnecting to it once it is back. Compares:
+
+  fixed    previous Comms behaviour: immediate attempt after connection loss, then fixed
+           60 s pause and WiFi reconnect between attempts
+  backoff  current Comms behaviour: first attempt spread over [0, COMMS_BackoffMin),
+           then delay doubling from COMMS_BackoffMin up to COMMS_BackoffMax randomized
+           by COMMS_BackoffJitter percent; per device random generator is seeded from MAC
+           exactly as commsRandom() does
+
+Broker accepts limited number of connections per second (--capacity); connections above the
+limit are not acknowledged and fail after MQTT_ConnAckTimeout. Every accepted connection
+publishes --messages messages (Online, DeviceInfo, subscriptions, module states).
+
+Example:
+  fleet_sim.py --devices 200 --outage 45
+
+No dependencies except Python 3.
+"""
+
+import argparse
+import heapq
+import random
+
+
+def fnv_seed(mac):
+    state = 2166136261
+    for b in mac:
+        state = ((state ^ b) * 16777619) & 0xFFFFFFFF
+    return state or 1
+
+
+class Device:
+    def __init__(self, mac, args):
+        self.mac = mac
+        self.args = args
+        self.state = fnv_seed(mac)
+        self.attempt = 0
+        self.connected_at = None
+        self.attempts = 0
+
+    def random(self):
+        # xorshift32, same as commsRandom()
+        x = self.state
+        x ^= (x << 13) & 0xFFFFFFFF
+        x ^= x >> 17
+        x ^= (x << 5) & 0xFFFFFFFF
+        self.state = x
+        return x
+
+    def backoff(self):
+        # commsBackoff()
+        a = self.args
+        delay, attempt = a.backoff_min, self.attempt
+        while attempt > 0 and delay < a.backoff_max:
+            delay *= 2
+            attempt -= 1
+        delay = min(delay, a.backoff_max)
+        jitter = delay // 100 * a.jitter
+        return delay - jitter + self.random() % (jitter + 1)
+
+
+def simulate(args, policy):
+    rng = random.Random(args.seed)
+    devices = [Device(bytes([0x5C, 0xCF, 0x7F] + [rng.randrange(256) for _ in range(3)]), args)
+               for _ in range(args.devices)]
+    events = []  # (time ms, seq, device index)
+    for i, d in enumerate(devices):
+        # Broker restart closes all sockets at t=0
+        first = 0 if policy == "fixed" else d.random() % args.backoff_min
+        heapq.heappush(events, (first, i, i))
+
+    seq = len(devices)
+    accepted = {}  # second -> accepted connections
+    attempts_per_s = {}
+    messages_per_s = {}
+    while events:
+        t, _, i = heapq.heappop(events)
+        d = devices[i]
+        second = t // 1000
+        attempts_per_s[second] = attempts_per_s.get(second, 0) + 1
+        d.attempts += 1
+        if t >= args.outage * 1000 and accepted.get(second, 0) < args.capacity:
+            accepted[second] = accepted.get(second, 0) + 1
+            messages_per_s[second] = messages_per_s.get(second, 0) + args.messages
+            d.connected_at = t
+            continue
+        # Refused while broker is down, CONNACK timeout when broker is overloaded
+        failed_at = t if t < args.outage * 1000 else t + args.connack_timeout
+        if policy == "fixed":
+            delay = 60000
+        else:
+            delay = d.backoff()
+            d.attempt += 1
+        # commsReconnect(): WiFi is reconnected before next attempt
+        seq += 1
+        heapq.heappush(events, (failed_at + delay + args.wifi_time, seq, i))
+
+    done = max(d.connected_at for d in devices)
+    return {
+        "attempts": attempts_per_s,
+        "messages": messages_per_s,
+        "accepted": accepted,
+        "all_online": done / 1000.0,
+        "peak_attempts": max(attempts_per_s.values()),
+        "peak_messages": max(messages_per_s.values()),
+        "total_attempts": sum(d.attempts for d in devices),
+    }
+
+
+def histogram(result, args):
+    bucket = args.bucket
+    last = int(result["all_online"]) + 1
+    scale = max(1, max(result["attempts"].values()) * bucket // 60 + 1)
+    for start in range(0, last + 1, bucket):
+        attempts = sum(result["attempts"].get(s, 0) for s in range(start, start + bucket))
+        accepted = sum(result["accepted"].get(s, 0) for s in range(start, start + bucket))
+        if attempts == 0:
+            continue
+        print("  %4d-%-4ds attempts %5d online %5d |%s" %
+              (start, start + bucket, attempts, accepted, "#" * (attempts // scale)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--devices", type=int, default=200)
+    parser.add_argument("--outage", type=float, default=45, help="broker downtime, s")
+    parser.add_argument("--capacity", type=int, default=20, help="connections broker accepts per second")
+    parser.add_argument("--messages", type=int, default=25, help="messages published after connect")
+    parser.add_argument("--wifi-time", type=int, default=1500, help="WiFi reconnect time, ms")
+    parser.add_argument("--connack-timeout", type=int, default=5000, help="MQTT_ConnAckTimeout, ms")
+    parser.add_argument("--backoff-min", type=int, default=3000, help="COMMS_BackoffMin, ms")
+    parser.add_argument("--backoff-max", type=int, default=60000, help="COMMS_BackoffMax, ms")
+    parser.add_argument("--jitter", type=int, default=50, help="COMMS_BackoffJitter, percent")
+    parser.add_argument("--bucket", type=int, default=5, help="histogram bucket, s")
+    parser.add_argument("--seed", type=int, default=1, help="MAC addresses generator seed")
+    args = parser.parse_args()
+
+    for policy in ("fixed", "backoff"):
+        r = simulate(args, policy)
+        print("%s: all online after %.1f s, %d attempts, peak %d attempts/s, peak %d messages/s" %
+              (policy, r["all_online"], r["total_attempts"], r["peak_attempts"], r["peak_messages"]))
+        histogram(r, args)
+
+
+if __name__ == "__main__":
+    main()
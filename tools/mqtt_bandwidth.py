@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""MQTT 3.1.1 vs MQTT 5 (topic aliases) bandwidth comparison.
+
+Replays device-like telemetry (long topics, tiny numeric payloads) against a broker twice:
+as MQTT 3.1.1 client and as MQTT 5 client using topic aliases the same way AELib Mqtt5Client
+does (topic gets alias on its second publish). Bytes sent are counted at the socket level.
+A separate MQTT 5 subscriber checks every message is delivered with its full topic name,
+i.e. the broker resolved aliases correctly.
+
+Example (mosquitto allows 10 topic aliases by default, see "max_topic_alias"):
+  mosquitto -v &
+  mqtt_bandwidth.py --host localhost --rounds 100
+
+No dependencies except Python 3.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+ROOT = "SecondFloor/Bedroom/ESP_XXXXXXXXXXXX/"
+TOPICS = [
+    ("Sensors/LightLevel", "412.5"),
+    ("Sensors/LightLevelFiltered", "398.1"),
+    ("Sensors/Temperature", "23.5"),
+    ("Sensors/Humidity", "45"),
+    ("Sensors/HeatIndex", "24.1"),
+    ("Sensors/AbsHumidity", "9.6"),
+    ("Dimmer/Brightness", "712"),
+    ("Relays/1/State", "1"),
+]
+EVENT_TOPIC = ("Buttons/1/Click", "1")
+
+
+def varint(n):
+    out = b""
+    while True:
+        b = n & 0x7F
+        n >>= 7
+        out += bytes([b | 0x80 if n else b])
+        if not n:
+            return out
+
+
+def string(s):
+    s = s.encode() if isinstance(s, str) else s
+    return struct.pack(">H", len(s)) + s
+
+
+def packet(header, body):
+    return bytes([header]) + varint(len(body)) + body
+
+
+class Connection:
+    def __init__(self, host, port, version, client_id):
+        self.version = version
+        self.sock = socket.create_connection((host, port), timeout=5)
+        self.sent = 0
+        self.alias_max = 0
+        self.aliases = {}
+        self.hits = {}
+        props = (b"\x00" if version == 5 else b"")
+        if version == 5:
+            # Allow broker to send up to 0 aliases to us, maximum packet size
+            props = varint(5) + b"\x27" + struct.pack(">I", 65535)
+        body = string("MQTT") + bytes([version, 0x02]) + struct.pack(">H", 30) + props + string(client_id)
+        self.send(packet(0x10, body))
+        header, body = self.read()
+        if header >> 4 != 2 or body[1] != 0:
+            raise RuntimeError("CONNACK error %r" % body)
+        if version == 5:
+            self.parse_connack_props(body[2:])
+
+    def parse_connack_props(self, data):
+        length, i = 0, 0
+        for shift in range(4):
+            length |= (data[i] & 0x7F) << (7 * shift)
+            i += 1
+            if not data[i - 1] & 0x80:
+                break
+        props = data[i:i + length]
+        i = 0
+        sizes = {0x01: 1, 0x17: 1, 0x19: 1, 0x24: 1, 0x25: 1, 0x28: 1, 0x29: 1, 0x2A: 1,
+                 0x13: 2, 0x21: 2, 0x22: 2, 0x23: 2, 0x02: 4, 0x11: 4, 0x18: 4, 0x27: 4}
+        while i < len(props):
+            pid = props[i]
+            i += 1
+            if pid in sizes:
+                value = int.from_bytes(props[i:i + sizes[pid]], "big")
+                if pid == 0x22:
+                    self.alias_max = value
+                i += sizes[pid]
+            elif pid == 0x26:
+                i += 2 + int.from_bytes(props[i:i + 2], "big")
+                i += 2 + int.from_bytes(props[i:i + 2], "big")
+            elif pid == 0x0B:
+                while props[i] & 0x80:
+                    i += 1
+                i += 1
+            else:
+                i += 2 + int.from_bytes(props[i:i + 2], "big")
+
+    def send(self, data):
+        self.sock.sendall(data)
+        self.sent += len(data)
+
+    def read(self):
+        header = self.recv(1)[0]
+        length, shift = 0, 0
+        while True:
+            b = self.recv(1)[0]
+            length |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        return header, self.recv(length)
+
+    def recv(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise RuntimeError("connection closed")
+            data += chunk
+        return data
+
+    def alias(self, topic):
+        if topic in self.aliases:
+            return self.aliases[topic], False
+        self.hits[topic] = self.hits.get(topic, 0) + 1
+        if self.hits[topic] < 2 or len(self.aliases) >= self.alias_max:
+            return 0, False
+        self.aliases[topic] = len(self.aliases) + 1
+        return self.aliases[topic], True
+
+    def publish(self, topic, payload, retained, expiry=0):
+        payload = payload.encode()
+        if self.version == 5:
+            alias, new = self.alias(topic)
+            props = b""
+            if alias:
+                props += b"\x23" + struct.pack(">H", alias)
+            if expiry and not retained:
+                props += b"\x02" + struct.pack(">I", expiry)
+            name = string(topic) if (alias == 0 or new) else string("")
+            body = name + varint(len(props)) + props + payload
+        else:
+            body = string(topic) + payload
+        self.send(packet(0x30 | (1 if retained else 0), body))
+
+    def subscribe(self, topic_filter):
+        options = b"\x00" if self.version == 5 else b""
+        body = struct.pack(">H", 1) + options + string(topic_filter) + b"\x00"
+        self.send(packet(0x82, body))
+        header, _ = self.read()
+        if header >> 4 != 9:
+            raise RuntimeError("SUBACK expected")
+
+    def ping(self):
+        self.send(packet(0xC0, b""))
+        while True:
+            header, body = self.read()
+            if header >> 4 == 13:
+                return
+
+    def close(self):
+        self.send(packet(0xE0, b"\x00" if self.version == 5 else b""))
+        self.sock.close()
+
+
+def receive_all(sub, expected, timeout):
+    """Collect PUBLISH packets received by subscriber."""
+    received = []
+    sub.sock.settimeout(timeout)
+    try:
+        while len(received) < expected:
+            header, body = sub.read()
+            if header >> 4 != 3:
+                continue
+            n = int.from_bytes(body[:2], "big")
+            topic = body[2:2 + n].decode()
+            i = 2 + n
+            plen, shift = 0, 0
+            while True:
+                b = body[i]
+                i += 1
+                plen |= (b & 0x7F) << shift
+                shift += 7
+                if not b & 0x80:
+                    break
+            received.append((topic, body[i + plen:].decode()))
+    except socket.timeout:
+        pass
+    return received
+
+
+def run(args, version):
+    root = args.root + "v%d/" % version
+    sub = Connection(args.host, args.port, 5, "bw-sub-%d" % version)
+    sub.subscribe(root + "#")
+
+    dev = Connection(args.host, args.port, version, "bw-dev-%d" % version)
+    expected = []
+    for r in range(args.rounds):
+        for name, value in TOPICS:
+            # Retained flag is not used to avoid polluting broker with retained test topics
+            dev.publish(root + name, value, False)
+            expected.append((root + name, value))
+        if r % 10 == 0:
+            dev.publish(root + EVENT_TOPIC[0], EVENT_TOPIC[1], False, args.expiry)
+            expected.append((root + EVENT_TOPIC[0], EVENT_TOPIC[1]))
+    dev.ping()
+    sent = dev.sent
+    aliases = dev.alias_max
+    dev.close()
+
+    received = receive_all(sub, len(expected), 5)
+    sub.close()
+    ok = sorted(received) == sorted(expected)
+    return sent, len(expected), aliases, ok, len(received)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--rounds", type=int, default=100)
+    parser.add_argument("--root", default="bandwidth-test/" + ROOT)
+    parser.add_argument("--expiry", type=int, default=60, help="message expiry for events, s")
+    args = parser.parse_args()
+
+    results = {}
+    for version in (4, 5):
+        results[version] = run(args, version)
+        sent, count, aliases, ok, received = results[version]
+        print("MQTT %s: %d messages, %d bytes sent (%.1f per message), aliases allowed: %s, delivered: %d/%d %s" %
+              ("3.1.1" if version == 4 else "5", count, sent, sent / count, aliases if version == 5 else "-",
+               received, count, "OK" if ok else "MISMATCH"))
+        time.sleep(0.2)
+    print("MQTT 5 / MQTT 3.1.1 bytes: %.0f%%" % (100.0 * results[5][0] / results[4][0]))
+    if not (results[4][3] and results[5][3]):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
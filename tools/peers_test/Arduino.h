@@ -0,0 +1,22 @@
+// Minimal Arduino API to build Peers module on host, see peers_test.cpp
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <functional>
+
+typedef uint8_t byte;
+#define PROGMEM
+#define F(x) x
+
+unsigned long millis();
+
+class HostSerial {
+public:
+    template<typename... Args> int printf(const char* format, Args... args) { return ::printf(format, args...); }
+    int print(const char* s) { return ::printf("%s", s); }
+    int println(const char* s) { return ::printf("%s\n", s); }
+};
+extern HostSerial Serial;
@@ -0,0 +1,149 @@
+// Host test of Peers module logic: pairing, retries and duplicate filtering over a simulated radio.
+// Build and run from repository root:
+//   g++ -std=gnu++17 -DWIFI_SSID='"test"' -Itools/peers_test -IAELib tools/peers_test/peers_test.cpp -o peers_test && ./peers_test
+#include "Peers.cpp"
+
+#include <vector>
+
+HostSerial Serial;
+unsigned long now = 1000;
+unsigned long millis() { return now; }
+
+void storageRegisterBlock(char id, void* data, unsigned short size) { memset(data, 0, size); }
+int storageSaves = 0;
+void storageSave() { storageSaves++; }
+void aeRegisterLoop(LOOP loop) {}
+
+bool mqttConnected() { return false; }
+bool mqttPublish(char* TOPIC_Name, char* value, bool retained) { return true; }
+void mqttRegisterCallbacks(MQTT_CALLBACK, MQTT_CONNECT) {}
+void mqttSubscribeTopic(char* TOPIC_Name) {}
+bool mqttIsTopic(char* topic, char* TOPIC_Name) { return strcmp(topic, TOPIC_Name) == 0; }
+
+#pragma region Simulated radio
+// Result reported for the next frames sent, delivered if none left
+enum SimResult { simDelivered, simFailed, simSilent };
+
+struct SimFrame {
+    uint8_t mac[6];
+    PeerMessage message;
+};
+
+std::vector<SimFrame> simFrames;
+std::vector<SimResult> simResults;
+bool simStarted = false;
+int simPeersAdded = 0;
+
+bool simBegin() {
+    simStarted = true;
+    return true;
+}
+
+bool simAddPeer(const uint8_t* mac) {
+    simPeersAdded++;
+    return true;
+}
+
+// Result is reported right away, as ESP-NOW does from WiFi task before the next loop pass
+bool simSend(const uint8_t* mac, const uint8_t* data, uint8_t length) {
+    SimFrame frame;
+    memcpy(frame.mac, mac, 6);
+    memcpy(&frame.message, data, length);
+    simFrames.push_back(frame);
+    SimResult result = simDelivered;
+    if (!simResults.empty()) {
+        result = simResults.front();
+        simResults.erase(simResults.begin());
+    }
+    if (result != simSilent) peerSent(mac, result == simDelivered);
+    return true;
+}
+
+PeerRadio simRadio = { simBegin, simAddPeer, simSend };
+
+// Frame from the remote device
+void simReceive(const uint8_t* mac, uint8_t type, uint16_t seq, uint8_t index, uint8_t value) {
+    PeerMessage message = { PEERS_Magic, type, seq, index, 0, value, 1 };
+    peerReceived(mac, (const uint8_t*)&message, sizeof(message));
+}
+#pragma endregion
+
+int failures = 0;
+#define CHECK(condition) do { if (!(condition)) { printf("FAIL line %d: %s\n", __LINE__, #condition); failures++; } } while (0)
+
+int main() {
+    static const uint8_t remote[6] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+    static const uint8_t stranger[6] = { 0x02, 0x66, 0x77, 0x88, 0x99, 0xAA };
+    std::vector<PeerMessage> handled;
+    peerRegisterHandler([&handled](const uint8_t* mac, const PeerMessage* message) {
+        handled.push_back(*message);
+        return true;
+        });
+
+    // No radio on host until one is installed
+    peerInit();
+    peersLoop();
+    CHECK(!peerStarted);
+    peerSetRadio(&simRadio);
+    now += PEERS_PairInterval + 1;
+    peersLoop();
+    CHECK(peerStarted && simStarted);
+
+    // Pairing: beacons are accepted only in pairing mode, broadcast is sent once without retries
+    simReceive(remote, peerPairBeacon, 1, 0, 0);
+    peersLoop();
+    CHECK(peerCount() == 0);
+    peerPair();
+    simResults.push_back(simFailed);
+    peersLoop();
+    CHECK((simFrames.size() == 1) && (simFrames[0].message.type == peerPairBeacon) && (simFrames[0].mac[0] == 0xFF));
+    now += 10;
+    peersLoop();
+    CHECK(simFrames.size() == 1);
+    simReceive(remote, peerPairBeacon, 2, 0, 0);
+    peersLoop();
+    CHECK((peerCount() == 1) && (storageSaves == 1) && (simPeersAdded == 1));
+    now += PEERS_PairInterval + 1;
+    peersLoop();
+    CHECK(simFrames.size() == 2);
+    now += PEERS_PairTimeout;
+    peersLoop();
+    CHECK(peerPairing == 0);
+
+    // Retries: failed send and missing send result are retried with the same message number
+    simFrames.clear();
+    simResults = { simFailed, simSilent, simDelivered };
+    CHECK(peerSendRelay(1, PEER_Toggle));
+    peersLoop();
+    peersLoop();
+    CHECK(simFrames.size() == 2);
+    now += PEERS_SendTimeout + 1;
+    peersLoop();
+    peersLoop();
+    CHECK((simFrames.size() == 3) && (peerOutboxCount == 0));
+    CHECK((simFrames[0].message.seq == simFrames[2].message.seq) && (memcmp(simFrames[2].mac, remote, 6) == 0));
+
+    // Message is dropped after PEERS_Retries retries
+    simFrames.clear();
+    simResults = { simFailed, simFailed, simFailed, simFailed };
+    CHECK(peerSendButton(1, 0, peerPressed, 1));
+    for (int i = 0; i < 5; i++) peersLoop();
+    CHECK((simFrames.size() == PEERS_Retries + 1) && (peerOutboxCount == 0));
+
+    // Duplicates: the same message number is handled once, messages of not paired devices are ignored
+    simReceive(remote, peerButton, 100, 1, peerPressed);
+    simReceive(remote, peerButton, 100, 1, peerPressed);
+    simReceive(remote, peerButton, 101, 1, peerPressed);
+    simReceive(stranger, peerButton, 102, 1, peerPressed);
+    peersLoop();
+    CHECK((handled.size() == 2) && (handled[0].seq == 100) && (handled[1].seq == 101));
+
+    // Messages with wrong size or magic are dropped by radio callback
+    uint8_t garbage[4] = { PEERS_Magic, peerButton, 0, 0 };
+    peerReceived(remote, garbage, sizeof(garbage));
+    peersLoop();
+    CHECK(handled.size() == 2);
+
+    printf(failures == 0 ? "Peers: all tests passed\n" : "Peers: %d tests failed\n", failures);
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,332 @@
+#!/usr/bin/env python3
+"""MQTT over TLS handshake cost benchmark.
+
+Modes:
+  broker   measure full and resumed TLS handshakes against broker TLS listener from the host:
+           handshake time, bytes and round trips per handshake, time to CONNACK. Client behaves
+           like BearSSL on ESP8266: TLS 1.2 only, session resumption by session id (no tickets).
+           Reports whether broker resumes sessions at all: without it every device reconnect
+           costs full key exchange
+  devices  collect handshake metrics published by devices built with MQTT_TLS in "Connection"
+           topic (Tls, TlsResumed, TlsHeap, TlsStack, TlsMfln) and print them per device with
+           full / resumed summary. With --restart device is restarted via "Reset" command after
+           every report, so next report shows handshake resumed from RTC memory
+
+Minimal mosquitto TLS listener (mosquitto.conf):
+  listener 8883
+  cafile /etc/mosquitto/ca.crt
+  certfile /etc/mosquitto/server.crt
+  keyfile /etc/mosquitto/server.key
+  allow_anonymous true
+
+Examples:
+  tls_bench.py broker --host localhost --port 8883 --rounds 50
+  tls_bench.py devices --host 192.168.1.10 --port 8883 --insecure --filter "SecondFloor/#" --restart 5
+
+No dependencies except Python 3.
+"""
+
+import argparse
+import json
+import socket
+import ssl
+import statistics
+import struct
+import sys
+import time
+
+
+def varint(n):
+    out = b""
+    while True:
+        b = n & 0x7F
+        n >>= 7
+        out += bytes([b | 0x80 if n else b])
+        if not n:
+            return out
+
+
+def string(s):
+    s = s.encode() if isinstance(s, str) else s
+    return struct.pack(">H", len(s)) + s
+
+
+def packet(header, body):
+    return bytes([header]) + varint(len(body)) + body
+
+
+def tls_context(args):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    # BearSSL supports TLS 1.2 and resumes sessions by session id only
+    ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+    ctx.options |= ssl.OP_NO_TICKET
+    if args.insecure or not args.cafile:
+        ctx.check_hostname = False
+        ctx.verify_mode = ssl.CERT_NONE
+    else:
+        ctx.load_verify_locations(args.cafile)
+    return ctx
+
+
+class MqttStream:
+    """Minimal MQTT 3.1.1 client over send() / recv() of subclass."""
+
+    def read_packet(self):
+        header = self.recv(1)[0]
+        length, shift = 0, 0
+        while True:
+            b = self.recv(1)[0]
+            length |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        return header, self.recv(length)
+
+    def mqtt_connect(self, client_id):
+        body = string("MQTT") + bytes([4, 0x02]) + struct.pack(">H", 30) + string(client_id)
+        self.send(packet(0x10, body))
+        header, body = self.read_packet()
+        if header >> 4 != 2 or body[1] != 0:
+            raise RuntimeError("CONNACK error %r" % body)
+
+    def mqtt_subscribe(self, topic_filter):
+        self.send(packet(0x82, struct.pack(">H", 1) + string(topic_filter) + b"\x00"))
+
+    def mqtt_publish(self, topic, payload):
+        self.send(packet(0x30, string(topic) + payload))
+
+
+class PlainConnection(MqttStream):
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port), timeout=5)
+
+    def send(self, data):
+        self.sock.sendall(data)
+
+    def recv(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise RuntimeError("connection closed")
+            data += chunk
+        return data
+
+    def close(self):
+        self.send(packet(0xE0, b""))
+        self.sock.close()
+
+
+class TlsConnection(MqttStream):
+    """TLS over memory BIO to count bytes and round trips of the handshake."""
+
+    def __init__(self, ctx, host, port, session=None):
+        self.sock = socket.create_connection((host, port), timeout=5)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.incoming = ssl.MemoryBIO()
+        self.outgoing = ssl.MemoryBIO()
+        self.tls = ctx.wrap_bio(self.incoming, self.outgoing, server_hostname=host, session=session)
+        self.sent = 0
+        self.received = 0
+        self.round_trips = 0
+        self.buffer = b""
+
+    def flush(self):
+        data = self.outgoing.read()
+        if data:
+            self.sock.sendall(data)
+            self.sent += len(data)
+
+    def fill(self):
+        data = self.sock.recv(16384)
+        if not data:
+            raise RuntimeError("connection closed")
+        self.received += len(data)
+        self.incoming.write(data)
+
+    def handshake(self):
+        while True:
+            try:
+                self.tls.do_handshake()
+                self.flush()
+                return
+            except ssl.SSLWantReadError:
+                self.flush()
+                self.round_trips += 1
+                self.fill()
+
+    def send(self, data):
+        self.tls.write(data)
+        self.flush()
+
+    def recv(self, n):
+        while len(self.buffer) < n:
+            try:
+                self.buffer += self.tls.read(16384)
+            except ssl.SSLWantReadError:
+                self.fill()
+        data, self.buffer = self.buffer[:n], self.buffer[n:]
+        return data
+
+    def close(self):
+        try:
+            self.send(packet(0xE0, b""))
+            self.tls.unwrap()
+        except (ssl.SSLError, OSError):
+            pass
+        self.sock.close()
+
+
+#region Broker benchmark
+def measure(ctx, args, session):
+    started = time.perf_counter()
+    conn = TlsConnection(ctx, args.host, args.port, session)
+    connected = time.perf_counter()
+    conn.handshake()
+    handshake = time.perf_counter()
+    conn.mqtt_connect("tls-bench")
+    connack = time.perf_counter()
+    result = {
+        "tcp": (connected - started) * 1000,
+        "handshake": (handshake - connected) * 1000,
+        "connack": (connack - started) * 1000,
+        "sent": conn.sent,
+        "received": conn.received,
+        "round_trips": conn.round_trips,
+        "resumed": conn.tls.session_reused,
+        "cipher": conn.tls.cipher()[0],
+        "session": conn.tls.session,
+    }
+    conn.close()
+    return result
+
+
+def summary(name, results):
+    if not results:
+        print("%-8s no samples" % name)
+        return
+    hs = sorted(r["handshake"] for r in results)
+    print("%-8s %4d %9.2f %9.2f %9.2f %9.2f %7d %7d %5d" % (
+        name, len(results), statistics.median(hs), hs[int(len(hs) * 0.95) - 1 if len(hs) > 1 else 0],
+        statistics.median(r["tcp"] for r in results), statistics.median(r["connack"] for r in results),
+        statistics.median(r["sent"] for r in results), statistics.median(r["received"] for r in results),
+        statistics.median(r["round_trips"] for r in results)))
+
+
+def bench_broker(args):
+    ctx = tls_context(args)
+    full, resumed = [], []
+    for _ in range(args.rounds):
+        first = measure(ctx, args, None)
+        full.append(first)
+        second = measure(ctx, args, first["session"])
+        (resumed if second["resumed"] else full).append(second)
+    print("Broker %s:%d, cipher %s" % (args.host, args.port, full[0]["cipher"]))
+    print("%-8s %4s %9s %9s %9s %9s %7s %7s %5s" %
+          ("", "N", "TLS, ms", "p95, ms", "TCP, ms", "CONNACK", "Sent, B", "Recv, B", "RTT"))
+    summary("full", full)
+    summary("resumed", resumed)
+    if not resumed:
+        print("Broker does not resume TLS 1.2 sessions by session id: every device reconnect is full handshake")
+    print("Host CPU times only: ESP8266 needs ~1-2 s for full RSA/ECDHE handshake and ~0.1 s for resumed one;\n"
+          "use 'devices' mode for on-device handshake time and heap")
+#endregion
+
+
+#region Devices report
+FIELDS = ("Tls", "TlsResumed", "TlsHeap", "TlsStack", "TlsMfln", "TlsMinHeap")
+
+
+def parse_publish(header, body):
+    n = int.from_bytes(body[:2], "big")
+    topic = body[2:2 + n].decode()
+    i = 2 + n + (2 if (header >> 1) & 3 else 0)
+    return topic, body[i:]
+
+
+def bench_devices(args):
+    if args.plain:
+        conn = PlainConnection(args.host, args.port)
+    else:
+        conn = TlsConnection(tls_context(args), args.host, args.port)
+        conn.handshake()
+    conn.mqtt_connect("tls-bench-devices")
+    topic_filter = args.filter.rstrip("#").rstrip("/")
+    conn.mqtt_subscribe((topic_filter + "/#") if topic_filter else "#")
+    conn.sock.settimeout(1)
+
+    reports = {}
+    restarts = {}
+    deadline = time.time() + args.timeout
+    print("%-48s %7s %8s %8s %8s %8s %10s" % ("Device", "Tls, ms", "Resumed", "Heap, B", "Stack, B", "MFLN", "MinHeap, B"))
+    while time.time() < deadline:
+        try:
+            header, body = conn.read_packet()
+        except socket.timeout:
+            continue
+        if header >> 4 != 3:
+            continue
+        topic, payload = parse_publish(header, body)
+        if not topic.endswith("/Connection"):
+            continue
+        try:
+            report = json.loads(payload)
+        except ValueError:
+            continue
+        if "Tls" not in report:
+            continue
+        root = topic[:-len("Connection")]
+        reports.setdefault(root, []).append(report)
+        print("%-48s %7s %8s %8s %8s %8s %10s" % ((root,) + tuple(str(report.get(f, "-")) for f in FIELDS)))
+        sys.stdout.flush()
+        if restarts.get(root, 0) < args.restart:
+            restarts[root] = restarts.get(root, 0) + 1
+            conn.mqtt_publish(root + "Reset", b"1")
+        if args.restart and all(n >= args.restart for n in restarts.values()) and \
+                all(len(r) > args.restart for r in reports.values()):
+            break
+    conn.close()
+
+    samples = [r for rs in reports.values() for r in rs]
+    for name, resumed in (("full", 0), ("resumed", 1)):
+        times = [r["Tls"] for r in samples if r.get("TlsResumed", 0) == resumed]
+        heap = [r["TlsHeap"] for r in samples if r.get("TlsResumed", 0) == resumed]
+        if times:
+            print("%-8s %4d handshakes, median %d ms, max %d ms, heap median %d B, max %d B" %
+                  (name, len(times), statistics.median(times), max(times), statistics.median(heap), max(heap)))
+    stacks = [r["TlsStack"] for r in samples if "TlsStack" in r]
+    if stacks:
+        print("BearSSL stack high-water mark: %d B" % max(stacks))
+    if not samples:
+        sys.exit("No TLS connection reports received")
+
+#endregion
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    for mode in ("broker", "devices"):
+        p = sub.add_parser(mode)
+        p.add_argument("--host", default="localhost")
+        p.add_argument("--port", type=int, default=8883)
+        p.add_argument("--cafile", help="CA certificate to verify broker, not verified if omitted")
+        p.add_argument("--insecure", action="store_true", help="do not verify broker certificate")
+        if mode == "broker":
+            p.add_argument("--rounds", type=int, default=20, help="full + resumed handshake pairs")
+        else:
+            p.add_argument("--plain", action="store_true", help="subscribe without TLS (use plain port)")
+            p.add_argument("--filter", default="#", help="topic filter of devices to watch")
+            p.add_argument("--restart", type=int, default=0, help="restart every device this many times")
+            p.add_argument("--timeout", type=float, default=300, help="collect reports for this long, s")
+
+    args = parser.parse_args()
+    if args.mode == "broker":
+        bench_broker(args)
+    else:
+        bench_devices(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+"""AELib local UDP control sender and latency benchmark.
+
+Devices built with COMMS_UdpPort / COMMS_UdpKey accept commands directly over UDP: the same
+command topics as MQTT (relative to device root, e.g. "Relay1/SetState") executed by the same
+module handlers, without broker round trip. Resulting state is still published to MQTT.
+
+Datagram (big endian), MAC is HMAC-SHA256 keyed with COMMS_UdpKey truncated to 16 bytes:
+  command  version=1, 'C', device nonce (4), sequence (4), topic length (1), topic, payload, MAC
+  reply    version=1, 'R', device nonce (4), sequence (4), status (1), last sequence (4), MAC
+Device nonce is random per boot and sequence must grow. Sender starts with nonce 0: device
+answers "stale" with its nonce and last accepted sequence, sender retries with them.
+
+Modes:
+  send   send one command and print reply status and round trip time
+  bench  send --count commands cycling through --payloads and report round trip statistics;
+         with --mqtt-host also send the same commands via broker and measure time until device
+         publishes --state topic, i.e. compare UDP and MQTT control paths
+
+Examples:
+  udp_control.py send --host 192.168.1.50 --key secret --topic Relay1/SetState --payload 1
+  udp_control.py bench --host 192.168.1.50 --key secret --topic Relay1/SetState --payloads 1,0 \\
+      --mqtt-host 192.168.1.10 --root "SecondFloor/Bedroom/ESP_XXXXXXXXXXXX/" --state Relay1/State
+
+No dependencies except Python 3.
+"""
+
+import argparse
+import hashlib
+import hmac
+import socket
+import statistics
+import struct
+import sys
+import time
+
+VERSION = 1
+MAC_SIZE = 16
+STATUS = {0: "ok", 1: "unknown topic", 2: "stale", 3: "malformed"}
+
+
+class UdpControl:
+    def __init__(self, host, port, key, timeout):
+        self.address = (host, port)
+        self.key = key.encode()
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(timeout)
+        self.nonce = 0
+        self.seq = 0
+
+    def mac(self, data):
+        return hmac.new(self.key, data, hashlib.sha256).digest()[:MAC_SIZE]
+
+    def command(self, topic, payload):
+        self.seq = (self.seq + 1) & 0xFFFFFFFF
+        topic = topic.encode()
+        body = struct.pack(">BcIIB", VERSION, b"C", self.nonce, self.seq, len(topic)) + topic + payload
+        return body + self.mac(body)
+
+    def parse_reply(self, data):
+        if len(data) != 15 + MAC_SIZE or not hmac.compare_digest(self.mac(data[:15]), data[15:]):
+            return None
+        version, kind, nonce, seq, status, last = struct.unpack(">BcIIBI", data[:15])
+        if version != VERSION or kind != b"R":
+            return None
+        return nonce, seq, status, last
+
+    def send(self, topic, payload):
+        """Returns (status, round trip ms). Resynchronizes nonce / sequence once if device asks to."""
+        for _ in range(2):
+            packet = self.command(topic, payload)
+            started = time.perf_counter()
+            self.sock.sendto(packet, self.address)
+            while True:
+                try:
+                    data, _ = self.sock.recvfrom(256)
+                except socket.timeout:
+                    return None, None
+                reply = self.parse_reply(data)
+                if reply and reply[1] == self.seq:
+                    break
+            rtt = (time.perf_counter() - started) * 1000
+            nonce, _, status, last = reply
+            if status != 2:
+                return status, rtt
+            self.nonce, self.seq = nonce, last
+        return status, rtt
+
+
+#region MQTT path
+def varint(n):
+    out = b""
+    while True:
+        b = n & 0x7F
+        n >>= 7
+        out += bytes([b | 0x80 if n else b])
+        if not n:
+            return out
+
+
+def string(s):
+    s = s.encode() if isinstance(s, str) else s
+    return struct.pack(">H", len(s)) + s
+
+
+class MqttPath:
+    """Publish command via broker and wait for device state publication."""
+
+    def __init__(self, host, port, state_topic, timeout):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.state_topic = state_topic
+        body = string("MQTT") + bytes([4, 0x02]) + struct.pack(">H", 30) + string("udp-control-bench")
+        self.sock.sendall(bytes([0x10]) + varint(len(body)) + body)
+        self.read()
+        body = struct.pack(">H", 1) + string(state_topic) + b"\x00"
+        self.sock.sendall(bytes([0x82]) + varint(len(body)) + body)
+        # SUBACK and retained state
+        self.drain(0.5)
+
+    def recv(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise RuntimeError("connection closed")
+            data += chunk
+        return data
+
+    def read(self):
+        header = self.recv(1)[0]
+        length, shift = 0, 0
+        while True:
+            b = self.recv(1)[0]
+            length |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        return header, self.recv(length)
+
+    def drain(self, timeout):
+        saved = self.sock.gettimeout()
+        self.sock.settimeout(timeout)
+        try:
+            while True:
+                self.read()
+        except socket.timeout:
+            pass
+        self.sock.settimeout(saved)
+
+    def send(self, topic, payload):
+        body = string(topic) + payload
+        started = time.perf_counter()
+        self.sock.sendall(bytes([0x30]) + varint(len(body)) + body)
+        try:
+            while True:
+                header, body = self.read()
+                if header >> 4 != 3:
+                    continue
+                n = int.from_bytes(body[:2], "big")
+                if body[2:2 + n].decode() == self.state_topic:
+                    return (time.perf_counter() - started) * 1000
+        except socket.timeout:
+            return None
+#endregion
+
+
+def stats(name, times, count):
+    ok = [t for t in times if t is not None]
+    if not ok:
+        print("%-5s no replies out of %d" % (name, count))
+        return
+    ok.sort()
+    print("%-5s %4d/%-4d median %7.2f ms, p95 %7.2f ms, max %7.2f ms" %
+          (name, len(ok), count, statistics.median(ok), ok[max(0, int(len(ok) * 0.95) - 1)], ok[-1]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="mode", required=True)
+    for mode in ("send", "bench"):
+        p = sub.add_parser(mode)
+        p.add_argument("--host", required=True, help="device address")
+        p.add_argument("--port", type=int, default=4210, help="COMMS_UdpPort")
+        p.add_argument("--key", required=True, help="COMMS_UdpKey")
+        p.add_argument("--topic", required=True, help="command topic relative to device root")
+        p.add_argument("--timeout", type=float, default=1.0, help="reply timeout, s")
+        if mode == "send":
+            p.add_argument("--payload", default="")
+        else:
+            p.add_argument("--payloads", default="1,0", help="comma separated payloads to cycle through")
+            p.add_argument("--count", type=int, default=100)
+            p.add_argument("--interval", type=float, default=0.2, help="pause between commands, s")
+            p.add_argument("--mqtt-host", help="broker to compare MQTT control path with")
+            p.add_argument("--mqtt-port", type=int, default=1883)
+            p.add_argument("--root", help="device root topic, required with --mqtt-host")
+            p.add_argument("--state", help="state topic relative to device root, required with --mqtt-host")
+    args = parser.parse_args()
+
+    udp = UdpControl(args.host, args.port, args.key, args.timeout)
+    if args.mode == "send":
+        status, rtt = udp.send(args.topic, args.payload.encode())
+        if status is None:
+            sys.exit("No reply")
+        print("%s in %.2f ms" % (STATUS.get(status, status), rtt))
+        sys.exit(0 if status == 0 else 1)
+
+    payloads = [p.encode() for p in args.payloads.split(",")]
+    times = []
+    for i in range(args.count):
+        status, rtt = udp.send(args.topic, payloads[i % len(payloads)])
+        times.append(rtt if status == 0 else None)
+        time.sleep(args.interval)
+    stats("UDP", times, args.count)
+
+    if args.mqtt_host:
+        if not (args.root and args.state):
+            sys.exit("--root and --state are required with --mqtt-host")
+        root = args.root if args.root.endswith("/") else args.root + "/"
+        mqtt = MqttPath(args.mqtt_host, args.mqtt_port, root + args.state, args.timeout)
+        times = []
+        for i in range(args.count):
+            # Same payload twice does not change state and is not published
+            times.append(mqtt.send(root + args.topic, payloads[i % len(payloads)]))
+            time.sleep(args.interval)
+        stats("MQTT", times, args.count)
+
+
+if __name__ == "__main__":
+    main()